@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "aot.h"
+
+// FNV-1a over the bytes a block was translated from
+uint32_t aot_hash(const uint8_t* bytes, int length)
+{
+    uint32_t hash = 0x811c9dc5;
+
+    for (int i = 0; i < length; i++) hash = (hash ^ bytes[i]) * 0x01000193;
+
+    return hash;
+}
+
+#if AOT
+
+// The bytes bank `bank` holds where it would be mapped at pc, or NULL if the
+// cartridge has no such bank
+static const uint8_t* bank_bytes(Memory* mem, int bank, uint16_t pc, int length)
+{
+    if (!mem->cart) return aot_rom_bank(mem, pc) == bank ? bus_span(mem->readPages, pc, length) : NULL;
+    if (bank >= mem->cart->romBanks) return NULL;
+
+    size_t offset = (size_t)bank * ROM_BANK_SIZE + (pc & (ROM_BANK_SIZE - 1));
+    return offset + length <= mem->cart->fileSize ? mem->cart->rom + offset : NULL;
+}
+
+// Table of the linked translations that match the cartridge in mem, in any
+// of its banks, or NULL if the program was built without a generated file
+AotTable* make_aot_table(Memory* mem)
+{
+    if (!&aot_bank_count) return NULL;
+
+    AotTable* table = calloc(1, sizeof(AotTable));
+
+    for (int i = 0; i < aot_bank_count; i++)
+    {
+        const AotBank* bank = &aot_banks[i];
+        if (bank->bank >= AOT_MAX_BANKS) continue;
+
+        for (int j = 0; j < bank->count; j++)
+        {
+            const AotBlock* block = &bank->blocks[j];
+            int length = block->endPc - block->pc;
+
+            const uint8_t* code = bank_bytes(mem, bank->bank, block->pc, length);
+            if (!code || aot_hash(code, length) != block->hash) continue;
+
+            AotBankTable* bankTable = table->banks[bank->bank];
+            if (!bankTable) bankTable = table->banks[bank->bank] = calloc(1, sizeof(AotBankTable));
+
+            int offset = block->pc & (ROM_BANK_SIZE - 1);
+            bankTable->blocks[offset] = block;
+            for (int covered = offset; covered < offset + length; covered++) bankTable->codeCount[covered]++;
+            table->numBlocks++;
+        }
+    }
+
+    return table;
+}
+
+void free_aot_table(AotTable* table)
+{
+    if (!table) return;
+
+    for (int bank = 0; bank < AOT_MAX_BANKS; bank++) free(table->banks[bank]);
+    free(table);
+}
+
+// Called on every write below AOT_ROM_END; drops the blocks of the bank
+// mapped there that cover addr
+void aot_invalidate(AotTable* table, Memory* mem, uint16_t addr)
+{
+    if (addr >= AOT_ROM_END) return;
+
+    AotBankTable* bankTable = table->banks[aot_rom_bank(mem, addr)];
+    int offset = addr & (ROM_BANK_SIZE - 1);
+    if (!bankTable || !bankTable->codeCount[offset]) return;
+
+    int first = offset >= AOT_MAX_BLOCK_BYTES ? offset - AOT_MAX_BLOCK_BYTES + 1 : 0;
+
+    for (int start = first; start <= offset; start++)
+    {
+        const AotBlock* block = bankTable->blocks[start];
+        if (!block || addr >= block->endPc || addr < block->pc) continue;
+
+        bankTable->blocks[start] = NULL;
+        table->numBlocks--;
+        table->invalidations++;
+
+        int end = start + (block->endPc - block->pc);
+        for (int covered = start; covered < end; covered++) bankTable->codeCount[covered]--;
+    }
+}
+
+// Runs translated blocks wherever PC has one for the bank switched in and the
+// interpreter everywhere else until the cycle counter reaches limit. Like
+// run_blocks, interrupts that a block enables or requests are taken once it
+// ends.
+void run_aot(CPU* cpu, uint64_t limit)
+{
+    AotTable* table = cpu->aot;
+
+    while (cpu->cycles < limit)
+    {
+        if (cpu->checkState) limit = event_limit(cpu, limit);
+
+        // EI's delay, HALT and interrupts are handled an instruction at a time
+        const AotBlock* block = NULL;
+        if (!cpu->checkState && cpu->pc < AOT_ROM_END) block = aot_block_at(table, aot_rom_bank(cpu->mem, cpu->pc), cpu->pc);
+
+        if (block)
+        {
+            cpu->cycles += block->code(cpu);
+            cpu->blockCycles = 0;
+            table->blockRuns++;
+        }
+        else
+        {
+            step_until(cpu, limit);
+            table->interpreted++;
+        }
+    }
+}
+
+void print_aot_stats(AotTable* table)
+{
+    int translated = 0;
+    for (int i = 0; i < aot_bank_count; i++) translated += aot_banks[i].count;
+
+    printf("AOT: %d of %d translated blocks in use, %llu block runs, %llu interpreted steps, %llu invalidations\n",
+        table->numBlocks, translated, (unsigned long long)table->blockRuns, (unsigned long long)table->interpreted,
+        (unsigned long long)table->invalidations);
+}
+
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "cartridge.h"
+
+// Ahead-of-time translation of ROM code to C. recompiler/recompile.c walks
+// every bank of a ROM from its entry points and writes one C function per
+// basic block plus a table of them per bank; building that file into the
+// program with -DAOT=1 lets run_until call the translations instead of
+// interpreting. Code that wasn't translated, or has changed since, still goes
+// through the interpreter.
+
+// Limits on one translated block, so invalidation only has to look back
+// AOT_MAX_BLOCK_BYTES addresses for blocks covering a written byte
+#define AOT_MAX_OPS 64
+#define AOT_MAX_BLOCK_BYTES (3 * AOT_MAX_OPS)
+
+// Translations only cover the cartridge ROM, up to the 512 banks of MBC5
+#define AOT_ROM_END 0x8000
+#define AOT_MAX_BANKS 512
+
+typedef int (*AotCode)(CPU* cpu);
+
+// One translated block: the code it was generated from lies at pc up to endPc
+// in ROM bank `bank` and hashes to `hash` (see aot_hash)
+typedef struct AotBlock
+{
+    uint16_t pc;
+    uint16_t endPc;
+    uint16_t bank;
+    uint32_t hash;
+    AotCode code;
+} AotBlock;
+
+// The blocks translated from one ROM bank. Bank 0 blocks lie at 0x0000-0x3fff
+// and those of every other bank at 0x4000-0x7fff.
+typedef struct AotBank
+{
+    uint16_t bank;
+    int count;
+    const AotBlock* blocks;
+} AotBank;
+
+// Defined by the generated file. Weak so the program still links, and simply
+// interprets everything, without one.
+extern const AotBank aot_banks[] __attribute__((weak));
+extern const int aot_bank_count __attribute__((weak));
+
+// Translated blocks of one bank by start address within it; NULL where there
+// is none or the memory under it no longer matches what was translated
+typedef struct AotBankTable
+{
+    const AotBlock* blocks[ROM_BANK_SIZE];
+
+    // Number of blocks in use covering each address, so writes elsewhere
+    // can skip the search
+    uint8_t codeCount[ROM_BANK_SIZE];
+} AotBankTable;
+
+// Translations keyed by (bank, pc), with a table only for the banks that
+// have any
+typedef struct AotTable
+{
+    AotBankTable* banks[AOT_MAX_BANKS];
+    int numBlocks;
+
+    uint64_t blockRuns;
+    uint64_t interpreted;
+    uint64_t invalidations;
+} AotTable;
+
+uint32_t aot_hash(const uint8_t* bytes, int length);
+
+// ROM bank mapped at addr: whatever the cartridge's controller has switched
+// in, or for plain memory the fixed banks 0 and 1 of a 32 KiB image
+static inline uint16_t aot_rom_bank(Memory* mem, uint16_t addr)
+{
+    return mem->cart ? mapped_rom_bank(mem, addr) : addr >= 0x4000;
+}
+
+// The translation of bank `bank` starting at pc, if it is still in use
+static inline const AotBlock* aot_block_at(AotTable* table, uint16_t bank, uint16_t pc)
+{
+    AotBankTable* bankTable = table->banks[bank];
+    const AotBlock* block = bankTable ? bankTable->blocks[pc & (ROM_BANK_SIZE - 1)] : NULL;
+
+    // MBC1 can also map a bank at 0x0000, where its translation doesn't apply
+    return block && block->pc == pc ? block : NULL;
+}
+
+#if AOT
+AotTable* make_aot_table(Memory* mem);
+void free_aot_table(AotTable* table);
+void aot_invalidate(AotTable* table, Memory* mem, uint16_t addr);
+void run_aot(CPU* cpu, uint64_t limit);
+void print_aot_stats(AotTable* table);
+#endif
+
+// Helpers for the generated code. A block keeps A, the other 8-bit registers
+// and the flags in locals, and only writes them back to the CPU around
+// interpreter calls and when it exits, so the C compiler can allocate them to
+// host registers and drop flag results nothing reads.
+#define AOT_LOCALS uint8_t a, b, c, d, e, h, l; bool fz, fn, fh, fc
+
+#if FLAT_REGS
+#define AOT_LOAD_FLAGS(cpu) (fz = (cpu)->z, fn = (cpu)->n, fh = (cpu)->half_carry, fc = (cpu)->carry)
+#define AOT_STORE_FLAGS(cpu) ((cpu)->z = fz, (cpu)->n = fn, (cpu)->half_carry = fh, (cpu)->carry = fc)
+#else
+#define AOT_LOAD_FLAGS(cpu) (fz = (cpu)->f & 0x80, fn = (cpu)->f & 0x40, fh = (cpu)->f & 0x20, fc = (cpu)->f & 0x10)
+#define AOT_STORE_FLAGS(cpu) ((cpu)->f = (fz << 7) | (fn << 6) | (fh << 5) | (fc << 4))
+#endif
+
+#define AOT_LOAD(cpu) \
+    (a = (cpu)->a, b = (cpu)->b, c = (cpu)->c, d = (cpu)->d, e = (cpu)->e, h = (cpu)->h, l = (cpu)->l, AOT_LOAD_FLAGS(cpu))
+#define AOT_STORE(cpu) \
+    ((cpu)->a = a, (cpu)->b = b, (cpu)->c = c, (cpu)->d = d, (cpu)->e = e, (cpu)->h = h, (cpu)->l = l, AOT_STORE_FLAGS(cpu))
+
+// Whether an interpreted instruction just overwrote the block of `bank`
+// starting at pc or switched that bank out
+#define AOT_STALE(cpu, bank, pc) (aot_rom_bank((cpu)->mem, pc) != (bank) || !aot_block_at((cpu)->aot, bank, pc))
@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "batch.h"
+#include "opcodes.h"
+
+// 32 states per vector operation: one AVX2 register, or two SSE2 registers
+// without AVX2
+#define LANES 32
+
+// The kernels are built for AVX2 as well as the baseline, and the loader
+// picks the clone the CPU runs, so one binary gets the wide registers where
+// they exist
+#if defined(__x86_64__) && !defined(__AVX2__)
+#define KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define KERNEL
+#endif
+
+// batch_run only sorts states into groups when at least this percentage of
+// them would fill whole vectors of an opcode with a kernel; below that the
+// gather and scatter cost more than the kernels save
+#ifndef MIN_VECTOR_PERCENT
+#define MIN_VECTOR_PERCENT 50
+#endif
+
+typedef uint8_t ByteVec __attribute__((vector_size(LANES)));
+
+// Unaligned view of the state arrays. Macros rather than functions: passing
+// vectors by value would depend on whether AVX is enabled.
+typedef uint8_t UnalignedVec __attribute__((vector_size(LANES), aligned(1), may_alias));
+
+#define load_vec(src) ((ByteVec)*(const UnalignedVec*)(src))
+#define store_vec(dst, value) (*(UnalignedVec*)(dst) = (value))
+
+// Comparisons give 0 or -1 per lane; this turns them into 0 or bit
+#define MASK_BIT(cond, bit) ((ByteVec)(cond) & (bit))
+
+static void alloc_regs(BatchRegs* regs, int capacity)
+{
+    for (int i = 0; i < 8; i++) regs->r[i] = i == 6 ? NULL : calloc(capacity, 1);
+    regs->f = calloc(capacity, 1);
+    regs->sp = calloc(capacity, sizeof(uint16_t));
+    regs->pc = calloc(capacity, sizeof(uint16_t));
+    regs->cycles = calloc(capacity, 1);
+    regs->mems = calloc(capacity, sizeof(Memory*));
+}
+
+static void free_regs(BatchRegs* regs)
+{
+    for (int i = 0; i < 8; i++) free(regs->r[i]);
+    free(regs->f);
+    free(regs->sp);
+    free(regs->pc);
+    free(regs->cycles);
+    free(regs->mems);
+}
+
+Batch* make_batch(int capacity)
+{
+    Batch* batch = calloc(1, sizeof(Batch));
+    batch->capacity = capacity;
+
+    alloc_regs(&batch->regs, capacity);
+    alloc_regs(&batch->sorted, capacity);
+    batch->imms = calloc(capacity, 1);
+    batch->opcodes = calloc(capacity, sizeof(uint16_t));
+    batch->sortedImms = calloc(capacity, 1);
+    batch->sortedOpcodes = calloc(capacity, sizeof(uint16_t));
+    batch->order = calloc(capacity, sizeof(uint32_t));
+    batch->scratch = make_cpu(NULL);
+
+    return batch;
+}
+
+void free_batch(Batch* batch)
+{
+    free_regs(&batch->regs);
+    free_regs(&batch->sorted);
+    free(batch->imms);
+    free(batch->opcodes);
+    free(batch->sortedImms);
+    free(batch->sortedOpcodes);
+    free(batch->order);
+    free(batch->scratch);
+    free(batch);
+}
+
+// Copies the registers and memory of cpu into a new state and returns its
+// index, or -1 if the batch is full
+int batch_add(Batch* batch, CPU* cpu)
+{
+    if (batch->count == batch->capacity) return -1;
+
+    int index = batch->count++;
+    BatchRegs* regs = &batch->regs;
+
+    regs->r[0][index] = cpu->b;
+    regs->r[1][index] = cpu->c;
+    regs->r[2][index] = cpu->d;
+    regs->r[3][index] = cpu->e;
+    regs->r[4][index] = cpu->h;
+    regs->r[5][index] = cpu->l;
+    regs->r[7][index] = cpu->a;
+    regs->f[index] = read_flags(cpu);
+    regs->sp[index] = cpu->sp;
+    regs->pc[index] = cpu->pc;
+    regs->cycles[index] = 0;
+    regs->mems[index] = cpu->mem;
+
+    return index;
+}
+
+// Empties the batch for reuse
+void batch_clear(Batch* batch)
+{
+    batch->count = 0;
+}
+
+void batch_get(Batch* batch, int index, CPU* cpu)
+{
+    BatchRegs* regs = &batch->regs;
+
+    cpu->b = regs->r[0][index];
+    cpu->c = regs->r[1][index];
+    cpu->d = regs->r[2][index];
+    cpu->e = regs->r[3][index];
+    cpu->h = regs->r[4][index];
+    cpu->l = regs->r[5][index];
+    cpu->a = regs->r[7][index];
+    write_flags(cpu, regs->f[index]);
+    cpu->sp = regs->sp[index];
+    cpu->pc = regs->pc[index];
+    cpu->mem = regs->mems[index];
+}
+
+// Runs state index of regs through execute_inst on the scratch CPU
+static void run_scalar(Batch* batch, BatchRegs* regs, int index)
+{
+    CPU* cpu = batch->scratch;
+
+    cpu->b = regs->r[0][index];
+    cpu->c = regs->r[1][index];
+    cpu->d = regs->r[2][index];
+    cpu->e = regs->r[3][index];
+    cpu->h = regs->r[4][index];
+    cpu->l = regs->r[5][index];
+    cpu->a = regs->r[7][index];
+    write_flags(cpu, regs->f[index]);
+    cpu->sp = regs->sp[index];
+    cpu->pc = regs->pc[index];
+    cpu->mem = regs->mems[index];
+
+    // Every state starts with interrupts off and the CPU running
+    cpu->ime = false;
+    cpu->imeDelay = 0;
+    cpu->halted = false;
+    cpu->stopped = false;
+    cpu->haltBug = false;
+    cpu->checkState = false;
+
+    regs->cycles[index] = execute_inst(cpu);
+
+    regs->r[0][index] = cpu->b;
+    regs->r[1][index] = cpu->c;
+    regs->r[2][index] = cpu->d;
+    regs->r[3][index] = cpu->e;
+    regs->r[4][index] = cpu->h;
+    regs->r[5][index] = cpu->l;
+    regs->r[7][index] = cpu->a;
+    regs->f[index] = read_flags(cpu);
+    regs->sp[index] = cpu->sp;
+    regs->pc[index] = cpu->pc;
+}
+
+// Vector kernels. Each handles states start to end of one opcode group in the
+// sorted copy, LANES at a time; the remainder goes through run_scalar.
+
+// LD r,r'
+KERNEL static int ld_kernel(BatchRegs* s, int start, int end, int dst, int src)
+{
+    int i;
+    for (i = start; i + LANES <= end; i += LANES) store_vec(s->r[dst] + i, load_vec(s->r[src] + i));
+
+    return i;
+}
+
+// ADD, ADC, SUB, SBC, AND, XOR, OR or CP of A and operand
+KERNEL static int alu_kernel(BatchRegs* s, int start, int end, int aluOp, const uint8_t* operand)
+{
+    int i;
+    for (i = start; i + LANES <= end; i += LANES)
+    {
+        ByteVec a = load_vec(s->r[7] + i);
+        ByteVec value = load_vec(operand + i);
+        ByteVec f = load_vec(s->f + i);
+        ByteVec carryIn = (aluOp == 1 || aluOp == 3) ? (f >> 4) & 1 : (ByteVec){ 0 };
+        ByteVec result;
+        ByteVec flags;
+
+        switch (aluOp)
+        {
+            case 0:
+            case 1:
+            {
+                ByteVec sum = a + value;
+                result = sum + carryIn;
+                ByteVec carry = MASK_BIT(sum < a, 0x10) | MASK_BIT(result < sum, 0x10);
+                flags = carry | ((((a & 0xf) + (value & 0xf) + carryIn) & 0x10) << 1);
+                break;
+            }
+            case 2:
+            case 3:
+            case 7:
+            {
+                ByteVec diff = a - value;
+                result = diff - carryIn;
+                ByteVec carry = MASK_BIT(a < value, 0x10) | MASK_BIT(diff < carryIn, 0x10);
+                flags = 0x40 | carry | ((((a & 0xf) - (value & 0xf) - carryIn) & 0x10) << 1);
+                break;
+            }
+            case 4:
+                result = a & value;
+                flags = (ByteVec){ 0 } + 0x20;
+                break;
+            case 5:
+                result = a ^ value;
+                flags = (ByteVec){ 0 };
+                break;
+            default:
+                result = a | value;
+                flags = (ByteVec){ 0 };
+                break;
+        }
+
+        store_vec(s->f + i, flags | MASK_BIT(result == 0, 0x80));
+        if (aluOp != 7) store_vec(s->r[7] + i, result);
+    }
+
+    return i;
+}
+
+// INC r or DEC r, carry unchanged
+KERNEL static int inc_dec_kernel(BatchRegs* s, int start, int end, int reg, bool dec)
+{
+    int i;
+    for (i = start; i + LANES <= end; i += LANES)
+    {
+        ByteVec value = load_vec(s->r[reg] + i);
+        ByteVec f = load_vec(s->f + i);
+        ByteVec result = dec ? value - 1 : value + 1;
+        ByteVec halfCarry = dec ? MASK_BIT((value & 0xf) == 0, 0x20) : MASK_BIT((result & 0xf) == 0, 0x20);
+
+        store_vec(s->r[reg] + i, result);
+        store_vec(s->f + i, (f & 0x10) | (uint8_t)(dec ? 0x40 : 0) | halfCarry | MASK_BIT(result == 0, 0x80));
+    }
+
+    return i;
+}
+
+// CB-prefixed rotates, shifts, SWAP, BIT, RES and SET on a register
+KERNEL static int cb_kernel(BatchRegs* s, int start, int end, uint8_t cbInst)
+{
+    int reg = cbInst & 7;
+    int bitIndex = (cbInst >> 3) & 7;
+    uint8_t bitMask = 1 << bitIndex;
+
+    int i;
+    for (i = start; i + LANES <= end; i += LANES)
+    {
+        ByteVec value = load_vec(s->r[reg] + i);
+        ByteVec f = load_vec(s->f + i);
+        ByteVec carryIn = (f >> 4) & 1;
+        ByteVec result = value;
+        ByteVec carry = (ByteVec){ 0 };
+
+        if (cbInst >= 0x40)
+        {
+            if (cbInst < 0x80)
+            {
+                store_vec(s->f + i, (f & 0x10) | 0x20 | MASK_BIT((value & bitMask) == 0, 0x80));
+                continue;
+            }
+            store_vec(s->r[reg] + i, cbInst < 0xc0 ? value & (uint8_t)~bitMask : value | bitMask);
+            continue;
+        }
+
+        switch (bitIndex)
+        {
+            case 0: carry = value >> 7; result = (value << 1) | carry; break;
+            case 1: carry = value & 1; result = (value >> 1) | (carry << 7); break;
+            case 2: carry = value >> 7; result = (value << 1) | carryIn; break;
+            case 3: carry = value & 1; result = (value >> 1) | (carryIn << 7); break;
+            case 4: carry = value >> 7; result = value << 1; break;
+            case 5: carry = value & 1; result = (value >> 1) | (value & 0x80); break;
+            case 6: result = (value << 4) | (value >> 4); break;
+            default: carry = value & 1; result = value >> 1; break;
+        }
+
+        store_vec(s->r[reg] + i, result);
+        store_vec(s->f + i, (carry << 4) | MASK_BIT(result == 0, 0x80));
+    }
+
+    return i;
+}
+
+// Whether run_group has a vector kernel for opcode
+static bool has_kernel(int opcode)
+{
+    int dst = (opcode >> 3) & 7;
+    int src = opcode & 7;
+
+    if (opcode >= 0x100) return src != 6;
+    if (opcode >= 0x40 && opcode < 0x80) return dst != 6 && src != 6;
+    if (opcode >= 0x80 && opcode < 0xc0) return src != 6;
+    if (opcode >= 0xc0) return src == 6;
+
+    return (src == 4 || src == 5) && dst != 6;
+}
+
+// Runs states start to end of regs, which all have the given opcode, with its
+// vector kernel and returns the first state left for run_scalar. opcode is
+// 0x100 | n for CB n.
+static int run_group(Batch* batch, BatchRegs* s, const uint8_t* imms, int opcode, int start, int end)
+{
+    int dst = (opcode >> 3) & 7;
+    int src = opcode & 7;
+    int done = start;
+
+    if (opcode >= 0x100)
+    {
+        if (src != 6) done = cb_kernel(s, start, end, opcode & 0xff);
+    }
+    else if (opcode >= 0x40 && opcode < 0x80)
+    {
+        if (dst != 6 && src != 6) done = ld_kernel(s, start, end, dst, src);
+    }
+    else if (opcode >= 0x80 && opcode < 0xc0)
+    {
+        if (src != 6) done = alu_kernel(s, start, end, dst, s->r[src]);
+    }
+    else if (opcode >= 0xc0 && src == 6)
+    {
+        done = alu_kernel(s, start, end, dst, imms);
+    }
+    else if (opcode < 0x40 && (src == 4 || src == 5) && dst != 6)
+    {
+        done = inc_dec_kernel(s, start, end, dst, src == 5);
+    }
+
+    batch->vectorStates += done - start;
+
+    const OpcodeInfo* info = &opcode_info[opcode];
+    for (int i = start; i < done; i++)
+    {
+        s->pc[i] += info->length;
+        s->cycles[i] = info->cycles;
+    }
+
+    return done;
+}
+
+static void run_groups(Batch* batch, BatchRegs* s, const uint8_t* imms, const uint16_t* opcodes, int count)
+{
+    int start = 0;
+    while (start < count)
+    {
+        int end = start + 1;
+        while (end < count && opcodes[end] == opcodes[start]) end++;
+
+        for (int k = run_group(batch, s, imms, opcodes[start], start, end); k < end; k++) run_scalar(batch, s, k);
+        start = end;
+    }
+}
+
+#define GATHER(dst, src) for (int k = 0; k < count; k++) (dst)[k] = (src)[order[k]]
+#define SCATTER(dst, src) for (int k = 0; k < count; k++) (dst)[order[k]] = (src)[k]
+
+// Runs every state's instruction. Each run of states with the same opcode
+// goes through a vector kernel over contiguous arrays; loads and stores to
+// (HL), control flow and everything else take the scalar path. States that
+// aren't already grouped by opcode (as test vectors usually are) are sorted
+// into a grouped copy first, one array at a time, if enough of them share an
+// opcode; otherwise they all run as in batch_run_scalar.
+void batch_run(Batch* batch)
+{
+    BatchRegs* regs = &batch->regs;
+    int count = batch->count;
+    int* groupStart = batch->groupStart;
+    int runs = 0;
+    int groups = 0;
+
+    memset(groupStart, 0, sizeof(batch->groupStart));
+
+    for (int i = 0; i < count; i++)
+    {
+        Memory* mem = regs->mems[i];
+        uint16_t pc = regs->pc[i];
+        uint16_t opcode = bus_read8(mem, pc);
+        uint8_t next = bus_read8(mem, pc + 1);
+
+        if (opcode == 0xcb) opcode = 0x100 | next;
+
+        batch->opcodes[i] = opcode;
+        batch->imms[i] = next;
+        groups += groupStart[opcode + 1]++ == 0;
+        runs += i == 0 || opcode != batch->opcodes[i - 1];
+    }
+
+    if (runs == groups)
+    {
+        run_groups(batch, regs, batch->imms, batch->opcodes, count);
+        return;
+    }
+
+    int vectorStates = 0;
+    for (int op = 0; op < 0x200; op++)
+    {
+        if (has_kernel(op)) vectorStates += groupStart[op + 1] / LANES * LANES;
+    }
+
+    if (vectorStates * 100 < count * MIN_VECTOR_PERCENT)
+    {
+        batch_run_scalar(batch);
+        return;
+    }
+
+    for (int op = 0; op < 0x200; op++) groupStart[op + 1] += groupStart[op];
+
+    // Counting sort by opcode
+    uint32_t* order = batch->order;
+    int next[0x200];
+    memcpy(next, groupStart, sizeof(next));
+
+    for (int i = 0; i < count; i++) order[next[batch->opcodes[i]]++] = i;
+
+    BatchRegs* s = &batch->sorted;
+    uint8_t* imms = batch->sortedImms;
+    uint16_t* opcodes = batch->sortedOpcodes;
+
+    for (int r = 0; r < 8; r++)
+    {
+        if (r != 6) GATHER(s->r[r], regs->r[r]);
+    }
+    GATHER(s->f, regs->f);
+    GATHER(s->sp, regs->sp);
+    GATHER(s->pc, regs->pc);
+    GATHER(s->mems, regs->mems);
+    GATHER(imms, batch->imms);
+    GATHER(opcodes, batch->opcodes);
+
+    run_groups(batch, s, imms, opcodes, count);
+
+    for (int r = 0; r < 8; r++)
+    {
+        if (r != 6) SCATTER(regs->r[r], s->r[r]);
+    }
+    SCATTER(regs->f, s->f);
+    SCATTER(regs->sp, s->sp);
+    SCATTER(regs->pc, s->pc);
+    SCATTER(regs->cycles, s->cycles);
+}
+
+// The same, one state at a time through execute_inst
+void batch_run_scalar(Batch* batch)
+{
+    for (int i = 0; i < batch->count; i++) run_scalar(batch, &batch->regs, i);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+// One array per register, indexed by state. r uses the opcode register order
+// B, C, D, E, H, L, (HL), A; the (HL) slot is always NULL.
+typedef struct BatchRegs
+{
+    uint8_t* r[8];
+    uint8_t* f;
+    uint16_t* sp;
+    uint16_t* pc;
+    uint8_t* cycles;    // M-cycles the state's instruction took
+    Memory** mems;
+} BatchRegs;
+
+// Many independent CPU states that each run the one instruction at their PC.
+// States may share a Memory when the instructions under test don't write it.
+typedef struct Batch
+{
+    int count;
+    int capacity;
+    BatchRegs regs;
+
+    // batch_run's scratch: each state's opcode (0x100 | n for CB n) and the
+    // byte after it, and the states grouped by opcode with where each came
+    // from
+    uint16_t* opcodes;
+    uint8_t* imms;
+    BatchRegs sorted;
+    uint16_t* sortedOpcodes;
+    uint8_t* sortedImms;
+    uint32_t* order;
+    int groupStart[0x201];
+
+    CPU* scratch;       // runs the states no vector kernel covers
+
+    uint64_t vectorStates;  // states batch_run has put through a kernel
+} Batch;
+
+Batch* make_batch(int capacity);
+void free_batch(Batch* batch);
+void batch_clear(Batch* batch);
+int batch_add(Batch* batch, CPU* cpu);
+void batch_get(Batch* batch, int index, CPU* cpu);
+void batch_run(Batch* batch);
+void batch_run_scalar(Batch* batch);
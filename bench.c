@@ -0,0 +1,626 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "cpu.h"
+#include "block-cache.h"
+#include "batch.h"
+#include "cartridge.h"
+#include "emulator.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_TSC 1
+#else
+#define HAS_TSC 0
+#endif
+
+#define BENCH_PASSES 200000
+
+typedef struct BenchTimer
+{
+    struct timespec start;
+    uint64_t startTsc;
+} BenchTimer;
+
+static void timer_start(BenchTimer* timer)
+{
+    clock_gettime(CLOCK_MONOTONIC, &timer->start);
+#if HAS_TSC
+    timer->startTsc = __rdtsc();
+#endif
+}
+
+// Prints the time per operation since timer_start and returns it in ns
+static double timer_report(BenchTimer* timer, const char* name, uint64_t ops)
+{
+    struct timespec end;
+#if HAS_TSC
+    uint64_t tsc = __rdtsc() - timer->startTsc;
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (end.tv_sec - timer->start.tv_sec) * 1e9 + (end.tv_nsec - timer->start.tv_nsec);
+
+#if HAS_TSC
+    printf("%-32s %8.2f ns/op %8.2f TSC cycles/op\n", name, ns / ops, (double)tsc / ops);
+#else
+    printf("%-32s %8.2f ns/op\n", name, ns / ops);
+#endif
+
+    return ns / ops;
+}
+
+// The register/(HL) operand block 0x40-0xbf (LD r,r' and the 8-bit ALU) run
+// straight through, skipping HALT. The block is restored every pass since
+// LD (HL),r may land on it.
+static void run_operand_block(CPU* cpu, const char* name)
+{
+    uint8_t block[0x80];
+    int blockLength = 0;
+    for (int inst = 0x40; inst < 0xc0; inst++)
+    {
+        if (inst != 0x76) block[blockLength++] = inst;
+    }
+
+    cpu->hl = 0xc000;
+    cpu->sp = 0xfffe;
+
+    BenchTimer timer;
+    timer_start(&timer);
+
+    for (int pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        memcpy(&cpu->mem->ram[0x100], block, blockLength);
+        cpu->pc = 0x100;
+
+        for (int i = 0; i < blockLength; i++) execute_inst(cpu);
+    }
+
+    timer_report(&timer, name, (uint64_t)BENCH_PASSES * blockLength);
+}
+
+void bench_operand_block(void)
+{
+    Memory* mem = make_memory();
+    CPU* cpu = make_cpu(mem);
+
+    run_operand_block(cpu, "operand block 0x40-0xbf");
+
+    free(cpu);
+    free(mem);
+}
+
+// ALU-only loop: ADD/ADC/SUB/SBC/CP on every register and (HL), the eight d8
+// ALU forms and INC/DEC on every register
+void bench_alu_loop(void)
+{
+    Memory* mem = make_memory();
+    CPU* cpu = make_cpu(mem);
+
+    uint8_t block[0x100];
+    int blockLength = 0;
+    for (int inst = 0x80; inst < 0xa0; inst++) block[blockLength++] = inst;
+    for (int inst = 0xb8; inst < 0xc0; inst++) block[blockLength++] = inst;
+    for (int inst = 0xc6; inst < 0x100; inst += 0x10)
+    {
+        block[blockLength++] = inst;
+        block[blockLength++] = 0x5a + inst;
+        block[blockLength++] = inst + 8;
+        block[blockLength++] = 0xa5 - inst;
+    }
+    for (int reg = 0; reg < 8; reg++)
+    {
+        if (reg == 6) continue;
+        block[blockLength++] = 0x04 | (reg << 3);
+        block[blockLength++] = 0x05 | (reg << 3);
+    }
+
+    memcpy(&mem->ram[0x100], block, blockLength);
+    mem->ram[0xc000] = 0x3c;
+    cpu->hl = 0xc000;
+
+    BenchTimer timer;
+    timer_start(&timer);
+
+    for (int pass = 0; pass < BENCH_PASSES; pass++)
+    {
+        cpu->pc = 0x100;
+
+        // H and L are incremented and decremented in pairs, so (HL) stays put
+        while (cpu->pc < 0x100 + blockLength) execute_inst(cpu);
+    }
+
+    timer_report(&timer, "8-bit ALU loop", (uint64_t)BENCH_PASSES * (blockLength - 8));
+
+    free(cpu);
+    free(mem);
+}
+
+// A loop of 31 register ALU ops closed by JP back to its start: 32
+// instructions and 35 M-cycles per iteration
+static void load_alu_loop(CPU* cpu)
+{
+    int blockLength = 0;
+    for (int inst = 0x80; inst < 0x9f; inst++) cpu->mem->ram[0x100 + blockLength++] = inst;
+    cpu->mem->ram[0x100 + blockLength++] = 0xc3;
+    cpu->mem->ram[0x100 + blockLength++] = 0x00;
+    cpu->mem->ram[0x100 + blockLength++] = 0x01;
+
+    cpu->hl = 0xc000;
+    cpu->pc = 0x100;
+}
+
+// The ALU loop stepped with execute_inst and run a frame (17556 M-cycles) per
+// run_cycles call
+void bench_run_cycles(void)
+{
+    Memory* mem = make_memory();
+    CPU* cpu = make_cpu(mem);
+    load_alu_loop(cpu);
+
+    uint64_t budget = (uint64_t)BENCH_PASSES * 35;
+
+    BenchTimer timer;
+    timer_start(&timer);
+
+    uint64_t cycles = 0;
+    while (cycles < budget) cycles += execute_inst(cpu);
+
+    timer_report(&timer, "ALU loop, execute_inst", (uint64_t)BENCH_PASSES * 32);
+
+    timer_start(&timer);
+
+    uint64_t end = cpu->cycles + budget;
+    while (cpu->cycles < end) run_cycles(cpu, FRAME_CYCLES);
+
+    timer_report(&timer, "ALU loop, run_cycles", (uint64_t)BENCH_PASSES * 32);
+
+    free(cpu);
+    free(mem);
+}
+
+// Frames of a game that sleeps in HALT until the VBlank interrupt: EI / HALT /
+// JR back, with the handler a bare RETI
+void bench_halt_frame(void)
+{
+    static const uint8_t mainLoop[] = { 0xfb, 0x76, 0x18, 0xfd };
+    int frames = BENCH_PASSES;
+
+    Memory* mem = make_memory();
+    CPU* cpu = make_cpu(mem);
+    memcpy(&mem->ram[0x100], mainLoop, sizeof(mainLoop));
+    mem->ram[0x40] = 0xd9;
+    mem->ram[REG_IE] = 1 << INT_VBLANK;
+    cpu->pc = 0x100;
+    cpu->sp = 0xfffe;
+
+    BenchTimer timer;
+    timer_start(&timer);
+
+    for (int frame = 0; frame < frames; frame++)
+    {
+        cpu->nextEvent = cpu->cycles + FRAME_CYCLES;
+        run_until(cpu, UINT64_MAX);
+        request_interrupt(cpu, INT_VBLANK);
+    }
+
+    timer_report(&timer, "HALT frame", frames);
+
+    free(cpu);
+    free(mem);
+
+    // The same with VBlank coming from the emulator's scheduler, one
+    // run_until call per frame
+    Emulator* emu = make_emulator(false);
+    cpu = &emu->cpu;
+    memcpy(&emu->mem.ram[0x100], mainLoop, sizeof(mainLoop));
+    emu->mem.ram[0x40] = 0xd9;
+    emu->mem.ram[REG_IE] = 1 << INT_VBLANK;
+
+    timer_start(&timer);
+
+    for (int frame = 0; frame < frames; frame++) run_until(cpu, cpu->cycles + FRAME_CYCLES);
+
+    timer_report(&timer, "HALT frame, scheduler", frames);
+
+    free_emulator(emu);
+}
+
+// Conditional JR and JP on carry patterns that shift every iteration:
+// ADD A,$3b / JR C / INC B / CP $80 / JP NC / INC C / JP back
+void bench_branches(void)
+{
+    static const uint8_t branchLoop[] = { 0xc6, 0x3b, 0x38, 0x01, 0x04, 0xfe, 0x80, 0xd2, 0x0b, 0x01, 0x0c, 0xc3, 0x00, 0x01 };
+    uint64_t insts = (uint64_t)BENCH_PASSES * 32;
+
+    Memory* mem = make_memory();
+    CPU* cpu = make_cpu(mem);
+    memcpy(&mem->ram[0x100], branchLoop, sizeof(branchLoop));
+    cpu->pc = 0x100;
+
+    BenchTimer timer;
+    timer_start(&timer);
+
+    for (uint64_t i = 0; i < insts; i++) execute_inst(cpu);
+
+    timer_report(&timer, "Branch loop, execute_inst", insts);
+
+#if BRANCH_PROFILE
+    print_branch_profile(cpu);
+#endif
+
+    free(cpu);
+    free(mem);
+}
+
+// HRAM counter plus register traffic: LDH A,($80) / INC A / LDH ($80),A /
+// LDH A,(STAT) / LDH (SCX),A / JP back, on plain memory and then with the top
+// page on the I/O register table
+void bench_io(void)
+{
+    static const uint8_t ioLoop[] = { 0xf0, 0x80, 0x3c, 0xe0, 0x80, 0xf0, 0x41, 0xe0, 0x43, 0xc3, 0x00, 0x01 };
+    static const char* names[] = { "LDH loop, plain RAM", "LDH loop, I/O registers" };
+    uint64_t insts = (uint64_t)BENCH_PASSES * 36;
+
+    for (int mapped = 0; mapped < 2; mapped++)
+    {
+        Memory* mem = make_memory();
+        if (mapped) map_io(mem);
+
+        CPU* cpu = make_cpu(mem);
+        memcpy(&mem->ram[0x100], ioLoop, sizeof(ioLoop));
+        cpu->pc = 0x100;
+
+        BenchTimer timer;
+        timer_start(&timer);
+
+        for (uint64_t i = 0; i < insts; i++) execute_inst(cpu);
+
+        timer_report(&timer, names[mapped], insts);
+
+        free(cpu);
+        free(mem);
+    }
+}
+
+// The operand block again, on an emulator arena with small and then huge
+// pages, and the cost of putting one back to its post-boot state
+void bench_emulator(void)
+{
+    static const char* names[] = { "operand block, arena", "operand block, arena (huge)" };
+
+    for (int huge = 0; huge < 2; huge++)
+    {
+        Emulator* emu = make_emulator(huge);
+
+        // No huge pages to be had
+        if (huge && !emu->hugePages)
+        {
+            free_emulator(emu);
+            break;
+        }
+
+        run_operand_block(&emu->cpu, names[huge]);
+        free_emulator(emu);
+    }
+
+    Emulator* emu = make_emulator(false);
+    int resets = BENCH_PASSES / 10;
+
+    BenchTimer timer;
+    timer_start(&timer);
+
+    for (int i = 0; i < resets; i++) reset_emulator(emu);
+
+    timer_report(&timer, "reset_emulator", resets);
+
+    free_emulator(emu);
+}
+
+#define SWITCH_BANKS 512
+
+// ROM bank switches on an 8 MiB MBC5 cartridge, which only re-point the 64
+// bus pages of the 0x4000-0x7fff window: straight bus writes, then a loop of
+// INC A / LD ($2000),A / JR back, against the 16 KiB copy per switch that
+// mapping banks by copying would cost
+void bench_bank_switch(void)
+{
+    static const uint8_t switchLoop[] = { 0x3c, 0xea, 0x00, 0x20, 0x18, 0xfa };
+    int switches = BENCH_PASSES * 10;
+
+    uint8_t* rom = calloc(SWITCH_BANKS, ROM_BANK_SIZE);
+    for (int bank = 0; bank < SWITCH_BANKS; bank++) rom[bank * ROM_BANK_SIZE + 1] = bank;
+
+    memcpy(&rom[0x150], switchLoop, sizeof(switchLoop));
+    rom[HEADER_TYPE] = 0x19;
+    rom[HEADER_ROM_SIZE] = 8;
+    for (int addr = HEADER_TITLE; addr < HEADER_CHECKSUM; addr++) rom[HEADER_CHECKSUM] -= rom[addr] + 1;
+
+    Cartridge* cart = make_cartridge(rom, SWITCH_BANKS * ROM_BANK_SIZE, "bench");
+    Memory* mem = make_memory();
+    map_cartridge(mem, cart);
+
+    BenchTimer timer;
+    timer_start(&timer);
+
+    int sum = 0;
+    for (int i = 0; i < switches; i++)
+    {
+        bus_write8(mem, 0x2000, i);
+        sum += bus_read8(mem, 0x4001);
+    }
+
+    timer_report(&timer, "Bank switch, bus write", switches);
+
+    CPU* cpu = make_cpu(mem);
+    cpu->pc = 0x150;
+
+    timer_start(&timer);
+
+    for (int i = 0; i < 3 * switches; i++) execute_inst(cpu);
+
+    timer_report(&timer, "Bank switch, LD (a16),A loop", switches);
+
+    static uint8_t window[ROM_BANK_SIZE];
+    int copies = switches / 10;
+
+    timer_start(&timer);
+
+    for (int i = 0; i < copies; i++)
+    {
+        memcpy(window, &rom[(i % SWITCH_BANKS) * ROM_BANK_SIZE], ROM_BANK_SIZE);
+        sum += window[1];
+    }
+
+    timer_report(&timer, "Bank switch, 16 KiB copy", copies);
+
+    // Keeps the reads above from being optimized out
+    if (sum == -1) printf("%d\n", sum);
+
+    free(cpu);
+    free(mem);
+    free_cartridge(cart);
+    free(rom);
+}
+
+#define BATCH_STATES (1 << 18)
+#define BATCH_MEMS 64
+
+// Random single-instruction states spread over BATCH_MEMS memories. Grouped
+// states come opcode by opcode like test vector files, each opcode placed at
+// its own address; otherwise the instruction is whatever random byte is at PC.
+static void fill_batch(Batch* batch, Memory** mems, bool grouped)
+{
+    srand(1);
+    for (int m = 0; m < BATCH_MEMS; m++)
+    {
+        for (int addr = 0; addr < 0xff00; addr++) mems[m]->ram[addr] = rand();
+    }
+
+    CPU* cpu = make_cpu(NULL);
+    batch_clear(batch);
+
+    for (int i = 0; i < BATCH_STATES; i++)
+    {
+        cpu->mem = mems[i % BATCH_MEMS];
+        cpu->bc = rand();
+        cpu->de = rand();
+        cpu->hl = rand();
+        cpu->a = rand();
+        write_flags(cpu, rand() & 0xf0);
+        cpu->sp = rand();
+        cpu->pc = rand() % 0xfe00;
+
+        if (grouped)
+        {
+            // 255 plain opcodes, then the 256 CB ones
+            int group = (uint64_t)i * 0x1ff / BATCH_STATES;
+            cpu->pc = (i / BATCH_MEMS) * 4;
+            cpu->mem->ram[cpu->pc] = group < 0xcb ? group : group < 0xff ? group + 1 : 0xcb;
+            cpu->mem->ram[cpu->pc + 1] = group < 0xff ? rand() : group - 0xff;
+        }
+
+        batch_add(batch, cpu);
+    }
+
+    free(cpu);
+}
+
+// Throughput of batch_run against running the same states one at a time
+// through execute_inst
+void bench_batch(void)
+{
+    static const char* names[2][2] = {
+        { "Batch, vector kernels", "Batch, execute_inst" },
+        { "Batch grouped, vector kernels", "Batch grouped, execute_inst" }
+    };
+
+    Memory* mems[BATCH_MEMS];
+    for (int m = 0; m < BATCH_MEMS; m++) mems[m] = make_memory();
+    Batch* batch = make_batch(BATCH_STATES);
+
+    for (int grouped = 0; grouped < 2; grouped++)
+    {
+        for (int scalar = 0; scalar < 2; scalar++)
+        {
+            // The first run faults in the batch's arrays, time the second
+            for (int pass = 0; pass < 2; pass++)
+            {
+                fill_batch(batch, mems, grouped);
+                batch->vectorStates = 0;
+
+                BenchTimer timer;
+                timer_start(&timer);
+
+                if (scalar) batch_run_scalar(batch);
+                else batch_run(batch);
+
+                if (pass == 0) continue;
+
+                double ns = timer_report(&timer, names[grouped][scalar], BATCH_STATES);
+                printf("%-32s %8.2f M states/s\n", "", 1e3 / ns);
+                if (!scalar) printf("%-32s %8d of %d states through vector kernels\n", "", (int)batch->vectorStates, BATCH_STATES);
+            }
+        }
+    }
+
+    free_batch(batch);
+    for (int m = 0; m < BATCH_MEMS; m++) free(mems[m]);
+}
+
+#if BLOCK_CACHE
+
+// The ALU loop run through the block cache and then one instruction at a time
+// for comparison
+void bench_block_cache(void)
+{
+    Memory* mem = make_memory();
+    CPU* cpu = make_cpu(mem);
+    cpu->blockCache = make_block_cache();
+    load_alu_loop(cpu);
+
+    BenchTimer timer;
+    timer_start(&timer);
+
+    for (int pass = 0; pass < BENCH_PASSES; pass++) execute_block(cpu);
+
+    timer_report(&timer, JIT ? "ALU loop, JIT" : "ALU loop, block cache", (uint64_t)BENCH_PASSES * 32);
+
+    timer_start(&timer);
+
+    for (int pass = 0; pass < BENCH_PASSES * 32; pass++) execute_inst(cpu);
+
+    timer_report(&timer, "ALU loop, execute_inst", (uint64_t)BENCH_PASSES * 32);
+
+    // 17 loads and ALU ops with immediate operands closed by JP: the operands
+    // come from the decoded block rather than another fetch from memory
+    static const uint8_t immLoop[] = {
+        0x3e, 0x12, 0xc6, 0x34, 0x06, 0x56, 0xfe, 0x78, 0xe6, 0x9a, 0x0e, 0xbc,
+        0xee, 0xde, 0xf6, 0xf0, 0xd6, 0x11, 0x16, 0x22, 0xce, 0x33, 0x1e, 0x44,
+        0xde, 0x55, 0x26, 0xc0, 0x2e, 0x00, 0x01, 0x34, 0x12, 0x11, 0x78, 0x56,
+        0xc3, 0x00, 0x02
+    };
+    memcpy(&mem->ram[0x200], immLoop, sizeof(immLoop));
+    cpu->pc = 0x200;
+
+    timer_start(&timer);
+
+    for (int pass = 0; pass < BENCH_PASSES; pass++) execute_block(cpu);
+
+    timer_report(&timer, JIT ? "Immediate loop, JIT" : "Immediate loop, block cache", (uint64_t)BENCH_PASSES * 18);
+
+    timer_start(&timer);
+
+    for (int pass = 0; pass < BENCH_PASSES * 18; pass++) execute_inst(cpu);
+
+    timer_report(&timer, "Immediate loop, execute_inst", (uint64_t)BENCH_PASSES * 18);
+
+    print_block_cache_stats(cpu->blockCache);
+
+    free_block_cache(cpu->blockCache);
+    free(cpu);
+    free(mem);
+}
+
+#endif
+
+#if FUSION
+
+// A 4 KB copy with the LD A,(HL+) / LD (DE),A / ... / JR NZ loop through the
+// block cache, unfused and fused
+void bench_fusion(void)
+{
+    static const uint8_t copyLoop[] = { 0x2a, 0x12, 0x13, 0x0b, 0x78, 0xb1, 0x20, 0xf8 };
+    int passes = BENCH_PASSES / 1000;
+
+    for (int fuse = 0; fuse < 2; fuse++)
+    {
+        Memory* mem = make_memory();
+        CPU* cpu = make_cpu(mem);
+        cpu->blockCache = make_block_cache();
+        cpu->blockCache->fuse = fuse;
+        memcpy(&mem->ram[0x100], copyLoop, sizeof(copyLoop));
+
+        BenchTimer timer;
+        timer_start(&timer);
+
+        for (int pass = 0; pass < passes; pass++)
+        {
+            cpu->hl = 0xc000;
+            cpu->de = 0xd000;
+            cpu->bc = 0x1000;
+            cpu->pc = 0x100;
+
+            while (cpu->pc != 0x108) execute_block(cpu);
+        }
+
+        timer_report(&timer, fuse ? "4 KB copy loop, fused" : "4 KB copy loop, unfused", (uint64_t)passes * 0x1000 * 7);
+
+        free_block_cache(cpu->blockCache);
+        free(cpu);
+        free(mem);
+    }
+}
+
+#endif
+
+#if IDLE_SKIP
+
+// Frames spent polling LY for a value it never gets, with and without the
+// idle loop fast-forward
+void bench_idle_loop(void)
+{
+    static const uint8_t pollLoop[] = { 0xf0, 0x44, 0xfe, 0x90, 0x20, 0xfa };
+    int frames = BENCH_PASSES / 100;
+
+    for (int skip = 0; skip < 2; skip++)
+    {
+        Memory* mem = make_memory();
+        CPU* cpu = make_cpu(mem);
+        cpu->blockCache = make_block_cache();
+        cpu->blockCache->skipIdle = skip;
+        memcpy(&mem->ram[0x100], pollLoop, sizeof(pollLoop));
+        cpu->pc = 0x100;
+
+        BenchTimer timer;
+        timer_start(&timer);
+
+        for (int frame = 0; frame < frames; frame++) run_cycles(cpu, FRAME_CYCLES);
+
+        timer_report(&timer, skip ? "LY poll frame, skipped" : "LY poll frame, run", frames);
+        if (skip) print_idle_loop_stats(cpu);
+
+        free_block_cache(cpu->blockCache);
+        free(cpu);
+        free(mem);
+    }
+}
+
+#endif
+
+void run_benchmarks(void)
+{
+    bench_operand_block();
+    bench_emulator();
+    bench_alu_loop();
+    bench_run_cycles();
+    bench_halt_frame();
+    bench_branches();
+    bench_io();
+    bench_bank_switch();
+    bench_batch();
+
+#if BLOCK_CACHE
+    bench_block_cache();
+#endif
+
+#if FUSION
+    bench_fusion();
+#endif
+
+#if IDLE_SKIP
+    bench_idle_loop();
+#endif
+}
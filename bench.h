@@ -0,0 +1,26 @@
+#pragma once
+
+#include "cpu.h"
+
+void bench_operand_block(void);
+void bench_emulator(void);
+void bench_alu_loop(void);
+void bench_run_cycles(void);
+void bench_halt_frame(void);
+void bench_branches(void);
+void bench_io(void);
+void bench_bank_switch(void);
+void bench_batch(void);
+#if BLOCK_CACHE
+void bench_block_cache(void);
+#endif
+
+#if FUSION
+void bench_fusion(void);
+#endif
+
+#if IDLE_SKIP
+void bench_idle_loop(void);
+#endif
+
+void run_benchmarks(void);
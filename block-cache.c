@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block-cache.h"
+#include "opcodes.h"
+#include "jit.h"
+
+#if JIT
+#include <sys/mman.h>
+#endif
+
+#if BLOCK_CACHE
+
+BlockCache* make_block_cache(void)
+{
+    BlockCache* cache = calloc(1, sizeof(BlockCache));
+
+#if FUSION
+    cache->fuse = true;
+#endif
+
+#if IDLE_SKIP
+    cache->skipIdle = true;
+#endif
+
+    return cache;
+}
+
+// Frees the cache along with the JIT's code arena
+void free_block_cache(BlockCache* cache)
+{
+    if (!cache) return;
+
+#if JIT
+    if (cache->code) munmap(cache->code, JIT_ARENA_SIZE);
+#endif
+
+    free(cache);
+}
+
+// Drops every block, e.g. after memory was changed behind the CPU's back
+void flush_block_cache(BlockCache* cache)
+{
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) cache->blocks[i].valid = false;
+    memset(cache->codeCount, 0, sizeof(cache->codeCount));
+}
+
+static inline int block_slot(uint16_t pc)
+{
+    return (pc ^ (pc >> 12)) & (BLOCK_CACHE_SIZE - 1);
+}
+
+static void release_block(BlockCache* cache, Block* block)
+{
+    block->valid = false;
+
+    for (uint16_t addr = block->startPc; addr != block->endPc; addr++) cache->codeCount[addr]--;
+}
+
+// Called on every write to an address covered by a cached block
+void invalidate_code(BlockCache* cache, uint16_t addr)
+{
+    // Every block is in the slot of its start address, so only the slots of
+    // the addresses a block covering addr can start at need looking at
+    for (int back = 0; back < BLOCK_MAX_BYTES && cache->codeCount[addr]; back++)
+    {
+        uint16_t start = addr - back;
+        Block* block = &cache->blocks[block_slot(start)];
+        if (!block->valid || block->startPc != start) continue;
+
+        // endPc may have wrapped past 0xffff
+        if ((uint16_t)(addr - block->startPc) < (uint16_t)(block->endPc - block->startPc))
+        {
+            release_block(cache, block);
+            cache->invalidations++;
+        }
+    }
+}
+
+// Fills block->ops from the code at pc without registering the block in the
+// cache. Stops after maxOps instructions or the first one that ends a block.
+void decode_ops(Memory* mem, Block* block, uint16_t pc, int maxOps)
+{
+    block->startPc = pc;
+    block->numOps = 0;
+    block->cycles = 0;
+
+#if JIT
+    block->code = NULL;
+    block->execCount = 0;
+#endif
+
+    while (block->numOps < maxOps)
+    {
+        MicroOp* op = &block->ops[block->numOps++];
+        uint8_t inst = bus_read8(mem, pc);
+
+        if (inst == 0xcb)
+        {
+            op->inst = bus_read8(mem, pc + 1);
+            op->handler = decoded_cb_instruction_map[op->inst];
+            op->info = 0x100 | op->inst;
+            op->opcodeLength = 2;
+        }
+        else
+        {
+            op->inst = inst;
+            op->handler = decoded_instruction_map[inst];
+            op->info = inst;
+            op->opcodeLength = 1;
+        }
+
+        const OpcodeInfo* info = &opcode_info[op->info];
+        op->pc = pc;
+        op->fusion = FUSE_NONE;
+        op->fusedOps = 1;
+        op->length = info->length;
+        op->cycles = info->cycles;
+        op->imm = 0;
+        if (op->length - op->opcodeLength >= 1) op->imm = bus_read8(mem, pc + op->opcodeLength);
+        if (op->length - op->opcodeLength == 2) op->imm |= bus_read8(mem, pc + op->opcodeLength + 1) << 8;
+
+        block->cycles += op->cycles;
+        pc += op->length;
+
+        if (opcode_ends_block(info)) break;
+    }
+
+    block->endPc = pc;
+}
+
+#if FUSION
+
+static bool match_ops(Block* block, int start, const uint8_t* insts, int count)
+{
+    if (start + count > block->numOps) return false;
+
+    for (int i = 0; i < count; i++)
+    {
+        MicroOp* op = &block->ops[start + i];
+        if (op->opcodeLength != 1 || op->inst != insts[i]) return false;
+    }
+
+    return true;
+}
+
+// Marks the idioms fused_copy_loop, fused_dec_loop and fused_ldh_cp_jr in
+// cpu.c implement. All of them end in a JR, so they can only be at the end
+// of a block.
+static void find_fusions(Block* block)
+{
+    static const uint8_t copyLoop[] = { 0x2a, 0x12, 0x13, 0x0b, 0x78, 0xb1, 0x20 };
+
+    for (int i = 0; i < block->numOps; i++)
+    {
+        MicroOp* op = &block->ops[i];
+        MicroOp* last = &block->ops[block->numOps - 1];
+        int count = block->numOps - i;
+
+        if (op->opcodeLength != 1 || last->opcodeLength != 1) continue;
+
+        if (count == 7 && match_ops(block, i, copyLoop, 7) && last->imm == 0xf8)
+        {
+            op->fusion = FUSE_COPY_LOOP;
+        }
+        else if (count == 2 && (op->inst & 0xc7) == 0x05 && op->inst != 0x35 && last->inst == 0x20 && last->imm == 0xfd)
+        {
+            op->fusion = FUSE_DEC_LOOP;
+        }
+        else if (count == 3 && op->inst == 0xf0 && op[1].inst == 0xfe && op[1].opcodeLength == 1 && (last->inst & 0xe7) == 0x20)
+        {
+            op->fusion = FUSE_LDH_CP_JR;
+        }
+        else
+        {
+            continue;
+        }
+
+        op->fusedOps = count;
+        return;
+    }
+}
+
+// Runs the fused idiom starting at op, or returns 0 if it has to be run
+// instruction by instruction
+static int run_fused(CPU* cpu, Block* block, MicroOp* op)
+{
+    switch (op->fusion)
+    {
+        case FUSE_COPY_LOOP:
+            return fused_copy_loop(cpu, op->pc);
+        case FUSE_DEC_LOOP:
+            return fused_dec_loop(cpu, (op->inst >> 3) & 7, op->pc);
+        case FUSE_LDH_CP_JR:
+        {
+            MicroOp* jr = op + 2;
+            return fused_ldh_cp_jr(cpu, op->imm, op[1].imm, jr->inst, (int8_t)jr->imm, block->endPc);
+        }
+        default:
+            return 0;
+    }
+}
+
+#endif
+
+#if IDLE_SKIP
+
+// Instructions an idle loop may contain: anything that reads memory or
+// changes registers and flags, but never writes memory or touches the stack
+static bool is_idle_safe(MicroOp* op)
+{
+    uint8_t inst = op->inst;
+
+    // BIT n,r and BIT n,(HL)
+    if (op->opcodeLength == 2) return inst >= 0x40 && inst < 0x80;
+
+    if (inst == 0x00) return true;
+    if (inst >= 0x40 && inst < 0x80) return inst < 0x70 || inst > 0x77;     // LD r,r' and LD r,(HL)
+    if (inst >= 0x80 && inst < 0xc0) return true;                           // ALU A,r and A,(HL)
+    if (inst < 0x40 && (inst & 7) >= 4 && (inst & 7) <= 6) return ((inst >> 3) & 7) != 6; // INC/DEC/LD r,d8
+
+    switch (inst)
+    {
+        case 0x0a: case 0x1a: case 0xf0: case 0xf2: case 0xfa:              // loads into A
+        case 0xc6: case 0xce: case 0xd6: case 0xde:                         // ALU A,d8
+        case 0xe6: case 0xee: case 0xf6: case 0xfe:
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:              // JR
+        case 0xc3: case 0xc2: case 0xca: case 0xd2: case 0xda:              // JP
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_idle_candidate(Block* block)
+{
+    MicroOp* last = &block->ops[block->numOps - 1];
+    const OpcodeInfo* info = &opcode_info[last->info];
+    uint16_t target;
+
+    if (info->kind == KIND_JR) target = block->endPc + (int8_t)last->imm;
+    else if (info->kind == KIND_JP && last->opcodeLength == 1) target = last->imm;
+    else return false;
+
+    if (target != block->startPc) return false;
+
+    for (int i = 0; i < block->numOps; i++)
+    {
+        if (!is_idle_safe(&block->ops[i])) return false;
+    }
+
+    return true;
+}
+
+#endif
+
+// Whether the memory under block is still mapped where it was decoded from
+static inline bool block_mapped(Memory* mem, Block* block)
+{
+    return block->pages[0] == mem->readPages[block->startPc >> BUS_PAGE_SHIFT]
+        && block->pages[1] == mem->readPages[(uint16_t)(block->endPc - 1) >> BUS_PAGE_SHIFT];
+}
+
+static void decode_block(CPU* cpu, Block* block, uint16_t pc)
+{
+    decode_ops(cpu->mem, block, pc, BLOCK_MAX_OPS);
+    block->valid = true;
+    block->pages[0] = cpu->mem->readPages[block->startPc >> BUS_PAGE_SHIFT];
+    block->pages[1] = cpu->mem->readPages[(uint16_t)(block->endPc - 1) >> BUS_PAGE_SHIFT];
+
+#if FUSION
+    if (cpu->blockCache->fuse) find_fusions(block);
+#endif
+
+#if IDLE_SKIP
+    block->idleCandidate = is_idle_candidate(block);
+#endif
+
+    for (uint16_t addr = block->startPc; addr != block->endPc; addr++) cpu->blockCache->codeCount[addr]++;
+}
+
+Block* lookup_block(CPU* cpu, uint16_t pc)
+{
+    BlockCache* cache = cpu->blockCache;
+    Block* block = &cache->blocks[block_slot(pc)];
+
+    if (block->valid && block->startPc == pc && block_mapped(cpu->mem, block))
+    {
+        cache->hits++;
+        return block;
+    }
+
+    cache->misses++;
+
+    if (block->valid) release_block(cache, block);
+    decode_block(cpu, block, pc);
+
+    return block;
+}
+
+static int run_block(CPU* cpu)
+{
+    Block* block = lookup_block(cpu, cpu->pc);
+
+#if JIT
+    if (block->code) return block->code(cpu);
+    if (++block->execCount == JIT_THRESHOLD && jit_compile_block(cpu->blockCache, block)) return block->code(cpu);
+#endif
+
+    int cycles = 0;
+
+    for (int i = 0; i < block->numOps; i++)
+    {
+        MicroOp* op = &block->ops[i];
+
+        // Where this op's accesses fall, for register handlers
+        cpu->inst = op->opcodeLength == 2 ? 0xcb : op->inst;
+        cpu->blockCycles = cycles;
+
+#if FUSION
+        if (op->fusion)
+        {
+            int fusedCycles = run_fused(cpu, block, op);
+            if (fusedCycles)
+            {
+                cpu->blockCache->fusedRuns++;
+                cycles += fusedCycles;
+                i += op->fusedOps - 1;
+                continue;
+            }
+        }
+#endif
+
+        cpu->pc += op->length;
+        cycles += op->handler(cpu, op->imm);
+
+        if (!block->valid) break;
+    }
+
+    return cycles;
+}
+
+// Runs the block starting at pc and returns the M-cycles it took. Stops early
+// if one of its own instructions overwrote the block.
+int execute_block(CPU* cpu)
+{
+    int cycles = run_block(cpu);
+    cpu->cycles += cycles;
+    cpu->blockCycles = 0;
+
+    return cycles;
+}
+
+#if IDLE_SKIP
+
+static void record_idle_skip(BlockCache* cache, uint16_t pc, uint64_t cycles)
+{
+    IdleLoop* loop = NULL;
+
+    for (int i = 0; i < cache->numIdleLoops; i++)
+    {
+        if (cache->idleLoops[i].pc == pc) loop = &cache->idleLoops[i];
+    }
+
+    if (!loop)
+    {
+        if (cache->numIdleLoops == MAX_IDLE_LOOPS) return;
+
+        loop = &cache->idleLoops[cache->numIdleLoops++];
+        loop->pc = pc;
+    }
+
+    loop->skips++;
+    loop->skippedCycles += cycles;
+}
+
+// Called with PC back at the start of the block that just ran. Runs the loop
+// once more, and if that left every register and flag as it was, the loop is
+// spinning: it doesn't write memory, so nothing it reads can change before
+// limit (run_until caps it at cpu->nextEvent), unless it reads DIV or TIMA,
+// which change without an event and so rule the skip out, or LY, which moves
+// limit up to its next line. The whole
+// iterations that end by limit are then added to the cycle counter in one
+// go; the one limit falls in runs normally, since its reads may come after
+// the event.
+static void skip_idle_loop(CPU* cpu, uint64_t limit)
+{
+    BlockCache* cache = cpu->blockCache;
+    uint16_t pc = cpu->pc;
+    Block* block = &cache->blocks[block_slot(pc)];
+
+    if (!block->valid || block->startPc != pc || !block->idleCandidate) return;
+
+    uint8_t flags = read_flags(cpu);
+    uint8_t a = cpu->a;
+    uint16_t bc = cpu->bc, de = cpu->de, hl = cpu->hl, sp = cpu->sp;
+    uint32_t clockedReads = cpu->mem->clockedReads;
+    cpu->mem->clockedUntil = UINT64_MAX;
+
+    int cycles = execute_block(cpu);
+    if (cpu->mem->clockedUntil < limit) limit = cpu->mem->clockedUntil;
+
+    if (cpu->pc != pc || cpu->cycles >= limit || cpu->mem->clockedReads != clockedReads) return;
+    if (read_flags(cpu) != flags || cpu->a != a || cpu->bc != bc || cpu->de != de || cpu->hl != hl || cpu->sp != sp) return;
+
+    uint64_t iterations = (limit - cpu->cycles) / cycles;
+    if (!iterations) return;
+
+    cpu->cycles += iterations * cycles;
+
+    record_idle_skip(cache, pc, iterations * cycles);
+}
+
+#endif
+
+// Runs whole blocks until the cycle counter reaches limit. Interrupts that a
+// block enables or requests are taken once it ends.
+void run_blocks(CPU* cpu, uint64_t limit)
+{
+    while (cpu->cycles < limit)
+    {
+        // EI's delay, HALT and interrupts are handled an instruction at a time
+        if (cpu->checkState)
+        {
+            limit = event_limit(cpu, limit);
+            step_until(cpu, limit);
+            continue;
+        }
+
+#if IDLE_SKIP
+        uint16_t pc = cpu->pc;
+#endif
+
+        execute_block(cpu);
+
+#if IDLE_SKIP
+        if (cpu->pc == pc && cpu->blockCache->skipIdle && !cpu->checkState && cpu->cycles < limit) skip_idle_loop(cpu, limit);
+#endif
+    }
+}
+
+void print_block_cache_stats(BlockCache* cache)
+{
+    uint64_t lookups = cache->hits + cache->misses;
+
+    printf("Block cache: %llu hits, %llu misses (%.2f%% hit rate), %llu invalidations\n",
+        (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+        lookups ? 100.0 * cache->hits / lookups : 0.0, (unsigned long long)cache->invalidations);
+
+#if FUSION
+    printf("Fusion: %llu fused idioms run\n", (unsigned long long)cache->fusedRuns);
+#endif
+
+#if JIT
+    printf("JIT: %llu blocks compiled, %llu code cache evictions, %u bytes of code in use\n",
+        (unsigned long long)cache->compiledBlocks, (unsigned long long)cache->evictions, cache->codeUsed);
+#endif
+}
+
+#if IDLE_SKIP
+
+// Idle loops found in this run, with the share of all cycles skipped in each
+void print_idle_loop_stats(CPU* cpu)
+{
+    BlockCache* cache = cpu->blockCache;
+    uint64_t total = 0;
+
+    for (int i = 0; i < cache->numIdleLoops; i++)
+    {
+        IdleLoop* loop = &cache->idleLoops[i];
+        char text[32];
+        disassemble(cpu->mem, loop->pc, text, sizeof(text));
+
+        printf("Idle loop at 0x%04x (%s): %llu skips, %llu cycles skipped (%.1f%%)\n", loop->pc, text,
+            (unsigned long long)loop->skips, (unsigned long long)loop->skippedCycles,
+            cpu->cycles ? 100.0 * loop->skippedCycles / cpu->cycles : 0.0);
+        total += loop->skippedCycles;
+    }
+
+    printf("Idle loops: %d found, %llu of %llu cycles skipped\n", cache->numIdleLoops,
+        (unsigned long long)total, (unsigned long long)cpu->cycles);
+}
+
+#endif
+
+#endif
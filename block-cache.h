@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+#define BLOCK_CACHE_SIZE 0x1000
+#define BLOCK_MAX_OPS 32
+
+// Longest a block can be, so invalidation only has to look back this many
+// addresses for blocks covering a written byte
+#define BLOCK_MAX_BYTES (3 * BLOCK_MAX_OPS)
+
+// Upper bound on the M-cycles one call of a fused loop runs for
+#define FUSION_MAX_CYCLES 256
+
+typedef enum FusionKind
+{
+    FUSE_NONE,
+    FUSE_COPY_LOOP,     // LD A,(HL+) / LD (DE),A / INC DE / DEC BC / LD A,B / OR C / JR NZ
+    FUSE_DEC_LOOP,      // DEC r / JR NZ back to the DEC
+    FUSE_LDH_CP_JR      // LDH A,(n) / CP n / JR cc
+} FusionKind;
+
+// One pre-decoded instruction. CB-prefixed instructions are a single micro-op
+// whose handler comes straight from decoded_cb_instruction_map. The handler
+// is specific to the opcode and takes imm, with PC past the instruction.
+typedef struct MicroOp
+{
+    int (*handler)(CPU* cpu, uint16_t imm);
+    uint8_t inst;
+    uint8_t opcodeLength;   // 1, or 2 with the CB prefix
+    uint8_t length;
+    uint8_t cycles;         // M-cycles, not taken for conditional branches
+    uint16_t info;          // index into opcode_info
+    uint16_t imm;           // immediate operand, if any
+    uint16_t pc;
+
+    // Set on the first op of a fused idiom; fusedOps ops are covered
+    uint8_t fusion;
+    uint8_t fusedOps;
+} MicroOp;
+
+#define MAX_IDLE_LOOPS 32
+
+typedef int (*BlockCode)(CPU* cpu);
+
+// Per-loop counters for the idle loops run_blocks fast-forwarded over
+typedef struct IdleLoop
+{
+    uint16_t pc;
+    uint64_t skips;
+    uint64_t skippedCycles;
+} IdleLoop;
+
+// Straight-line code from startPc up to and including the first instruction
+// that can branch
+typedef struct Block
+{
+    bool valid;
+    uint8_t numOps;
+    uint16_t startPc;
+    uint16_t endPc;         // first byte after the block
+    uint32_t cycles;        // sum of the micro-op cycles
+
+    // Bus read pages of the first and last byte when the block was decoded.
+    // A bank switch re-points them, which makes the block stale.
+    uint8_t* pages[2];
+
+#if IDLE_SKIP
+    // Branches back to its own start and only reads memory, so it may be
+    // an idle loop
+    bool idleCandidate;
+#endif
+
+#if JIT
+    BlockCode code;         // native translation, NULL until the block is hot
+    uint32_t execCount;
+#endif
+    MicroOp ops[BLOCK_MAX_OPS];
+} Block;
+
+typedef struct BlockCache
+{
+    Block blocks[BLOCK_CACHE_SIZE];
+
+    // Number of valid blocks covering each address; writes to an address with
+    // a non-zero count invalidate those blocks
+    uint8_t codeCount[0x10000];
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+
+#if FUSION
+    bool fuse;          // annotate newly decoded blocks with fusions
+    uint64_t fusedRuns;
+#endif
+
+#if IDLE_SKIP
+    bool skipIdle;
+    int numIdleLoops;
+    IdleLoop idleLoops[MAX_IDLE_LOOPS];
+#endif
+
+#if JIT
+    // Executable arena the translated blocks are bump-allocated from. When it
+    // fills up every translation is dropped and the blocks start over cold.
+    uint8_t* code;
+    uint32_t codeUsed;
+    uint64_t compiledBlocks;
+    uint64_t evictions;
+#endif
+} BlockCache;
+
+BlockCache* make_block_cache(void);
+void free_block_cache(BlockCache* cache);
+void flush_block_cache(BlockCache* cache);
+void invalidate_code(BlockCache* cache, uint16_t addr);
+void decode_ops(Memory* mem, Block* block, uint16_t pc, int maxOps);
+Block* lookup_block(CPU* cpu, uint16_t pc);
+int execute_block(CPU* cpu);
+void run_blocks(CPU* cpu, uint64_t limit);
+void print_block_cache_stats(BlockCache* cache);
+
+#if IDLE_SKIP
+void print_idle_loop_stats(CPU* cpu);
+#endif
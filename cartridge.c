@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cartridge.h"
+
+// External RAM sizes by header code; 1 is an unofficial 2 KiB
+static const uint32_t ramSizes[] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+
+static uint8_t header_checksum(const uint8_t* rom)
+{
+    uint8_t sum = 0;
+
+    for (int addr = HEADER_TITLE; addr < HEADER_CHECKSUM; addr++) sum = sum - rom[addr] - 1;
+
+    return sum;
+}
+
+// Sum of every byte in the file except the checksum itself, big-endian
+static bool global_checksum_ok(const uint8_t* rom, size_t size)
+{
+    uint16_t sum = 0;
+
+    for (size_t addr = 0; addr < size; addr++) sum += rom[addr];
+
+    sum -= rom[HEADER_GLOBAL_CHECKSUM] + rom[HEADER_GLOBAL_CHECKSUM + 1];
+
+    return sum == (rom[HEADER_GLOBAL_CHECKSUM] << 8 | rom[HEADER_GLOBAL_CHECKSUM + 1]);
+}
+
+// Controller and extras by cartridge type; false for types we can't run
+static bool set_features(Cartridge* cart)
+{
+    switch (cart->type)
+    {
+        case 0x00: case 0x08: case 0x09: cart->mbc = MBC_NONE; break;
+        case 0x01: case 0x02: case 0x03: cart->mbc = MBC_1; break;
+        case 0x05: case 0x06: cart->mbc = MBC_2; break;
+        case 0x0f: case 0x10: case 0x11: case 0x12: case 0x13: cart->mbc = MBC_3; break;
+        case 0x19: case 0x1a: case 0x1b: case 0x1c: case 0x1d: case 0x1e: cart->mbc = MBC_5; break;
+        default: return false;
+    }
+
+    switch (cart->type)
+    {
+        case 0x03: case 0x06: case 0x09: case 0x0f: case 0x10: case 0x13: case 0x1b: case 0x1e:
+            cart->hasBattery = true;
+            break;
+    }
+
+    cart->hasRtc = cart->type == 0x0f || cart->type == 0x10;
+    cart->hasRumble = cart->type >= 0x1c && cart->type <= 0x1e;
+
+    return true;
+}
+
+// Fills in cart from the header, or returns false after printing why not
+static bool parse_header(Cartridge* cart, const char* path)
+{
+    const uint8_t* rom = cart->rom;
+
+    if (cart->fileSize < 2 * ROM_BANK_SIZE)
+    {
+        fprintf(stderr, "%s: too small for a cartridge (%zu bytes)\n", path, cart->fileSize);
+        return false;
+    }
+
+    if (header_checksum(rom) != rom[HEADER_CHECKSUM])
+    {
+        fprintf(stderr, "%s: bad header checksum (0x%02x, expected 0x%02x)\n", path, rom[HEADER_CHECKSUM], header_checksum(rom));
+        return false;
+    }
+
+    if (rom[HEADER_ROM_SIZE] > 8)
+    {
+        fprintf(stderr, "%s: unknown ROM size code 0x%02x\n", path, rom[HEADER_ROM_SIZE]);
+        return false;
+    }
+
+    if (rom[HEADER_RAM_SIZE] >= sizeof(ramSizes) / sizeof(ramSizes[0]))
+    {
+        fprintf(stderr, "%s: unknown RAM size code 0x%02x\n", path, rom[HEADER_RAM_SIZE]);
+        return false;
+    }
+
+    // Titles are up to 16 bytes, 15 on cartridges that use the last for the CGB flag
+    int titleLength = (rom[0x143] & 0x80) ? 15 : 16;
+    for (int i = 0; i < titleLength && rom[HEADER_TITLE + i] >= 0x20 && rom[HEADER_TITLE + i] < 0x7f; i++)
+    {
+        cart->title[i] = rom[HEADER_TITLE + i];
+    }
+
+    cart->type = rom[HEADER_TYPE];
+    cart->ramSize = ramSizes[rom[HEADER_RAM_SIZE]];
+
+    if (!set_features(cart))
+    {
+        fprintf(stderr, "%s: unsupported cartridge type 0x%02x\n", path, cart->type);
+        return false;
+    }
+    cart->globalChecksumOk = global_checksum_ok(rom, cart->fileSize);
+
+    int headerBanks = 2 << rom[HEADER_ROM_SIZE];
+    int fileBanks = cart->fileSize / ROM_BANK_SIZE;
+    cart->romBanks = fileBanks < headerBanks ? fileBanks : headerBanks;
+
+    if (fileBanks != headerBanks)
+    {
+        fprintf(stderr, "%s: header says %d ROM banks, file has %d\n", path, headerBanks, fileBanks);
+    }
+
+    return true;
+}
+
+Cartridge* make_cartridge(const uint8_t* rom, size_t size, const char* name)
+{
+    Cartridge* cart = calloc(1, sizeof(Cartridge));
+    cart->rom = rom;
+    cart->fileSize = size;
+
+    if (!parse_header(cart, name))
+    {
+        free(cart);
+        return NULL;
+    }
+
+    // MBC2 has 512 half-bytes built in whatever the header says; banks of
+    // less than 8 KiB get a whole one so they can be mapped directly
+    uint32_t ramSize = cart->mbc == MBC_2 ? 0x200 : cart->ramSize;
+    cart->ramBanks = (ramSize + RAM_BANK_SIZE - 1) / RAM_BANK_SIZE;
+    if (cart->ramBanks) cart->ram = calloc(cart->ramBanks, RAM_BANK_SIZE);
+
+    // The clock keeps running across resets, so it starts here rather than
+    // in map_cartridge
+    cart->rtc.start = time(NULL);
+
+    return cart;
+}
+
+Cartridge* load_cartridge(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+    {
+        perror(path);
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping stays valid after the descriptor is closed. Private and
+    // read-only: the pages still come straight from the page cache, but
+    // nothing done through them can ever reach the file.
+    void* rom = info.st_size ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (rom == MAP_FAILED)
+    {
+        if (info.st_size) perror(path);
+        else fprintf(stderr, "%s: empty file\n", path);
+
+        return NULL;
+    }
+
+    Cartridge* cart = make_cartridge(rom, info.st_size, path);
+    if (!cart)
+    {
+        munmap(rom, info.st_size);
+        return NULL;
+    }
+
+    cart->mapped = true;
+
+    return cart;
+}
+
+bool map_save_file(Cartridge* cart, const char* path, bool persist)
+{
+    size_t length = (size_t)cart->ramBanks * RAM_BANK_SIZE;
+    if (!length) return true;
+
+    int fd = open(path, persist ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0)
+    {
+        // Nothing saved yet
+        if (!persist && errno == ENOENT) return true;
+
+        perror(path);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+    {
+        perror(path);
+        close(fd);
+        return false;
+    }
+
+    // New files, and shorter saves such as 512-byte MBC2 ones, grow to whole banks
+    if (persist && (size_t)info.st_size < length && ftruncate(fd, length) < 0)
+    {
+        perror(path);
+        close(fd);
+        return false;
+    }
+
+    void* ram;
+    if (persist || (size_t)info.st_size >= length)
+    {
+        ram = mmap(NULL, length, PROT_READ | PROT_WRITE, persist ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    }
+    else
+    {
+        // A private mapping can't reach past the end of the file, so a short
+        // one is read into anonymous memory instead
+        ram = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ram != MAP_FAILED && pread(fd, ram, info.st_size, 0) < 0) perror(path);
+    }
+
+    close(fd);
+
+    if (ram == MAP_FAILED)
+    {
+        perror(path);
+        return false;
+    }
+
+    if (cart->ramMapped) munmap(cart->ram, length);
+    else free(cart->ram);
+
+    cart->ram = ram;
+    cart->ramMapped = true;
+    cart->persistRam = persist;
+    cart->dirtyPages = 0;
+
+    return true;
+}
+
+void free_cartridge(Cartridge* cart)
+{
+    if (cart->mapped) munmap((void*)cart->rom, cart->fileSize);
+
+    if (cart->ramMapped)
+    {
+        size_t length = (size_t)cart->ramBanks * RAM_BANK_SIZE;
+
+        if (cart->persistRam) msync(cart->ram, length, MS_SYNC);
+        munmap(cart->ram, length);
+    }
+    else
+    {
+        free(cart->ram);
+    }
+
+    free(cart);
+}
+
+void print_cartridge(Cartridge* cart)
+{
+    static const char* mbcNames[] = { "none", "MBC1", "MBC2", "MBC3", "MBC5" };
+
+    printf("Title: %s\nType: 0x%02x (%s%s%s%s)\nROM: %d banks (%zu bytes)\nRAM: %u bytes\nGlobal checksum: %s\n",
+        cart->title, cart->type, mbcNames[cart->mbc], cart->hasBattery ? ", battery" : "", cart->hasRtc ? ", RTC" : "",
+        cart->hasRumble ? ", rumble" : "", cart->romBanks, cart->fileSize, cart->ramSize, cart->globalChecksumOk ? "ok" : "bad");
+}
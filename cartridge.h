@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "memory.h"
+
+#define ROM_BANK_SIZE 0x4000
+
+// Cartridge header fields, at 0x0100-0x014f of bank 0
+#define HEADER_TITLE 0x134
+#define HEADER_TYPE 0x147
+#define HEADER_ROM_SIZE 0x148
+#define HEADER_RAM_SIZE 0x149
+#define HEADER_CHECKSUM 0x14d
+#define HEADER_GLOBAL_CHECKSUM 0x14e
+#define HEADER_END 0x150
+
+#define RAM_BANK_SIZE 0x2000
+
+// Granularity of the dirty tracking for a persisted save file
+#define SAVE_PAGE_SIZE 0x1000
+
+// Build with -DSAVE_FLUSH_FRAMES=n to change how often the frontend writes
+// dirty save pages back to the file
+#ifndef SAVE_FLUSH_FRAMES
+#define SAVE_FLUSH_FRAMES 60
+#endif
+
+typedef enum MbcKind
+{
+    MBC_NONE,
+    MBC_1,
+    MBC_2,
+    MBC_3,
+    MBC_5
+} MbcKind;
+
+// MBC3 real-time clock, counting host seconds
+typedef struct Rtc
+{
+    // Host time at which the count was zero, or while halted the count itself
+    int64_t start;
+    int64_t haltedCount;
+    bool halted;
+    bool carry;             // day counter overflowed, until written
+
+    uint8_t latched[5];     // S, M, H, DL, DH as of the last latch
+    uint8_t latchWrite;     // last value written to 0x6000-0x7fff
+} Rtc;
+
+// A cartridge and its memory bank controller. The ROM is normally a file
+// mapped read-only into the process, so loading copies nothing and every
+// emulator running the same file shares its page cache.
+typedef struct Cartridge
+{
+    const uint8_t* rom;
+    size_t fileSize;
+    bool mapped;            // rom is our own mmap rather than the caller's
+
+    // Banks actually backed by the file; the header can claim more
+    int romBanks;
+
+    char title[17];
+    uint8_t type;
+    uint32_t ramSize;
+
+    // The boot ROM refuses to start a cartridge with a bad header checksum,
+    // so make_cartridge does too. Nothing checks the global one.
+    bool globalChecksumOk;
+
+    MbcKind mbc;
+    bool hasBattery;
+    bool hasRtc;
+    bool hasRumble;
+
+    // External RAM, whole banks of it; MBC2's 512 nibbles are kept a byte each
+    uint8_t* ram;
+    int ramBanks;
+
+    // ram is a mapping of the save file rather than the heap. When the file
+    // is shared, writes reach it and dirtyPages has a bit per SAVE_PAGE_SIZE
+    // written since the last flush_save.
+    bool ramMapped;
+    bool persistRam;
+    uint32_t dirtyPages;
+    uint64_t flushedPages;
+
+    // Controller registers as last written
+    bool ramEnabled;
+    uint16_t romBank;       // MBC1 keeps its upper two bits in bank2
+    uint8_t bank2;          // RAM bank, MBC1 upper bits or MBC3 RTC register
+    bool mode;              // MBC1 banking mode
+    bool rumble;            // MBC5 motor on
+    uint64_t bankSwitches;
+
+    Rtc rtc;
+} Cartridge;
+
+// NULL, after printing why, if the file can't be mapped or isn't a cartridge
+Cartridge* load_cartridge(const char* path);
+
+// Same for a ROM image already in memory, which the caller keeps alive
+Cartridge* make_cartridge(const uint8_t* rom, size_t size, const char* name);
+
+void free_cartridge(Cartridge* cart);
+void print_cartridge(Cartridge* cart);
+
+// Backs external RAM with a save file, before map_cartridge. With persist the
+// file is mapped shared, so writes survive a crash without any save step, and
+// created if missing; otherwise this instance gets a private copy-on-write
+// view of it, and a missing file just means blank RAM. False, after printing
+// why, if the file can't be used; the RAM then stays on the heap.
+bool map_save_file(Cartridge* cart, const char* path, bool persist);
+
+// Writes the save pages dirtied since the last call back to the file, for the
+// frontend to call every SAVE_FLUSH_FRAMES or so
+void flush_save(Memory* mem);
+
+// Maps the cartridge into mem: ROM banks straight from the image, external
+// RAM straight from cart->ram, and the controller on write handlers that
+// switch banks by re-pointing bus pages. The controller starts from its
+// power-on registers each time.
+void map_cartridge(Memory* mem, Cartridge* cart);
+
+// ROM bank whose bytes the bus currently maps at addr (below 0x8000)
+static inline int mapped_rom_bank(Memory* mem, uint16_t addr)
+{
+    return (mem->readPages[addr >> BUS_PAGE_SHIFT] - mem->cart->rom) / ROM_BANK_SIZE;
+}
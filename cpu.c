@@ -1,152 +1,714 @@
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "cpu.h"
+#include "opcodes.h"
+#include "block-cache.h"
+#include "aot.h"
+#include "scheduler.h"
+
+#if ALU_TABLES
+static void init_alu_tables(void);
+#endif
 
 CPU* make_cpu(Memory* mem)
 {
-    CPU* cpu = calloc(1, sizeof(CPU));
-    cpu->mem = mem;
+    CPU* cpu = malloc(sizeof(CPU));
+    init_cpu(cpu, mem);
 
     return cpu;
 }
 
+void init_cpu(CPU* cpu, Memory* mem)
+{
+    memset(cpu, 0, sizeof(CPU));
+    cpu->mem = mem;
+    cpu->nextEvent = UINT64_MAX;
+
+#if ALU_TABLES
+    init_alu_tables();
+#endif
+}
+
 void print_reg(CPU* cpu)
 {
-    printf("AF: 0x%02x \tBC: 0x%02x \tDE: 0x%02x \tHL: 0x%02x \tSP: 0x%02x \tPC: 0x%02x\n", cpu->af, cpu->bc, cpu->de, cpu->hl, cpu->sp, cpu->pc);
+    printf("AF: 0x%02x \tBC: 0x%02x \tDE: 0x%02x \tHL: 0x%02x \tSP: 0x%02x \tPC: 0x%02x\n", (cpu->a << 8) | read_flags(cpu), cpu->bc, cpu->de, cpu->hl, cpu->sp, cpu->pc);
 }
 
 uint8_t get_inst(CPU* cpu)
 {
-    // printf("%d\n", cpu->mem->ram[cpu->pc]);
-    return cpu->mem->ram[cpu->pc++];
+    return bus_read8(cpu->mem, cpu->pc++);
+}
+
+static inline uint8_t read_mem(CPU* cpu, uint16_t addr)
+{
+    return bus_read8(cpu->mem, addr);
+}
+
+// Once a cartridge is mapped, stores below 0x8000 go to its controller and
+// leave the ROM under them as it was
+static inline bool writes_code(CPU* cpu, uint16_t addr)
+{
+    return addr >= 0x8000 || !cpu->mem->cart;
+}
+
+// Bookkeeping after any store to addr
+static inline void wrote_mem(CPU* cpu, uint16_t addr)
+{
+    // Cheap superset of IF and IE, either can make an interrupt pending
+    if ((addr | 0xf0) == 0xffff) cpu->checkState = true;
+
+#if BLOCK_CACHE
+    if (cpu->blockCache && cpu->blockCache->codeCount[addr] && writes_code(cpu, addr)) invalidate_code(cpu->blockCache, addr);
+#endif
+
+#if AOT
+    if (addr < AOT_ROM_END && cpu->aot && writes_code(cpu, addr)) aot_invalidate(cpu->aot, cpu->mem, addr);
+#endif
+}
+
+static inline void write_mem(CPU* cpu, uint16_t addr, uint8_t value)
+{
+    bus_write8(cpu->mem, addr, value);
+    wrote_mem(cpu, addr);
+}
+
+// LDH and (C) accesses to 0xff00 | port. Once map_io has taken the top page
+// these go to the register table directly rather than through the page
+// handler, so plain registers and HRAM cost no call.
+static inline uint8_t read_io(CPU* cpu, uint8_t port)
+{
+    uint8_t* page = cpu->mem->readPages[IO_BASE >> BUS_PAGE_SHIFT];
+
+    return page ? page[port] : io_read(cpu->mem, port);
+}
+
+static inline void write_io(CPU* cpu, uint8_t port, uint8_t value)
+{
+    uint8_t* page = cpu->mem->writePages[IO_BASE >> BUS_PAGE_SHIFT];
+
+    if (page) page[port] = value;
+    else io_write(cpu->mem, port, value);
+
+    wrote_mem(cpu, IO_BASE | port);
+}
+
+// Operand access. Register operands are resolved through constant offset tables
+// into CPU; memory is only touched when the operand really is (HL).
+
+// B, C, D, E, H, L, (HL), A; the (HL) slot is never read
+static const uint8_t reg8Offsets[8] = {
+    offsetof(CPU, b), offsetof(CPU, c), offsetof(CPU, d), offsetof(CPU, e),
+    offsetof(CPU, h), offsetof(CPU, l), 0, offsetof(CPU, a)
+};
+
+// BC, DE, HL, SP for the 16-bit arithmetic and load opcodes
+static const uint8_t reg16Offsets[4] = {
+    offsetof(CPU, bc), offsetof(CPU, de), offsetof(CPU, hl), offsetof(CPU, sp)
+};
+
+// (BC), (DE), (HL+), (HL-): the pair holding the address and the HL adjustment
+static const uint8_t indirectOffsets[4] = {
+    offsetof(CPU, bc), offsetof(CPU, de), offsetof(CPU, hl), offsetof(CPU, hl)
+};
+static const int8_t indirectSteps[4] = { 0, 0, 1, -1 };
+
+static inline uint8_t read_reg_8(CPU* cpu, int index)
+{
+    if (index == 6) return read_mem(cpu, cpu->hl);
+
+    return *((uint8_t*)cpu + reg8Offsets[index]);
+}
+
+static inline void write_reg_8(CPU* cpu, int index, uint8_t value)
+{
+    if (index == 6) write_mem(cpu, cpu->hl, value);
+    else *((uint8_t*)cpu + reg8Offsets[index]) = value;
+}
+
+static inline uint16_t* get_reg_16(CPU* cpu, int index)
+{
+    return (uint16_t*)((uint8_t*)cpu + reg16Offsets[index]);
+}
+
+// Returns the address of an indirect operand, applying the HL+/HL- adjustment
+static inline uint16_t get_indirect_addr(CPU* cpu, int index)
+{
+    uint16_t addr = *(uint16_t*)((uint8_t*)cpu + indirectOffsets[index]);
+    cpu->hl += indirectSteps[index];
+
+    return addr;
+}
+
+// Whether a 16-bit access at addr can be a single load or store through its
+// bus page: both bytes in the same page and neither in I/O space. Everything
+// else goes byte by byte through read_mem/write_mem.
+static inline bool is_plain_pair(uint16_t addr)
+{
+    return (addr & 0xff) != 0xff && (addr & 0xff80) != 0xff00;
+}
+
+// Little-endian like the register unions, so the host byte order matches
+static inline uint16_t read_mem_16(CPU* cpu, uint16_t addr)
+{
+    uint8_t* page = cpu->mem->readPages[addr >> BUS_PAGE_SHIFT];
+
+    if (is_plain_pair(addr) && page)
+    {
+        uint16_t value;
+        memcpy(&value, &page[addr & (BUS_PAGE_SIZE - 1)], 2);
+        return value;
+    }
+
+    uint8_t lo = read_mem(cpu, addr);
+    return lo | (read_mem(cpu, addr + 1) << 8);
+}
+
+static inline void write_mem_16(CPU* cpu, uint16_t addr, uint16_t value)
+{
+    uint8_t* page = cpu->mem->writePages[addr >> BUS_PAGE_SHIFT];
+
+    // IE is the high byte of a pair at 0xfffe, which needs write_mem's check
+    if (is_plain_pair(addr) && addr != 0xfffe && page)
+    {
+        memcpy(&page[addr & (BUS_PAGE_SIZE - 1)], &value, 2);
+
+#if BLOCK_CACHE
+        if (cpu->blockCache && (cpu->blockCache->codeCount[addr] | cpu->blockCache->codeCount[addr + 1]))
+        {
+            invalidate_code(cpu->blockCache, addr);
+            invalidate_code(cpu->blockCache, addr + 1);
+        }
+#endif
+
+#if AOT
+        if (addr < AOT_ROM_END && cpu->aot)
+        {
+            aot_invalidate(cpu->aot, cpu->mem, addr);
+            aot_invalidate(cpu->aot, cpu->mem, addr + 1);
+        }
+#endif
+        return;
+    }
+
+    write_mem(cpu, addr, value & 0xff);
+    write_mem(cpu, addr + 1, value >> 8);
+}
+
+uint16_t get_inst_16(CPU* cpu)
+{
+    uint16_t value = read_mem_16(cpu, cpu->pc);
+    cpu->pc += 2;
+    return value;
+}
+
+void push_16(CPU* cpu, uint16_t value)
+{
+    cpu->sp -= 2;
+    write_mem_16(cpu, cpu->sp, value);
+}
+
+uint16_t pop_16(CPU* cpu)
+{
+    uint16_t value = read_mem_16(cpu, cpu->sp);
+    cpu->sp += 2;
+    return value;
+}
+
+#if LAZY_FLAGS
+
+// Computes F from the last recorded flag operation. Bits the operation leaves
+// unchanged come from f, which is kept up to date for them.
+static uint8_t compute_flags(CPU* cpu)
+{
+    uint16_t lhs = cpu->flagLhs;
+    uint16_t rhs = cpu->flagRhs;
+    uint32_t result = cpu->flagResult;
+    bool carryIn = cpu->flagCarryIn;
+
+    uint8_t zero = (result & 0xff) == 0 ? 0x80 : 0;
+    uint8_t flags;
+
+    switch (cpu->flagOp)
+    {
+        case FLAGS_ADD:
+            flags = zero | ((((lhs & 0xf) + (rhs & 0xf) + carryIn) & 0x10) ? 0x20 : 0) | (result > 0xff ? 0x10 : 0);
+            break;
+        case FLAGS_SUB:
+            flags = zero | 0x40 | ((((lhs & 0xf) - (rhs & 0xf) - carryIn) & 0x10) ? 0x20 : 0) | ((result & 0x100) ? 0x10 : 0);
+            break;
+        case FLAGS_AND:
+            flags = zero | 0x20;
+            break;
+        case FLAGS_LOGIC:
+            flags = zero;
+            break;
+        case FLAGS_INC:
+            flags = zero | ((lhs & 0xf) == 0xf ? 0x20 : 0) | (cpu->f & 0x10);
+            break;
+        case FLAGS_DEC:
+            flags = zero | 0x40 | ((lhs & 0xf) == 0 ? 0x20 : 0) | (cpu->f & 0x10);
+            break;
+        case FLAGS_ADD_HL:
+            flags = (cpu->f & 0x80) | ((((lhs & 0xfff) + (rhs & 0xfff)) & 0x1000) ? 0x20 : 0) | (result > 0xffff ? 0x10 : 0);
+            break;
+        case FLAGS_SHIFT:
+            flags = zero | (carryIn ? 0x10 : 0);
+            break;
+        default:
+            return cpu->f;
+    }
+
+    return flags | (cpu->f & 0x0f);
+}
+
+static inline uint8_t current_flags(CPU* cpu)
+{
+    return cpu->flagOp == FLAGS_NONE ? cpu->f : compute_flags(cpu);
+}
+
+// Writes the pending flags back to f; called before anything touches f directly
+static inline void materialize_flags(CPU* cpu)
+{
+    if (cpu->flagOp != FLAGS_NONE)
+    {
+        cpu->f = compute_flags(cpu);
+        cpu->flagOp = FLAGS_NONE;
+    }
+}
+
+static inline bool read_carry(CPU* cpu)
+{
+    return (current_flags(cpu) >> 4) & 1;
+}
+
+static inline void record_flags(CPU* cpu, uint8_t op, uint16_t lhs, uint16_t rhs, uint32_t result, bool carryIn)
+{
+    cpu->flagOp = op;
+    cpu->flagLhs = lhs;
+    cpu->flagRhs = rhs;
+    cpu->flagResult = result;
+    cpu->flagCarryIn = carryIn;
+}
+
+#else
+
+#define materialize_flags(cpu) ((void)0)
+#define read_carry(cpu) ((cpu)->carry)
+
+#if FLAT_REGS
+static inline uint8_t current_flags(CPU* cpu)
+{
+    return (cpu->z << 7) | (cpu->n << 6) | (cpu->half_carry << 5) | (cpu->carry << 4);
+}
+#else
+#define current_flags(cpu) ((cpu)->f)
+#endif
+
+#endif
+
+uint8_t read_flags(CPU* cpu)
+{
+    return current_flags(cpu);
+}
+
+void write_flags(CPU* cpu, uint8_t flags)
+{
+#if FLAT_REGS
+    cpu->z = flags & 0x80;
+    cpu->n = flags & 0x40;
+    cpu->half_carry = flags & 0x20;
+    cpu->carry = flags & 0x10;
+#else
+#if LAZY_FLAGS
+    cpu->flagOp = FLAGS_NONE;
+#endif
+    cpu->f = flags;
+#endif
+}
+
+// AF as PUSH AF stores it; POP AF cannot set the low nibble of F
+static inline uint16_t read_af(CPU* cpu)
+{
+    return (cpu->a << 8) | current_flags(cpu);
+}
+
+static inline void write_af(CPU* cpu, uint16_t value)
+{
+    cpu->a = value >> 8;
+    write_flags(cpu, value & 0xf0);
+}
+
+#if ALU_TABLES
+
+// Precomputed 8-bit arithmetic: the result byte in the low half of each entry
+// and the Z N H C nibble of F in the high half, indexed by carry-in, A and the
+// operand. SUB entries also serve SBC and CP.
+static uint16_t addTable[2][0x100][0x100];
+static uint16_t subTable[2][0x100][0x100];
+
+// INC/DEC result and Z N H, indexed by the operand; C is left as it was
+static uint16_t incTable[0x100];
+static uint16_t decTable[0x100];
+
+static void init_alu_tables(void)
+{
+    static bool initialized = false;
+    if (initialized) return;
+
+    for (int carryIn = 0; carryIn < 2; carryIn++)
+    {
+        for (int a = 0; a < 0x100; a++)
+        {
+            for (int value = 0; value < 0x100; value++)
+            {
+                int sum = a + value + carryIn;
+                uint8_t flags = ((uint8_t)sum == 0 ? 0x80 : 0)
+                    | (((a & 0xf) + (value & 0xf) + carryIn) & 0x10 ? 0x20 : 0)
+                    | (sum > 0xff ? 0x10 : 0);
+                addTable[carryIn][a][value] = (uint8_t)sum | (flags << 8);
+
+                int diff = a - value - carryIn;
+                flags = ((uint8_t)diff == 0 ? 0x80 : 0) | 0x40
+                    | (((a & 0xf) - (value & 0xf) - carryIn) & 0x10 ? 0x20 : 0)
+                    | (diff < 0 ? 0x10 : 0);
+                subTable[carryIn][a][value] = (uint8_t)diff | (flags << 8);
+            }
+        }
+    }
+
+    for (int value = 0; value < 0x100; value++)
+    {
+        uint8_t result = value + 1;
+        incTable[value] = result | (((result == 0 ? 0x80 : 0) | ((value & 0xf) == 0xf ? 0x20 : 0)) << 8);
+
+        result = value - 1;
+        decTable[value] = result | (((result == 0 ? 0x80 : 0) | 0x40 | ((value & 0xf) == 0 ? 0x20 : 0)) << 8);
+    }
+
+    initialized = true;
+}
+
+#endif
+
+// ALU operations shared by the generic and specialized handlers
+
+static inline void alu_add(CPU* cpu, uint8_t value, bool carryIn)
+{
+#if LAZY_FLAGS
+    int sum = cpu->a + value + carryIn;
+
+    record_flags(cpu, FLAGS_ADD, cpu->a, value, sum, carryIn);
+    cpu->a = sum;
+#elif ALU_TABLES
+    uint16_t entry = addTable[carryIn][cpu->a][value];
+
+    cpu->a = entry;
+    cpu->f = (entry >> 8) | (cpu->f & 0x0f);
+#else
+    int sum = cpu->a + value + carryIn;
+
+    cpu->half_carry = (value & 0xf) + (cpu->a & 0xf) + carryIn & 0x10;
+
+    cpu->a = sum;
+
+    cpu->z = cpu->a == 0;
+    cpu->n = 0;
+    cpu->carry = sum > 0xff;
+#endif
+}
+
+static inline void alu_sub(CPU* cpu, uint8_t value, bool carryIn, bool store)
+{
+#if LAZY_FLAGS
+    int diff = cpu->a - value - carryIn;
+
+    record_flags(cpu, FLAGS_SUB, cpu->a, value, diff, carryIn);
+    if (store) cpu->a = diff;
+#elif ALU_TABLES
+    uint16_t entry = subTable[carryIn][cpu->a][value];
+
+    if (store) cpu->a = entry;
+    cpu->f = (entry >> 8) | (cpu->f & 0x0f);
+#else
+    int diff = cpu->a - value - carryIn;
+
+    cpu->half_carry = (cpu->a & 0xf) - (value & 0xf) - carryIn & 0x10;
+
+    if (store) cpu->a = diff;
+
+    cpu->z = (uint8_t)diff == 0;
+    cpu->n = 1;
+    cpu->carry = diff < 0;
+#endif
+}
+
+static inline void alu_and(CPU* cpu, uint8_t value)
+{
+    cpu->a &= value;
+
+#if LAZY_FLAGS
+    record_flags(cpu, FLAGS_AND, 0, 0, cpu->a, 0);
+#else
+    cpu->z = cpu->a == 0;
+    cpu->n = 0;
+    cpu->half_carry = 1;
+    cpu->carry = 0;
+#endif
+}
+
+static inline void alu_or(CPU* cpu, uint8_t value)
+{
+    cpu->a |= value;
+
+#if LAZY_FLAGS
+    record_flags(cpu, FLAGS_LOGIC, 0, 0, cpu->a, 0);
+#else
+    cpu->z = cpu->a == 0;
+    cpu->n = 0;
+    cpu->half_carry = 0;
+    cpu->carry = 0;
+#endif
+}
+
+static inline void alu_xor(CPU* cpu, uint8_t value)
+{
+    cpu->a ^= value;
+
+#if LAZY_FLAGS
+    record_flags(cpu, FLAGS_LOGIC, 0, 0, cpu->a, 0);
+#else
+    cpu->z = cpu->a == 0;
+    cpu->n = 0;
+    cpu->half_carry = 0;
+    cpu->carry = 0;
+#endif
 }
 
-uint8_t* get_reg_8(CPU* cpu, int index)
+static inline uint8_t alu_inc(CPU* cpu, uint8_t value)
 {
-    uint8_t* regMap[] = {
-        &cpu->b,
-        &cpu->c,
-        &cpu->d,
-        &cpu->e,
-        &cpu->h,
-        &cpu->l,
-        &cpu->mem->ram[cpu->hl],
-        &cpu->a
-    };
+    uint8_t result = value + 1;
+
+#if LAZY_FLAGS
+    cpu->carry = read_carry(cpu);
+    record_flags(cpu, FLAGS_INC, value, 0, result, 0);
+#elif ALU_TABLES
+    uint16_t entry = incTable[value];
+
+    result = entry;
+    cpu->f = (entry >> 8) | (cpu->f & 0x1f);
+#else
+    cpu->n = 0;
+    cpu->half_carry = (value & 0xf) == 0xf;
+    cpu->z = result == 0;
+#endif
 
-    return regMap[index];
+    return result;
 }
 
-uint16_t* get_reg_16(CPU* cpu, int index)
+static inline uint8_t alu_dec(CPU* cpu, uint8_t value)
 {
-    uint16_t* regMap[] = {
-        &cpu->bc,
-        &cpu->de,
-        &cpu->hl,
-        &cpu->sp
-    };
+    uint8_t result = value - 1;
+
+#if LAZY_FLAGS
+    cpu->carry = read_carry(cpu);
+    record_flags(cpu, FLAGS_DEC, value, 0, result, 0);
+#elif ALU_TABLES
+    uint16_t entry = decTable[value];
 
-    return regMap[index];
+    result = entry;
+    cpu->f = (entry >> 8) | (cpu->f & 0x1f);
+#else
+    cpu->n = 1;
+    cpu->half_carry = (value & 0xf) == 0;
+    cpu->z = result == 0;
+#endif
+
+    return result;
 }
 
-uint8_t* get_reg_a16(CPU* cpu, int index)
+static inline void alu_add_hl(CPU* cpu, uint16_t value)
 {
-    uint8_t* regMap[] = {
-        &cpu->mem->ram[cpu->bc],
-        &cpu->mem->ram[cpu->de],
-        &cpu->mem->ram[cpu->hl],
-        &cpu->mem->ram[cpu->hl]
-    };
+    int sum = cpu->hl + value;
+
+#if LAZY_FLAGS
+    materialize_flags(cpu);
+    record_flags(cpu, FLAGS_ADD_HL, cpu->hl, value, sum, 0);
+#else
+    cpu->n = 0;
+    cpu->half_carry = (value & 0xfff) + (cpu->hl & 0xfff) & 0x1000;
+    cpu->carry = sum > 0xffff;
+#endif
+
+    cpu->hl = sum;
+}
 
-    if (index == 2) cpu->hl++;
-    else if (index == 3) cpu->hl--;
+// Rotates and shifts of the CB table; carryOut is the bit shifted out
+static inline uint8_t alu_shift_flags(CPU* cpu, uint8_t result, bool carryOut)
+{
+#if LAZY_FLAGS
+    record_flags(cpu, FLAGS_SHIFT, 0, 0, result, carryOut);
+#else
+    cpu->n = 0;
+    cpu->half_carry = 0;
+    cpu->carry = carryOut;
+    cpu->z = result == 0;
+#endif
 
-    return regMap[index];
+    return result;
 }
 
+static inline uint8_t alu_rlc(CPU* cpu, uint8_t value)
+{
+    return alu_shift_flags(cpu, (value << 1) | (value >> 7), value >> 7);
+}
+
+static inline uint8_t alu_rrc(CPU* cpu, uint8_t value)
+{
+    return alu_shift_flags(cpu, (value >> 1) | (value << 7), value & 1);
+}
+
+static inline uint8_t alu_rl(CPU* cpu, uint8_t value)
+{
+    return alu_shift_flags(cpu, (value << 1) | read_carry(cpu), value >> 7);
+}
+
+static inline uint8_t alu_rr(CPU* cpu, uint8_t value)
+{
+    return alu_shift_flags(cpu, (value >> 1) | (read_carry(cpu) << 7), value & 1);
+}
+
+static inline uint8_t alu_sla(CPU* cpu, uint8_t value)
+{
+    return alu_shift_flags(cpu, value << 1, value >> 7);
+}
+
+static inline uint8_t alu_sra(CPU* cpu, uint8_t value)
+{
+    return alu_shift_flags(cpu, (value >> 1) | (value & 0x80), value & 1);
+}
+
+static inline uint8_t alu_swap(CPU* cpu, uint8_t value)
+{
+    return alu_shift_flags(cpu, (value >> 4) | (value << 4), 0);
+}
+
+static inline uint8_t alu_srl(CPU* cpu, uint8_t value)
+{
+    return alu_shift_flags(cpu, value >> 1, value & 1);
+}
+
+static inline void alu_bit(CPU* cpu, uint8_t value, int bitIndex)
+{
+    materialize_flags(cpu);
+
+    cpu->n = 0;
+    cpu->half_carry = 1;
+    cpu->z = !(value & (1 << bitIndex));
+}
+
+// Handlers return their M-cycles from the opcode tables rather than constants
+// of their own, so the timing can be looked up without running anything
+#define CYCLES(inst) opcode_cycles[inst][0]
+#define CB_CYCLES(inst) opcode_cycles[0x100 | (inst)][0]
+#define BRANCH_CYCLES(inst, taken) ((taken) ? opcode_cycles[inst][1] : opcode_cycles[inst][0])
+
 int noop(CPU* cpu, uint8_t inst)
 {
-    return 1;
+    return CYCLES(inst);
 }
 
+static inline uint8_t pending_interrupts(CPU* cpu)
+{
+    return read_io(cpu, REG_IE & 0xff) & read_io(cpu, REG_IF & 0xff) & 0x1f;
+}
+
+// Sleeps until a joypad interrupt is requested
 int stop(CPU* cpu, uint8_t inst)
 {
     get_inst(cpu);
-    return 1;
+    cpu->stopped = true;
+    cpu->checkState = true;
+    return CYCLES(inst);
 }
 
+// Sleeps until an interrupt is pending. With IME off and one already pending
+// the CPU doesn't halt and instead fails to advance PC past the next opcode.
 int halt(CPU* cpu, uint8_t inst)
 {
-    return 1;
+    if (!cpu->ime && pending_interrupts(cpu)) cpu->haltBug = true;
+    else cpu->halted = true;
+
+    cpu->checkState = true;
+    return CYCLES(inst);
 }
 
 int di(CPU* cpu, uint8_t inst)
 {
-    return 1;
+    cpu->ime = false;
+    cpu->imeDelay = 0;
+    return CYCLES(inst);
 }
 
+// IME turns on after the instruction following EI
 int ei(CPU* cpu, uint8_t inst)
 {
-    return 1;
+    if (!cpu->ime)
+    {
+        cpu->imeDelay = 2;
+        cpu->checkState = true;
+    }
+    return CYCLES(inst);
 }
 
 int inc_16(CPU* cpu, uint8_t inst)
 {
-    (&cpu->af)[1 + (inst >> 4)]++;
-    return 2;
+    (*get_reg_16(cpu, inst >> 4))++;
+    return CYCLES(inst);
 }
 
 int dec_16(CPU* cpu, uint8_t inst)
 {
-    (&cpu->af)[1 + (inst >> 4)]--;
-    return 2;
+    (*get_reg_16(cpu, inst >> 4))--;
+    return CYCLES(inst);
 }
 
 int inc_8(CPU* cpu, uint8_t inst)
 {
     uint8_t regIndex = ((inst >> 3) & 1) + 2 * (inst >> 4);
-    uint8_t* reg = get_reg_8(cpu, regIndex);
 
-    cpu->n = 0;
-    cpu->half_carry = ((*reg)++ & 0xf) + (1 & 0xf) & 0x10;
-    cpu->z = (*reg) == 0;
+    write_reg_8(cpu, regIndex, alu_inc(cpu, read_reg_8(cpu, regIndex)));
 
-    return regIndex == 6 ? 3 : 1;
+    return CYCLES(inst);
 }
 
 int dec_8(CPU* cpu, uint8_t inst)
 {
     uint8_t regIndex = ((inst >> 3) & 1) + 2 * (inst >> 4);
-    uint8_t* reg = get_reg_8(cpu, regIndex);
 
-    cpu->n = 1;
-    cpu->half_carry = ((*reg)-- & 0xf) - (1 & 0xf) & 0x10;
-    cpu->z = (*reg) == 0;
+    write_reg_8(cpu, regIndex, alu_dec(cpu, read_reg_8(cpu, regIndex)));
 
-    return regIndex == 6 ? 3 : 1;
+    return CYCLES(inst);
 }
 
 int ld_8(CPU* cpu, uint8_t inst)
 {
     uint8_t destRegIndex = (inst - 0x40) >> 3;
-    uint8_t* destReg = get_reg_8(cpu, destRegIndex);
-
     uint8_t srcRegIndex = inst & 0x7;
-    uint8_t* srcReg = get_reg_8(cpu, srcRegIndex);
 
-    *destReg = *srcReg;
+    write_reg_8(cpu, destRegIndex, read_reg_8(cpu, srcRegIndex));
 
-    return destRegIndex == 6 || srcRegIndex == 6 ? 2 : 1;
+    return CYCLES(inst);
 }
 
 int ld_8_d8(CPU* cpu, uint8_t inst)
 {
     uint8_t destRegIndex = inst >> 3;
-    uint8_t* destReg = get_reg_8(cpu, destRegIndex);
 
-    *destReg = get_inst(cpu);
+    write_reg_8(cpu, destRegIndex, get_inst(cpu));
 
-    return destRegIndex == 6 ? 3 : 2;
+    return CYCLES(inst);
 }
 
 int ld_16(CPU* cpu, uint8_t inst)
@@ -154,100 +716,70 @@ int ld_16(CPU* cpu, uint8_t inst)
     uint16_t destRegIndex = inst >> 4;
     uint16_t* destReg = get_reg_16(cpu, destRegIndex);
 
-    *destReg = get_inst(cpu) | (get_inst(cpu) << 8);
+    *destReg = get_inst_16(cpu);
 
-    return 3;
+    return CYCLES(inst);
 }
 
 int ld_a16(CPU* cpu, uint8_t inst)
 {
     uint16_t destRegIndex = inst >> 4;
-    uint8_t* destReg = get_reg_a16(cpu, destRegIndex);
 
-    *destReg = cpu->a;
+    write_mem(cpu, get_indirect_addr(cpu, destRegIndex), cpu->a);
 
-    return 2;
+    return CYCLES(inst);
 }
 
 int ld_a_a16(CPU* cpu, uint8_t inst)
 {
     uint16_t srcRegIndex = inst >> 4;
-    uint8_t* srcReg = get_reg_a16(cpu, srcRegIndex);
 
-    cpu->a = *srcReg;
+    cpu->a = read_mem(cpu, get_indirect_addr(cpu, srcRegIndex));
 
-    return 2;
+    return CYCLES(inst);
 }
 
 int ld_a16_sp(CPU* cpu, uint8_t inst)
 {
-    uint16_t addr = get_inst(cpu) | (get_inst(cpu) << 8);
+    uint16_t addr = get_inst_16(cpu);
 
-    cpu->mem->ram[addr] = cpu->sp & 0xff;
-    cpu->mem->ram[addr + 1] = cpu->sp >> 8;
+    write_mem_16(cpu, addr, cpu->sp);
 
-    return 5;
+    return CYCLES(inst);
 }
 
 int ld_a_8(CPU* cpu, uint8_t inst)
 {
-    uint16_t addr = get_inst(cpu) | 0xff00;
+    uint8_t port = get_inst(cpu);
 
-    uint8_t* reg1 = &cpu->a;
-    uint8_t* reg2 = &cpu->mem->ram[addr];
+    if (inst < 0xf0) write_io(cpu, port, cpu->a);
+    else cpu->a = read_io(cpu, port);
 
-    if (inst < 0xf0)
-    {
-        uint8_t* temp = reg1;
-        reg1 = reg2;
-        reg2 = temp;
-    }
-
-    *reg1 = *reg2;
-
-    return 3;
+    return CYCLES(inst);
 }
 
 int ld_a_c(CPU* cpu, uint8_t inst)
 {
-    uint16_t addr = cpu->c | 0xff00;
-
-    uint8_t* reg1 = &cpu->a;
-    uint8_t* reg2 = &cpu->mem->ram[addr];
+    if (inst < 0xf0) write_io(cpu, cpu->c, cpu->a);
+    else cpu->a = read_io(cpu, cpu->c);
 
-    if (inst < 0xf0)
-    {
-        uint8_t* temp = reg1;
-        reg1 = reg2;
-        reg2 = temp;
-    }
-
-    *reg1 = *reg2;
-
-    return 2;
+    return CYCLES(inst);
 }
 
 int ld_a_16(CPU* cpu, uint8_t inst)
 {
-    uint16_t addr = get_inst(cpu) | (get_inst(cpu) << 8);
-
-    uint8_t* reg1 = &cpu->a;
-    uint8_t* reg2 = &cpu->mem->ram[addr];
+    uint16_t addr = get_inst_16(cpu);
 
-    if (inst < 0xf0)
-    {
-        uint8_t* temp = reg1;
-        reg1 = reg2;
-        reg2 = temp;
-    }
-
-    *reg1 = *reg2;
+    if (inst < 0xf0) write_mem(cpu, addr, cpu->a);
+    else cpu->a = read_mem(cpu, addr);
 
-    return 4;
+    return CYCLES(inst);
 }
 
 int ld_hl_sp_s8(CPU* cpu, uint8_t inst)
 {
+    materialize_flags(cpu);
+
     int8_t imm = get_inst(cpu);
 
     int sum = cpu->sp + imm;
@@ -260,14 +792,14 @@ int ld_hl_sp_s8(CPU* cpu, uint8_t inst)
     cpu->z = 0;
     cpu->n = 0;
 
-    return 3;
+    return CYCLES(inst);
 }
 
 int ld_sp_hl(CPU* cpu, uint8_t inst)
 {
     cpu->sp = cpu->hl;
 
-    return 2;
+    return CYCLES(inst);
 }
 
 int add_hl(CPU* cpu, uint8_t inst)
@@ -275,169 +807,96 @@ int add_hl(CPU* cpu, uint8_t inst)
     int destRegIndex = inst >> 4;
     uint16_t* reg = get_reg_16(cpu, destRegIndex);
 
-    int sum = cpu->hl + (*reg);
-
-    cpu->n = 0;
-    cpu->half_carry = ((*reg) & 0xfff) + (cpu->hl & 0xfff) & 0x1000;
-    cpu->carry = sum > 0xffff;
+    alu_add_hl(cpu, *reg);
 
-    cpu->hl = sum;
-
-    return 2;
+    return CYCLES(inst);
 }
 
 int add_8(CPU* cpu, uint8_t inst)
 {
     uint8_t regIndex = inst & 0x7;
-    uint8_t* reg = get_reg_8(cpu, regIndex);
-
-    int sum = cpu->a + *reg;
 
-    cpu->half_carry = ((*reg) & 0xf) + (cpu->a & 0xf) & 0x10;
+    alu_add(cpu, read_reg_8(cpu, regIndex), 0);
 
-    cpu->a = sum;
-
-    cpu->z = cpu->a == 0;
-    cpu->n = 0;
-    cpu->carry = sum > 0xff;
-
-    return regIndex == 6 ? 2 : 1;
+    return CYCLES(inst);
 }
 
 int sub_8(CPU* cpu, uint8_t inst)
 {
     uint8_t regIndex = inst & 0x7;
-    uint8_t* reg = get_reg_8(cpu, regIndex);
-
-    int diff = cpu->a - *reg;
-
-    cpu->half_carry = (cpu->a & 0xf) - ((*reg) & 0xf) & 0x10;
 
-    cpu->a = diff;
-
-    cpu->z = cpu->a == 0;
-    cpu->n = 1;
-    cpu->carry = diff < 0;
+    alu_sub(cpu, read_reg_8(cpu, regIndex), 0, true);
 
-    return regIndex == 6 ? 2 : 1;
+    return CYCLES(inst);
 }
 
 int and_8(CPU* cpu, uint8_t inst)
 {
     uint8_t regIndex = inst & 0x7;
-    uint8_t* reg = get_reg_8(cpu, regIndex);
-
-    cpu->a &= *reg;
 
-    cpu->z = cpu->a == 0;
-    cpu->n = 0;
-    cpu->half_carry = 1;
-    cpu->carry = 0;
+    alu_and(cpu, read_reg_8(cpu, regIndex));
 
-    return regIndex == 6 ? 2 : 1;
+    return CYCLES(inst);
 }
 
 int or_8(CPU* cpu, uint8_t inst)
 {
     uint8_t regIndex = inst & 0x7;
-    uint8_t* reg = get_reg_8(cpu, regIndex);
 
-    cpu->a |= *reg;
+    alu_or(cpu, read_reg_8(cpu, regIndex));
 
-    cpu->z = cpu->a == 0;
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = 0;
-
-    return regIndex == 6 ? 2 : 1;
+    return CYCLES(inst);
 }
 
 int xor_8(CPU* cpu, uint8_t inst)
 {
     uint8_t regIndex = inst & 0x7;
-    uint8_t* reg = get_reg_8(cpu, regIndex);
-
-    cpu->a ^= *reg;
 
-    cpu->z = cpu->a == 0;
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = 0;
+    alu_xor(cpu, read_reg_8(cpu, regIndex));
 
-    return regIndex == 6 ? 2 : 1;
+    return CYCLES(inst);
 }
 
 int cp_8(CPU* cpu, uint8_t inst)
 {
     uint8_t regIndex = inst & 0x7;
-    uint8_t* reg = get_reg_8(cpu, regIndex);
-
-    int diff = cpu->a - *reg;
 
-    cpu->half_carry = (cpu->a & 0xf) - ((*reg) & 0xf) & 0x10;
-
-    cpu->z = !diff;
-    cpu->n = 1;
-    cpu->carry = diff < 0;
+    alu_sub(cpu, read_reg_8(cpu, regIndex), 0, false);
 
-    return regIndex == 6 ? 2 : 1;
+    return CYCLES(inst);
 }
 
 int adc_8(CPU* cpu, uint8_t inst)
 {
     uint8_t regIndex = inst & 0x7;
-    uint8_t* reg = get_reg_8(cpu, regIndex);
-
-    int sum = *reg + cpu->carry + cpu->a;
-
-    cpu->half_carry = ((*reg) & 0xf) + (cpu->a & 0xf) + (cpu->carry & 0xf) & 0x10;
-
-    cpu->a = sum;
 
-    cpu->z = cpu->a == 0;
-    cpu->n = 0;
-    cpu->carry = sum > 0xff;
+    alu_add(cpu, read_reg_8(cpu, regIndex), read_carry(cpu));
 
-    return regIndex == 6 ? 2 : 1;
+    return CYCLES(inst);
 }
 
 int sbc_8(CPU* cpu, uint8_t inst)
 {
     uint8_t regIndex = inst & 0x7;
-    uint8_t* reg = get_reg_8(cpu, regIndex);
 
-    int sum = cpu->a - *reg - cpu->carry;
+    alu_sub(cpu, read_reg_8(cpu, regIndex), read_carry(cpu), true);
 
-    cpu->half_carry = (cpu->a & 0xf) - ((*reg) & 0xf) - (cpu->carry & 0xf) & 0x10;
-
-    cpu->a = sum;
-
-    cpu->z = cpu->a == 0;
-    cpu->n = 1;
-    cpu->carry = sum < 0;
-
-    return regIndex == 6 ? 2 : 1;
+    return CYCLES(inst);
 }
 
 int add_d8(CPU* cpu, uint8_t inst)
 {
     uint8_t reg = get_inst(cpu);
 
-    int sum = cpu->a + reg;
-
-    cpu->half_carry = (reg & 0xf) + (cpu->a & 0xf) & 0x10;
+    alu_add(cpu, reg, 0);
 
-    cpu->a = sum;
-
-    cpu->z = cpu->a == 0;
-    cpu->n = 0;
-    cpu->carry = sum > 0xff;
-
-    return 2;
+    return CYCLES(inst);
 }
 
 int add_s8(CPU* cpu, uint8_t inst)
 {
+    materialize_flags(cpu);
+
     int8_t reg = get_inst(cpu);
 
     int sum = cpu->sp + reg;
@@ -450,119 +909,76 @@ int add_s8(CPU* cpu, uint8_t inst)
     cpu->z = cpu->sp == 0;
     cpu->n = 0;
 
-    return 4;
+    return CYCLES(inst);
 }
 
 int sub_d8(CPU* cpu, uint8_t inst)
 {
     uint8_t reg = get_inst(cpu);
 
-    int diff = cpu->a - reg;
-
-    cpu->half_carry = (cpu->a & 0xf) - (reg & 0xf) & 0x10;
-
-    cpu->a = diff;
-
-    cpu->z = cpu->a == 0;
-    cpu->n = 1;
-    cpu->carry = diff < 0;
-
-    return 2;
+    alu_sub(cpu, reg, 0, true);
+
+    return CYCLES(inst);
 }
 
 int and_d8(CPU* cpu, uint8_t inst)
 {
     uint8_t reg = get_inst(cpu);
 
-    cpu->a &= reg;
-
-    cpu->z = cpu->a == 0;
-    cpu->n = 0;
-    cpu->half_carry = 1;
-    cpu->carry = 0;
+    alu_and(cpu, reg);
 
-    return 2;
+    return CYCLES(inst);
 }
 
 int or_d8(CPU* cpu, uint8_t inst)
 {
     uint8_t reg = get_inst(cpu);
 
-    cpu->a |= reg;
-
-    cpu->z = cpu->a == 0;
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = 0;
+    alu_or(cpu, reg);
 
-    return 2;
+    return CYCLES(inst);
 }
 
 int xor_d8(CPU* cpu, uint8_t inst)
 {
     uint8_t reg = get_inst(cpu);
 
-    cpu->a ^= reg;
-
-    cpu->z = cpu->a == 0;
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = 0;
+    alu_xor(cpu, reg);
 
-    return 2;
+    return CYCLES(inst);
 }
 
 int cp_d8(CPU* cpu, uint8_t inst)
 {
     uint8_t reg = get_inst(cpu);
 
-    int diff = cpu->a - reg;
+    alu_sub(cpu, reg, 0, false);
 
-    cpu->half_carry = (cpu->a & 0xf) - (reg & 0xf) & 0x10;
-
-    cpu->z = !diff;
-    cpu->n = 1;
-    cpu->carry = diff < 0;
-
-    return 2;
+    return CYCLES(inst);
 }
 
 int adc_d8(CPU* cpu, uint8_t inst)
 {
     uint8_t reg = get_inst(cpu);
 
-    int sum = reg + cpu->carry + cpu->a;
-
-    cpu->half_carry = (reg & 0xf) + (cpu->a & 0xf) + (cpu->carry & 0xf) & 0x10;
-
-    cpu->a = sum;
-
-    cpu->z = cpu->a == 0;
-    cpu->n = 0;
-    cpu->carry = sum > 0xff;
+    alu_add(cpu, reg, read_carry(cpu));
 
-    return 2;
+    return CYCLES(inst);
 }
 
 int sbc_d8(CPU* cpu, uint8_t inst)
 {
     uint8_t reg = get_inst(cpu);
 
-    int sum = cpu->a - reg - cpu->carry;
-
-    cpu->half_carry = (cpu->a & 0xf) - (reg & 0xf) - (cpu->carry & 0xf) & 0x10;
-
-    cpu->a = sum;
-
-    cpu->z = cpu->a == 0;
-    cpu->n = 1;
-    cpu->carry = sum < 0;
+    alu_sub(cpu, reg, read_carry(cpu), true);
 
-    return 2;
+    return CYCLES(inst);
 }
 
 int rlca(CPU* cpu, uint8_t inst)
 {
+    materialize_flags(cpu);
+
     cpu->z = 0;
     cpu->n = 0;
     cpu->half_carry = 0;
@@ -570,11 +986,13 @@ int rlca(CPU* cpu, uint8_t inst)
 
     cpu->a = (cpu->a << 1) | cpu->carry;
 
-    return 1;
+    return CYCLES(inst);
 }
 
 int rrca(CPU* cpu, uint8_t inst)
 {
+    materialize_flags(cpu);
+
     cpu->z = 0;
     cpu->n = 0;
     cpu->half_carry = 0;
@@ -582,11 +1000,13 @@ int rrca(CPU* cpu, uint8_t inst)
 
     cpu->a = (cpu->a >> 1) | (cpu->carry << 7);
 
-    return 1;
+    return CYCLES(inst);
 }
 
 int rla(CPU* cpu, uint8_t inst)
 {
+    materialize_flags(cpu);
+
     bool oldCarry = cpu->carry;
 
     cpu->z = 0;
@@ -596,11 +1016,13 @@ int rla(CPU* cpu, uint8_t inst)
 
     cpu->a = (cpu->a << 1) | oldCarry;
 
-    return 1;
+    return CYCLES(inst);
 }
 
 int rra(CPU* cpu, uint8_t inst)
 {
+    materialize_flags(cpu);
+
     bool oldCarry = cpu->carry;
 
     cpu->z = 0;
@@ -610,56 +1032,87 @@ int rra(CPU* cpu, uint8_t inst)
 
     cpu->a = (cpu->a >> 1) | (oldCarry << 7);
 
-    return 1;
+    return CYCLES(inst);
 }
 
 int jr(CPU* cpu, uint8_t inst)
 {
     cpu->pc += (int8_t)get_inst(cpu);
 
-    return 3;
+    return CYCLES(inst);
+}
+
+// The condition of every conditional JR/JP/CALL/RET is in bits 3-4 of the
+// opcode: NZ, Z, NC, C. Each is one flag compared against a wanted value.
+#if FLAT_REGS
+static const uint8_t conditionFlags[4] = { offsetof(CPU, z), offsetof(CPU, z), offsetof(CPU, carry), offsetof(CPU, carry) };
+
+static inline bool check_condition(CPU* cpu, uint8_t inst)
+{
+    int cc = (inst >> 3) & 3;
+    return *((bool*)cpu + conditionFlags[cc]) == (cc & 1);
+}
+#else
+static const uint8_t conditionMasks[4] = { 0x80, 0x80, 0x10, 0x10 };
+static const uint8_t conditionValues[4] = { 0x00, 0x80, 0x00, 0x10 };
+
+static inline bool check_condition(CPU* cpu, uint8_t inst)
+{
+    int cc = (inst >> 3) & 3;
+    return (current_flags(cpu) & conditionMasks[cc]) == conditionValues[cc];
 }
+#endif
+
+#if BRANCH_PROFILE
+static inline bool count_branch(CPU* cpu, uint8_t inst, bool taken)
+{
+    cpu->branchCounts[inst][taken]++;
+    return taken;
+}
+#else
+#define count_branch(cpu, inst, taken) (taken)
+#endif
 
 int jr_8(CPU* cpu, uint8_t inst)
 {
-    bool flag = (inst >= 0x30) ? cpu->carry : cpu->z;
-    if ((inst & 0xf) < 0x8) flag = !flag;
+    bool flag = check_condition(cpu, inst);
 
     int8_t dist = get_inst(cpu);
 
     cpu->pc += flag ? dist : 0;
 
-    return flag ? 3 : 2;
+    return BRANCH_CYCLES(inst, count_branch(cpu, inst, flag));
 }
 
 int jp(CPU* cpu, uint8_t inst)
 {
-    cpu->pc = get_inst(cpu) | (get_inst(cpu) << 8);
+    cpu->pc = get_inst_16(cpu);
 
-    return 4;
+    return CYCLES(inst);
 }
 
 int jp_16(CPU* cpu, uint8_t inst)
 {
-    bool flag = (inst >= 0xd0) ? cpu->carry : cpu->z;
-    if ((inst & 0xf) < 0x8) flag = !flag;
+    bool flag = check_condition(cpu, inst);
 
-    uint16_t newPC = get_inst(cpu) | (get_inst(cpu) << 8);
+    uint16_t newPC = get_inst_16(cpu);
 
     if (flag) cpu->pc = newPC;
 
-    return flag ? 4 : 3;
+    return BRANCH_CYCLES(inst, count_branch(cpu, inst, flag));
 }
 
 int jp_hl(CPU* cpu, uint8_t inst)
 {
     cpu->pc = cpu->hl;
 
-    return 1;
+    return CYCLES(inst);
 }
 
 int daa(CPU* cpu, uint8_t inst)
 {
+    materialize_flags(cpu);
+
     if (!cpu->n)
     {
         if (cpu->carry || cpu->a > 0x99) { cpu->a += 0x60; cpu->carry = 1; }
@@ -674,134 +1127,124 @@ int daa(CPU* cpu, uint8_t inst)
     cpu->z = (cpu->a == 0);
     cpu->half_carry = 0;
 
-    return 1;
+    return CYCLES(inst);
 }
 
 int cpl(CPU* cpu, uint8_t inst)
 {
+    materialize_flags(cpu);
+
     cpu->a = ~cpu->a;
 
     cpu->n = 1;
     cpu->half_carry = 1;
 
-    return 1;
+    return CYCLES(inst);
 }
 
 int scf(CPU* cpu, uint8_t inst)
 {
+    materialize_flags(cpu);
+
     cpu->n = 0;
     cpu->half_carry = 0;
     cpu->carry = 1;
 
-    return 1;
+    return CYCLES(inst);
 }
 
 int ccf(CPU* cpu, uint8_t inst)
 {
+    materialize_flags(cpu);
+
     cpu->n = 0;
     cpu->half_carry = 0;
     cpu->carry = !cpu->carry;
 
-    return 1;
+    return CYCLES(inst);
 }
 
 int ret(CPU* cpu, uint8_t inst)
 {
-    cpu->pc = cpu->mem->ram[cpu->sp++] | (cpu->mem->ram[cpu->sp++] << 8);
+    cpu->pc = pop_16(cpu);
 
-    return 4;
+    return CYCLES(inst);
 }
 
 int reti(CPU* cpu, uint8_t inst)
 {
-    cpu->pc = cpu->mem->ram[cpu->sp++] | (cpu->mem->ram[cpu->sp++] << 8);
+    cpu->pc = pop_16(cpu);
+    cpu->ime = true;
+    cpu->imeDelay = 0;
+    cpu->checkState = true;
 
-    return 4;
+    return CYCLES(inst);
 }
 
 int ret_8(CPU* cpu, uint8_t inst)
 {
-    bool flag = (inst >= 0xd0) ? cpu->carry : cpu->z;
-    if ((inst & 0xf) < 0x8) flag = !flag;
+    bool flag = check_condition(cpu, inst);
 
-    if (flag) cpu->pc = cpu->mem->ram[cpu->sp++] | (cpu->mem->ram[cpu->sp++] << 8);
+    if (flag) cpu->pc = pop_16(cpu);
 
-    return flag ? 5 : 2;
+    return BRANCH_CYCLES(inst, count_branch(cpu, inst, flag));
 }
 
+// BC, DE, HL or AF
 int pop(CPU* cpu, uint8_t inst)
 {
-    uint16_t* regMap[] = {
-        &cpu->bc,
-        &cpu->de,
-        &cpu->hl,
-        &cpu->af
-    };
-
-    uint16_t* reg = regMap[(inst >> 4) - 0xc];
+    int index = (inst >> 4) - 0xc;
+    uint16_t value = pop_16(cpu);
 
-    *reg = cpu->mem->ram[cpu->sp++] | (cpu->mem->ram[cpu->sp++] << 8);
+    if (index == 3) write_af(cpu, value);
+    else *get_reg_16(cpu, index) = value;
 
-    cpu->f &= 0xf0;
-
-    return 3;
+    return CYCLES(inst);
 }
 
 int push(CPU* cpu, uint8_t inst)
 {
-    uint16_t* regMap[] = {
-        &cpu->bc,
-        &cpu->de,
-        &cpu->hl,
-        &cpu->af
-    };
-
-    uint16_t* reg = regMap[(inst >> 4) - 0xc];
+    int index = (inst >> 4) - 0xc;
 
-    cpu->mem->ram[--cpu->sp] = *reg >> 8;
-    cpu->mem->ram[--cpu->sp] = *reg & 0xff;
+    push_16(cpu, index == 3 ? read_af(cpu) : *get_reg_16(cpu, index));
 
-    return 4;
+    return CYCLES(inst);
 }
 
 int call(CPU* cpu, uint8_t inst)
 {
-    uint16_t newPC = get_inst(cpu) | (get_inst(cpu) << 8);
+    uint16_t newPC = get_inst_16(cpu);
 
-    cpu->mem->ram[--cpu->sp] = cpu->pc >> 8;
-    cpu->mem->ram[--cpu->sp] = cpu->pc & 0xff;
+    push_16(cpu, cpu->pc);
 
     cpu->pc = newPC;
 
-    return 6;
+    return CYCLES(inst);
 }
 
 int call_16(CPU* cpu, uint8_t inst)
 {
-    bool flag = (inst >= 0xd0) ? cpu->carry : cpu->z;
-    if ((inst & 0xf) < 0x8) flag = !flag;
+    bool flag = check_condition(cpu, inst);
 
-    uint16_t newPC = get_inst(cpu) | (get_inst(cpu) << 8);
+    uint16_t newPC = get_inst_16(cpu);
 
     if (flag)
     {
-        cpu->mem->ram[--cpu->sp] = cpu->pc >> 8;
-        cpu->mem->ram[--cpu->sp] = cpu->pc & 0xff;
+        push_16(cpu, cpu->pc);
 
         cpu->pc = newPC;
     }
 
-    return flag ? 6 : 3;
+    return BRANCH_CYCLES(inst, count_branch(cpu, inst, flag));
 }
 
 int rst(CPU* cpu, uint8_t inst)
 {
-    cpu->mem->ram[--cpu->sp] = cpu->pc >> 8;
-    cpu->mem->ram[--cpu->sp] = cpu->pc & 0xff;
+    push_16(cpu, cpu->pc);
 
     cpu->pc = 8 * (2 * ((inst >> 4) - 0xc) + ((inst >> 3) & 1));
 
-    return 4;
+    return CYCLES(inst);
 }
 
 int cb(CPU* cpu, uint8_t inst);
@@ -809,219 +1252,305 @@ int cb(CPU* cpu, uint8_t inst);
 int rlc(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
-
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = *reg >> 7;
-
-    *reg <<= 1;
-    *reg |= cpu->carry;
 
-    cpu->z = *reg == 0;
+    write_reg_8(cpu, index, alu_rlc(cpu, read_reg_8(cpu, index)));
 
-    return index == 6 ? 4 : 2;
+    return CB_CYCLES(inst);
 }
 
 int rrc(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
-
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = *reg & 1;
-
-    *reg >>= 1;
-    *reg |= cpu->carry << 7;
 
-    cpu->z = *reg == 0;
+    write_reg_8(cpu, index, alu_rrc(cpu, read_reg_8(cpu, index)));
 
-    return index == 6 ? 4 : 2;
+    return CB_CYCLES(inst);
 }
 
 int rl(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
-    bool oldCarry = cpu->carry;
-
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = *reg >> 7;
 
-    *reg <<= 1;
-    *reg |= oldCarry;
+    write_reg_8(cpu, index, alu_rl(cpu, read_reg_8(cpu, index)));
 
-    cpu->z = *reg == 0;
-
-    return index == 6 ? 4 : 2;
+    return CB_CYCLES(inst);
 }
 
 int rr(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
-    bool oldCarry = cpu->carry;
-
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = *reg & 1;
-
-    *reg >>= 1;
-    *reg |= oldCarry << 7;
 
-    cpu->z = *reg == 0;
+    write_reg_8(cpu, index, alu_rr(cpu, read_reg_8(cpu, index)));
 
-    return index == 6 ? 4 : 2;
+    return CB_CYCLES(inst);
 }
 
 int sla(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
 
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = *reg >> 7;
-
-    *reg <<= 1;
-
-    cpu->z = *reg == 0;
+    write_reg_8(cpu, index, alu_sla(cpu, read_reg_8(cpu, index)));
 
-    return index == 6 ? 4 : 2;
+    return CB_CYCLES(inst);
 }
 
 int sra(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
-    bool oldBit7 = *reg >> 7;
-
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = *reg & 1;
-
-    *reg >>= 1;
-    *reg |= oldBit7 << 7;
 
-    cpu->z = *reg == 0;
+    write_reg_8(cpu, index, alu_sra(cpu, read_reg_8(cpu, index)));
 
-    return index == 6 ? 4 : 2;
+    return CB_CYCLES(inst);
 }
 
 int swap(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
 
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = 0;
-
-    uint8_t temp = 0xff & *reg;
-    *reg >>= 4;
-    *reg |= temp << 4;
+    write_reg_8(cpu, index, alu_swap(cpu, read_reg_8(cpu, index)));
 
-    cpu->z = *reg == 0;
-
-    return index == 6 ? 4 : 2;
+    return CB_CYCLES(inst);
 }
 
 int srl(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
-
-    cpu->n = 0;
-    cpu->half_carry = 0;
-    cpu->carry = *reg & 1;
 
-    *reg >>= 1;
+    write_reg_8(cpu, index, alu_srl(cpu, read_reg_8(cpu, index)));
 
-    cpu->z = *reg == 0;
-
-    return index == 6 ? 4 : 2;
+    return CB_CYCLES(inst);
 }
 
 int bit(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
 
     int bitIndex = (inst - 0x40) >> 3;
 
-    cpu->n = 0;
-    cpu->half_carry = 1;
-    cpu->z = !(*reg & (1 << bitIndex));
+    alu_bit(cpu, read_reg_8(cpu, index), bitIndex);
 
-    return index == 6 ? 3 : 2;
+    return CB_CYCLES(inst);
 }
 
 int res(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
 
     int bitIndex = (inst - 0x80) >> 3;
 
-    *reg &= ~(1 << bitIndex); 
+    write_reg_8(cpu, index, read_reg_8(cpu, index) & ~(1 << bitIndex));
 
-    return index == 6 ? 4 : 2;
+    return CB_CYCLES(inst);
 }
 
 int set(CPU* cpu, uint8_t inst)
 {
     int index = inst & 0b111;
-    uint8_t* reg = get_reg_8(cpu, index);
 
     int bitIndex = (inst - 0xc0) >> 3;
 
-    *reg |= 1 << bitIndex; 
+    write_reg_8(cpu, index, read_reg_8(cpu, index) | (1 << bitIndex));
+
+    return CB_CYCLES(inst);
+}
+
+#if SPECIALIZED_HANDLERS || BLOCK_CACHE
+
+// Operand accessors for the specialized and decoded handlers, named after the
+// operand tokens in opcodes.h. IMM8 and IMM16 are the instruction's immediate,
+// which each set of handlers gets its own way.
+#define RD_B(cpu) (cpu)->b
+#define RD_C(cpu) (cpu)->c
+#define RD_D(cpu) (cpu)->d
+#define RD_E(cpu) (cpu)->e
+#define RD_H(cpu) (cpu)->h
+#define RD_L(cpu) (cpu)->l
+#define RD_A(cpu) (cpu)->a
+#define RD_HLI(cpu) read_mem(cpu, (cpu)->hl)
+#define RD_HLIP(cpu) read_mem(cpu, (cpu)->hl++)
+#define RD_HLIM(cpu) read_mem(cpu, (cpu)->hl--)
+#define RD_BCI(cpu) read_mem(cpu, (cpu)->bc)
+#define RD_DEI(cpu) read_mem(cpu, (cpu)->de)
+#define RD_CI(cpu) read_io(cpu, (cpu)->c)
+#define RD_A8(cpu) read_io(cpu, IMM8(cpu))
+#define RD_A16(cpu) read_mem(cpu, IMM16(cpu))
+#define RD_D8(cpu) IMM8(cpu)
+#define RD_S8(cpu) (int8_t)IMM8(cpu)
+
+#define WR_B(cpu, v) (cpu)->b = (v)
+#define WR_C(cpu, v) (cpu)->c = (v)
+#define WR_D(cpu, v) (cpu)->d = (v)
+#define WR_E(cpu, v) (cpu)->e = (v)
+#define WR_H(cpu, v) (cpu)->h = (v)
+#define WR_L(cpu, v) (cpu)->l = (v)
+#define WR_A(cpu, v) (cpu)->a = (v)
+#define WR_HLI(cpu, v) write_mem(cpu, (cpu)->hl, v)
+#define WR_HLIP(cpu, v) write_mem(cpu, (cpu)->hl++, v)
+#define WR_HLIM(cpu, v) write_mem(cpu, (cpu)->hl--, v)
+#define WR_BCI(cpu, v) write_mem(cpu, (cpu)->bc, v)
+#define WR_DEI(cpu, v) write_mem(cpu, (cpu)->de, v)
+#define WR_CI(cpu, v) write_io(cpu, (cpu)->c, v)
+#define WR_A8(cpu, v) write_io(cpu, IMM8(cpu), v)
+#define WR_A16(cpu, v) write_mem(cpu, IMM16(cpu), v)
+
+#define R16_BC(cpu) (cpu)->bc
+#define R16_DE(cpu) (cpu)->de
+#define R16_HL(cpu) (cpu)->hl
+#define R16_SP(cpu) (cpu)->sp
+#define R16_AF(cpu) read_af(cpu)
+#define R16_D16(cpu) IMM16(cpu)
+
+#define W16_BC(cpu, v) (cpu)->bc = (v)
+#define W16_DE(cpu, v) (cpu)->de = (v)
+#define W16_HL(cpu, v) (cpu)->hl = (v)
+#define W16_AF(cpu, v) write_af(cpu, v)
+
+#if FLAT_REGS
+#define CC_NZ(cpu) !(cpu)->z
+#define CC_Z(cpu) (cpu)->z
+#define CC_NC(cpu) !(cpu)->carry
+#define CC_C(cpu) (cpu)->carry
+#else
+#define CC_NZ(cpu) !(current_flags(cpu) & 0x80)
+#define CC_Z(cpu) (current_flags(cpu) & 0x80)
+#define CC_NC(cpu) !(current_flags(cpu) & 0x10)
+#define CC_C(cpu) (current_flags(cpu) & 0x10)
+#endif
+#define CC_ALWAYS(cpu) true
+
+// One EXEC_<kind> per operation kind in opcodes.h. They run inside a handler
+// with cpu, inst and branch in scope.
+#define EXEC_NOP(handler, dst, src)
+#define EXEC_GENERIC(handler, dst, src) return handler(cpu, inst)
+#define EXEC_STOP EXEC_GENERIC
+#define EXEC_HALT EXEC_GENERIC
+#define EXEC_DI EXEC_GENERIC
+#define EXEC_EI EXEC_GENERIC
+#define EXEC_RETI EXEC_GENERIC
+#define EXEC_JP_HL EXEC_GENERIC
+#define EXEC_LD(handler, dst, src) { uint8_t value = RD_##src(cpu); WR_##dst(cpu, value); }
+#define EXEC_LD16(handler, dst, src) R16_##dst(cpu) = R16_##src(cpu)
+#define EXEC_INC16(handler, dst, src) R16_##dst(cpu)++
+#define EXEC_DEC16(handler, dst, src) R16_##dst(cpu)--
+#define EXEC_INC(handler, dst, src) WR_##dst(cpu, alu_inc(cpu, RD_##dst(cpu)))
+#define EXEC_DEC(handler, dst, src) WR_##dst(cpu, alu_dec(cpu, RD_##dst(cpu)))
+#define EXEC_ADD_HL(handler, dst, src) alu_add_hl(cpu, R16_##src(cpu))
+#define EXEC_ADD(handler, dst, src) alu_add(cpu, RD_##src(cpu), 0)
+#define EXEC_ADC(handler, dst, src) alu_add(cpu, RD_##src(cpu), read_carry(cpu))
+#define EXEC_SUB(handler, dst, src) alu_sub(cpu, RD_##src(cpu), 0, true)
+#define EXEC_SBC(handler, dst, src) alu_sub(cpu, RD_##src(cpu), read_carry(cpu), true)
+#define EXEC_CP(handler, dst, src) alu_sub(cpu, RD_##src(cpu), 0, false)
+#define EXEC_AND(handler, dst, src) alu_and(cpu, RD_##src(cpu))
+#define EXEC_XOR(handler, dst, src) alu_xor(cpu, RD_##src(cpu))
+#define EXEC_OR(handler, dst, src) alu_or(cpu, RD_##src(cpu))
+#define EXEC_JR(handler, cc, src) { int8_t dist = RD_S8(cpu); branch = CC_##cc(cpu); if (branch) cpu->pc += dist; }
+#define EXEC_JP(handler, cc, src) { uint16_t addr = IMM16(cpu); branch = CC_##cc(cpu); if (branch) cpu->pc = addr; }
+#define EXEC_CALL(handler, cc, src) { uint16_t addr = IMM16(cpu); branch = CC_##cc(cpu); if (branch) { push_16(cpu, cpu->pc); cpu->pc = addr; } }
+#define EXEC_RET(handler, cc, src) branch = CC_##cc(cpu); if (branch) cpu->pc = pop_16(cpu)
+#define EXEC_PUSH(handler, dst, src) push_16(cpu, R16_##src(cpu))
+#define EXEC_POP(handler, dst, src) W16_##dst(cpu, pop_16(cpu))
+#define EXEC_RST(handler, vec, src) push_16(cpu, cpu->pc); cpu->pc = vec
+#define EXEC_RLC(handler, dst, src) WR_##dst(cpu, alu_rlc(cpu, RD_##dst(cpu)))
+#define EXEC_RRC(handler, dst, src) WR_##dst(cpu, alu_rrc(cpu, RD_##dst(cpu)))
+#define EXEC_RL(handler, dst, src) WR_##dst(cpu, alu_rl(cpu, RD_##dst(cpu)))
+#define EXEC_RR(handler, dst, src) WR_##dst(cpu, alu_rr(cpu, RD_##dst(cpu)))
+#define EXEC_SLA(handler, dst, src) WR_##dst(cpu, alu_sla(cpu, RD_##dst(cpu)))
+#define EXEC_SRA(handler, dst, src) WR_##dst(cpu, alu_sra(cpu, RD_##dst(cpu)))
+#define EXEC_SWAP(handler, dst, src) WR_##dst(cpu, alu_swap(cpu, RD_##dst(cpu)))
+#define EXEC_SRL(handler, dst, src) WR_##dst(cpu, alu_srl(cpu, RD_##dst(cpu)))
+#define EXEC_BIT(handler, bitIndex, src) alu_bit(cpu, RD_##src(cpu), bitIndex)
+#define EXEC_RES(handler, bitIndex, src) WR_##src(cpu, RD_##src(cpu) & ~(1 << bitIndex))
+#define EXEC_SET(handler, bitIndex, src) WR_##src(cpu, RD_##src(cpu) | (1 << bitIndex))
+
+// Only conditional branches have different taken and not-taken cycles, so the
+// count_branch call folds away for everything else
+#define SPEC_BODY(kind, handler, dst, src, cycles, taken) \
+    { \
+        bool branch = false; \
+        EXEC_##kind(handler, dst, src); \
+        if (taken != cycles) branch = count_branch(cpu, inst, branch); \
+        return branch ? taken : cycles; \
+    }
+
+#endif
 
-    return index == 6 ? 4 : 2;
-}
+#if SPECIALIZED_HANDLERS
+
+#define IMM8(cpu) get_inst(cpu)
+#define IMM16(cpu) get_inst_16(cpu)
+
+#define SPEC_HANDLER(op, handler, mnemonic, kind, dst, src, length, cycles, taken, flags, access, takenAccess) \
+    static int spec_##op(CPU* cpu, uint8_t inst) SPEC_BODY(kind, handler, dst, src, cycles, taken)
+#define SPEC_CB_HANDLER(op, handler, mnemonic, kind, dst, src, length, cycles, taken, flags, access, takenAccess) \
+    static int spec_cb_##op(CPU* cpu, uint8_t inst) SPEC_BODY(kind, handler, dst, src, cycles, taken)
+#define SPEC_PREFIX(op, ...)
+
+OPCODE_TABLE(SPEC_HANDLER, SPEC_PREFIX)
+CB_OPCODE_TABLE(SPEC_CB_HANDLER)
+
+#undef IMM8
+#undef IMM16
+
+#define HANDLER(op, handler) spec_##op
+#define CB_HANDLER(op, handler) spec_cb_##op
+
+#else
+
+#define HANDLER(op, handler) handler
+#define CB_HANDLER(op, handler) handler
+
+#endif
+
+#define MAP_ENTRY(op, handler, ...) [op] = HANDLER(op, handler),
+#define CB_MAP_ENTRY(op, handler, ...) [op] = CB_HANDLER(op, handler),
+#define PREFIX_MAP_ENTRY(op, handler, ...) [op] = handler,
 
 int (*instruction_map[0x100])(CPU* cpu, uint8_t inst) = {
-    //  x0      x1      x2      x3          x4          x5          x6          x7      x8              x9          xa          xb      xc          xd      xe          xf
-        noop,   ld_16,  ld_a16, inc_16,     inc_8,      dec_8,      ld_8_d8,    rlca,   ld_a16_sp,      add_hl,     ld_a_a16,   dec_16, inc_8,      dec_8,  ld_8_d8,    rrca,   // 0x
-        stop,   ld_16,  ld_a16, inc_16,     inc_8,      dec_8,      ld_8_d8,    rla,    jr,             add_hl,     ld_a_a16,   dec_16, inc_8,      dec_8,  ld_8_d8,    rra,    // 1x
-        jr_8,   ld_16,  ld_a16, inc_16,     inc_8,      dec_8,      ld_8_d8,    daa,    jr_8,           add_hl,     ld_a_a16,   dec_16, inc_8,      dec_8,  ld_8_d8,    cpl,    // 2x
-        jr_8,   ld_16,  ld_a16, inc_16,     inc_8,      dec_8,      ld_8_d8,    scf,    jr_8,           add_hl,     ld_a_a16,   dec_16, inc_8,      dec_8,  ld_8_d8,    ccf,    // 3x
-        ld_8,   ld_8,   ld_8,   ld_8,       ld_8,       ld_8,       ld_8,       ld_8,   ld_8,           ld_8,       ld_8,       ld_8,   ld_8,       ld_8,   ld_8,       ld_8,   // 4x
-        ld_8,   ld_8,   ld_8,   ld_8,       ld_8,       ld_8,       ld_8,       ld_8,   ld_8,           ld_8,       ld_8,       ld_8,   ld_8,       ld_8,   ld_8,       ld_8,   // 5x
-        ld_8,   ld_8,   ld_8,   ld_8,       ld_8,       ld_8,       ld_8,       ld_8,   ld_8,           ld_8,       ld_8,       ld_8,   ld_8,       ld_8,   ld_8,       ld_8,   // 6x
-        ld_8,   ld_8,   ld_8,   ld_8,       ld_8,       ld_8,       halt,       ld_8,   ld_8,           ld_8,       ld_8,       ld_8,   ld_8,       ld_8,   ld_8,       ld_8,   // 7x
-        add_8,  add_8,  add_8,  add_8,      add_8,      add_8,      add_8,      add_8,  adc_8,          adc_8,      adc_8,      adc_8,  adc_8,      adc_8,  adc_8,      adc_8,  // 8x
-        sub_8,  sub_8,  sub_8,  sub_8,      sub_8,      sub_8,      sub_8,      sub_8,  sbc_8,          sbc_8,      sbc_8,      sbc_8,  sbc_8,      sbc_8,  sbc_8,      sbc_8,  // 9x
-        and_8,  and_8,  and_8,  and_8,      and_8,      and_8,      and_8,      and_8,  xor_8,          xor_8,      xor_8,      xor_8,  xor_8,      xor_8,  xor_8,      xor_8,  // ax
-        or_8,   or_8,   or_8,   or_8,       or_8,       or_8,       or_8,       or_8,   cp_8,           cp_8,       cp_8,       cp_8,   cp_8,       cp_8,   cp_8,       cp_8,   // bx
-        ret_8,  pop,    jp_16,  jp,         call_16,    push,       add_d8,     rst,    ret_8,          ret,        jp_16,      cb,     call_16,    call,   adc_d8,     rst,    // cx
-        ret_8,  pop,    jp_16,  noop,       call_16,    push,       sub_d8,     rst,    ret_8,          reti,       jp_16,      noop,   call_16,    noop,   sbc_d8,     rst,    // dx
-        ld_a_8, pop,    ld_a_c, noop,       noop,       push,       and_d8,     rst,    add_s8,         jp_hl,      ld_a_16,    noop,   noop,       noop,   xor_d8,     rst,    // ex
-        ld_a_8, pop,    ld_a_c, di,         noop,       push,       or_d8,      rst,    ld_hl_sp_s8,    ld_sp_hl,   ld_a_16,    ei,     noop,       noop,   cp_d8,      rst     // fx
+    OPCODE_TABLE(MAP_ENTRY, PREFIX_MAP_ENTRY)
 };
 
 int (*cb_instruction_map[0x100])(CPU* cpu, uint8_t inst) = {
-    //  x0      x1      x2      x3      x4      x5      x6      x7      x8      x9      xa      xb      xc      xd      xe      xf
-        rlc,    rlc,    rlc,    rlc,    rlc,    rlc,    rlc,    rlc,    rrc,    rrc,    rrc,    rrc,    rrc,    rrc,    rrc,    rrc,    // 0x
-        rl,     rl,     rl,     rl,     rl,     rl,     rl,     rl,     rr,     rr,     rr,     rr,     rr,     rr,     rr,     rr,     // 1x
-        sla,    sla,    sla,    sla,    sla,    sla,    sla,    sla,    sra,    sra,    sra,    sra,    sra,    sra,    sra,    sra,    // 2x
-        swap,   swap,   swap,   swap,   swap,   swap,   swap,   swap,   srl,    srl,    srl,    srl,    srl,    srl,    srl,    srl,    // 3x
-        bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    // 4x
-        bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    // 5x
-        bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    // 6x
-        bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    bit,    // 7x
-        res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    // 8x
-        res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    // 9x
-        res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    // ax
-        res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    res,    // bx
-        set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    // cx
-        set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    // dx
-        set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    // ex
-        set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set,    set     // fx
+    CB_OPCODE_TABLE(CB_MAP_ENTRY)
+};
+
+#if BLOCK_CACHE
+
+// The same bodies again for the block cache, one per opcode whatever
+// SPECIALIZED_HANDLERS is, taking the immediate it decoded along with the
+// opcode. PC is already past the whole instruction when they are called.
+#define IMM8(cpu) (uint8_t)imm
+#define IMM16(cpu) imm
+
+// Generic handlers (STOP's padding byte, LD (a16),SP, ADD SP,s8 and
+// LD HL,SP+s8) still fetch their own operands, so rewind PC for them
+#undef EXEC_GENERIC
+#define EXEC_GENERIC(handler, dst, src) { cpu->pc -= operandBytes; return handler(cpu, inst); }
+
+#define DECODED_HANDLER(op, handler, mnemonic, kind, dst, src, length, cycles, taken, flags, access, takenAccess) \
+    static int decoded_##op(CPU* cpu, uint16_t imm) { uint8_t inst = op; const uint16_t operandBytes = length - 1; (void)inst; (void)imm; (void)operandBytes; SPEC_BODY(kind, handler, dst, src, cycles, taken) }
+#define DECODED_CB_HANDLER(op, handler, mnemonic, kind, dst, src, length, cycles, taken, flags, access, takenAccess) \
+    static int decoded_cb_##op(CPU* cpu, uint16_t imm) { uint8_t inst = op; (void)inst; (void)imm; SPEC_BODY(kind, handler, dst, src, cycles, taken) }
+#define DECODED_PREFIX(op, ...)
+
+OPCODE_TABLE(DECODED_HANDLER, DECODED_PREFIX)
+CB_OPCODE_TABLE(DECODED_CB_HANDLER)
+
+#define DECODED_MAP_ENTRY(op, ...) [op] = decoded_##op,
+#define DECODED_CB_MAP_ENTRY(op, ...) [op] = decoded_cb_##op,
+
+int (*decoded_instruction_map[0x100])(CPU* cpu, uint16_t imm) = {
+    OPCODE_TABLE(DECODED_MAP_ENTRY, DECODED_PREFIX)
+};
+
+int (*decoded_cb_instruction_map[0x100])(CPU* cpu, uint16_t imm) = {
+    CB_OPCODE_TABLE(DECODED_CB_MAP_ENTRY)
 };
 
+#undef IMM8
+#undef IMM16
+
+#endif
+
 int cb(CPU* cpu, uint8_t inst)
 {
     uint8_t cbInst = get_inst(cpu);
@@ -1030,10 +1559,430 @@ int cb(CPU* cpu, uint8_t inst)
     return cycles;
 }
 
+#if FUSION
+
+// Superinstructions for the idioms block-cache.c fuses at decode time. Each
+// one leaves exactly the state the original instructions would and returns
+// their M-cycles, or 0 to have the original instructions run instead. Loops
+// run at most FUSION_MAX_CYCLES worth of iterations per call and leave PC on
+// the loop head if they are not done, so run_until can't overshoot by much.
+
+static inline uint32_t fused_iterations(uint32_t remaining, int cyclesPerIteration)
+{
+    uint32_t limit = FUSION_MAX_CYCLES / cyclesPerIteration;
+    if (limit == 0) limit = 1;
+
+    return remaining < limit ? remaining : limit;
+}
+
+// LD A,(HL+) / LD (DE),A / INC DE / DEC BC / LD A,B / OR C / JR NZ,loopPc
+int fused_copy_loop(CPU* cpu, uint16_t loopPc)
+{
+    uint32_t remaining = cpu->bc ? cpu->bc : 0x10000;
+    uint32_t count = fused_iterations(remaining, 13);
+    uint32_t src = cpu->hl;
+    uint32_t dst = cpu->de;
+
+    // Only plain memory: nothing in I/O space, no wrap-around, both ranges
+    // mapped directly by the bus, no overlap the byte-by-byte copy would smear
+    // forward, and no cached code overwritten
+    if (src + count > 0xff00 || dst + count > 0xff00) return 0;
+
+    uint8_t* from = bus_span(cpu->mem->readPages, src, count);
+    uint8_t* to = bus_span(cpu->mem->writePages, dst, count);
+    if (!from || !to) return 0;
+    if (to > from && to < from + count) return 0;
+
+#if BLOCK_CACHE
+    if (cpu->blockCache)
+    {
+        for (uint32_t addr = dst; addr < dst + count; addr++)
+        {
+            if (cpu->blockCache->codeCount[addr]) return 0;
+        }
+    }
+#endif
+
+    memmove(to, from, count);
+
+    cpu->hl += count;
+    cpu->de += count;
+    cpu->bc -= count;
+    cpu->a = cpu->b;
+    alu_or(cpu, cpu->c);
+
+    bool done = count == remaining;
+    cpu->pc = done ? loopPc + 8 : loopPc;
+
+    return 13 * count - done;
+}
+
+// DEC r / JR NZ,loopPc
+int fused_dec_loop(CPU* cpu, int regIndex, uint16_t loopPc)
+{
+    uint8_t value = read_reg_8(cpu, regIndex);
+    uint32_t remaining = value ? value : 0x100;
+    uint32_t count = fused_iterations(remaining, 4);
+
+    // All but the last decrement only matter for the register value
+    write_reg_8(cpu, regIndex, alu_dec(cpu, value - (count - 1)));
+
+    bool done = count == remaining;
+    cpu->pc = done ? loopPc + 3 : loopPc;
+
+    return 4 * count - done;
+}
+
+// LDH A,(port) / CP value / JR cc,offset, with nextPc after the JR
+int fused_ldh_cp_jr(CPU* cpu, uint8_t port, uint8_t value, uint8_t jrInst, int8_t offset, uint16_t nextPc)
+{
+    cpu->a = read_io(cpu, port);
+    alu_sub(cpu, value, false, false);
+
+    uint8_t flags = current_flags(cpu);
+    bool branch = (jrInst & 0x10) ? (flags & 0x10) : (flags & 0x80);
+    if (!(jrInst & 0x08)) branch = !branch;
+
+    cpu->pc = nextPc + (branch ? offset : 0);
+
+    return branch ? 8 : 7;
+}
+
+#endif
+
+static inline bool is_breakpoint(const uint8_t* breakpoints, uint16_t addr)
+{
+    return breakpoints[addr >> 3] & (1 << (addr & 7));
+}
+
+uint64_t access_cycle(CPU* cpu, bool write)
+{
+    uint64_t start = cpu->cycles + cpu->blockCycles;
+
+    // CB ops on (HL) read in their second M-cycle and write in their third
+    if (cpu->inst == 0xcb) return start + (write ? 2 : 1);
+
+    const OpcodeInfo* info = &opcode_info[cpu->inst];
+    if (!write) return start + info->length - 1;
+
+    const char* at = strchr(info->access, 'w');
+    return start + (at ? at - info->access : 0);
+}
+
+// Handles whatever set checkState, in the order the hardware does: EI's delay,
+// waking from HALT/STOP, the HALT bug and dispatching the highest priority
+// pending interrupt. Returns the M-cycles used, or 0 if the next instruction
+// should just run. A halted CPU with nothing pending sleeps until limit, since
+// nothing but an event at limit can request an interrupt before then.
+static uint64_t update_cpu_state(CPU* cpu, uint64_t cycles, uint64_t limit)
+{
+    // Its own accesses fall between instructions
+    cpu->inst = 0x00;
+
+    uint8_t pending = pending_interrupts(cpu);
+    cpu->checkState = false;
+
+    if (cpu->imeDelay && --cpu->imeDelay == 0) cpu->ime = true;
+    if (cpu->imeDelay) cpu->checkState = true;
+
+    if (cpu->halted || cpu->stopped)
+    {
+        bool wake = cpu->stopped ? (pending & (1 << INT_JOYPAD)) : pending;
+
+        if (!wake)
+        {
+            cpu->checkState = true;
+            return limit > cycles ? limit - cycles : 1;
+        }
+
+        cpu->halted = false;
+        cpu->stopped = false;
+    }
+
+    if (cpu->haltBug)
+    {
+        cpu->haltBug = false;
+
+        // EI / HALT: the interrupt returns to the HALT, which then halts
+        if (cpu->ime && pending)
+        {
+            cpu->pc--;
+        }
+        else
+        {
+            uint8_t inst = bus_read8(cpu->mem, cpu->pc);
+            cpu->inst = inst;
+            cpu->checkState = true;
+            return instruction_map[inst](cpu, inst);
+        }
+    }
+
+    if (!cpu->ime || !pending) return 0;
+
+    int bit = __builtin_ctz(pending);
+    cpu->ime = false;
+    bus_write8(cpu->mem, REG_IF, bus_read8(cpu->mem, REG_IF) & ~(1 << bit));
+    push_16(cpu, cpu->pc);
+    cpu->pc = 0x40 + 8 * bit;
+
+    return 5;
+}
+
+void request_interrupt(CPU* cpu, Interrupt interrupt)
+{
+    bus_write8(cpu->mem, REG_IF, bus_read8(cpu->mem, REG_IF) | (1 << interrupt));
+    cpu->checkState = true;
+}
+
+// One instruction, or whatever the CPU state calls for instead, for run_blocks
+uint64_t step_until(CPU* cpu, uint64_t limit)
+{
+    uint64_t cycles = cpu->checkState ? update_cpu_state(cpu, cpu->cycles, limit) : 0;
+
+    if (!cycles)
+    {
+        uint8_t inst = get_inst(cpu);
+        cpu->inst = inst;
+        cycles = instruction_map[inst](cpu, inst);
+    }
+
+    cpu->cycles += cycles;
+    return cycles;
+}
+
+#if THREADED_DISPATCH
+
+#define LABEL_ENTRY(op, ...) [op] = &&op_##op,
+#define CB_LABEL_ENTRY(op, ...) [op] = &&cb_##op,
+#define LABEL_BODY(op, handler, ...) op_##op: cycles = HANDLER(op, handler)(cpu, op); goto done;
+#define CB_LABEL_BODY(op, handler, ...) cb_##op: cycles = CB_HANDLER(op, handler)(cpu, op); goto done;
+#define LOOP_BODY(op, handler, ...) op_##op: instCycles = HANDLER(op, handler)(cpu, op); goto next;
+#define CB_LOOP_BODY(op, handler, ...) cb_##op: instCycles = CB_HANDLER(op, handler)(cpu, op); goto next;
+#define PREFIX_BODY(op, ...) op_##op: goto *cbLabels[get_inst(cpu)];
+
+// Runs instructions until the cycle counter reaches limit or PC lands on a
+// breakpoint. Direct-threaded: every handler is called with a constant opcode
+// from its own label so the compiler can inline it and fold away the operand
+// decode, and each label jumps straight to the next instruction's.
+static RunResult run_loop(CPU* cpu, uint64_t limit)
+{
+    static void* const labels[0x100] = { OPCODE_TABLE(LABEL_ENTRY, LABEL_ENTRY) };
+    static void* const cbLabels[0x100] = { CB_OPCODE_TABLE(CB_LABEL_ENTRY) };
+
+    uint64_t cycles = cpu->cycles;
+    const uint8_t* breakpoints = cpu->breakpoints;
+    RunResult result = RUN_BUDGET;
+    int instCycles;
+    uint8_t inst;
+
+    if (cycles >= limit) goto done;
+    goto dispatch;
+
+    OPCODE_TABLE(LOOP_BODY, PREFIX_BODY)
+    CB_OPCODE_TABLE(CB_LOOP_BODY)
+
+next:
+    cycles += instCycles;
+
+    if (breakpoints && is_breakpoint(breakpoints, cpu->pc))
+    {
+        result = RUN_BREAKPOINT;
+        goto done;
+    }
+    if (cycles >= limit) goto done;
+
+dispatch:
+    // Kept current for register handlers whose peripheral catches up to it
+    cpu->cycles = cycles;
+
+    if (cpu->checkState)
+    {
+        limit = event_limit(cpu, limit);
+
+        uint64_t stateCycles = update_cpu_state(cpu, cycles, limit);
+        if (stateCycles)
+        {
+            cycles += stateCycles;
+            instCycles = 0;
+            goto next;
+        }
+    }
+    inst = get_inst(cpu);
+    cpu->inst = inst;
+    goto *labels[inst];
+
+done:
+    cpu->cycles = cycles;
+    return result;
+}
+
+// Single step with its own copy of the labels, so stepping does not pay for
+// the loop and breakpoint checks
 int execute_inst(CPU* cpu)
 {
-    uint8_t inst = get_inst(cpu);
-    int cycles = instruction_map[inst](cpu, inst);
+    static void* const labels[0x100] = { OPCODE_TABLE(LABEL_ENTRY, LABEL_ENTRY) };
+    static void* const cbLabels[0x100] = { CB_OPCODE_TABLE(CB_LABEL_ENTRY) };
 
+    int cycles;
+    uint8_t inst;
+
+    if (cpu->checkState)
+    {
+        cycles = update_cpu_state(cpu, cpu->cycles, cpu->cycles + 1);
+        if (cycles) goto done;
+    }
+    inst = get_inst(cpu);
+    cpu->inst = inst;
+    goto *labels[inst];
+
+    OPCODE_TABLE(LABEL_BODY, PREFIX_BODY)
+    CB_OPCODE_TABLE(CB_LABEL_BODY)
+
+done:
+    cpu->cycles += cycles;
     return cycles;
-}
\ No newline at end of file
+}
+
+#else
+
+// Runs instructions until the cycle counter reaches limit or PC lands on a
+// breakpoint
+static RunResult run_loop(CPU* cpu, uint64_t limit)
+{
+    uint64_t cycles = cpu->cycles;
+    const uint8_t* breakpoints = cpu->breakpoints;
+    RunResult result = RUN_BUDGET;
+
+    while (cycles < limit)
+    {
+        uint64_t stateCycles = 0;
+
+        // Kept current for register handlers whose peripheral catches up to it
+        cpu->cycles = cycles;
+
+        if (cpu->checkState)
+        {
+            limit = event_limit(cpu, limit);
+            stateCycles = update_cpu_state(cpu, cycles, limit);
+        }
+
+        if (stateCycles)
+        {
+            cycles += stateCycles;
+        }
+        else
+        {
+            uint8_t inst = get_inst(cpu);
+            cpu->inst = inst;
+            cycles += instruction_map[inst](cpu, inst);
+        }
+
+        if (breakpoints && is_breakpoint(breakpoints, cpu->pc))
+        {
+            result = RUN_BREAKPOINT;
+            break;
+        }
+    }
+
+    cpu->cycles = cycles;
+    return result;
+}
+
+int execute_inst(CPU* cpu)
+{
+    return step_until(cpu, cpu->cycles + 1);
+}
+
+#endif
+
+// Runs until the cycle counter reaches limit or a breakpoint is hit, on
+// whatever is attached
+static RunResult run_span(CPU* cpu, uint64_t limit)
+{
+#if BLOCK_CACHE
+    // Blocks are not split at breakpoints, so those need the interpreter
+    if (cpu->blockCache && !cpu->breakpoints)
+    {
+        run_blocks(cpu, limit);
+        return RUN_BUDGET;
+    }
+#endif
+
+#if AOT
+    // Same for translated blocks
+    if (cpu->aot && !cpu->breakpoints)
+    {
+        run_aot(cpu, limit);
+        return RUN_BUDGET;
+    }
+#endif
+
+    return run_loop(cpu, limit);
+}
+
+// Runs until the cycle counter reaches targetCycle, cpu->nextEvent comes due
+// or a breakpoint is hit. With a scheduler on the memory, due events are run
+// here and only targetCycle or a breakpoint ends the call. The instruction at
+// PC always runs, so calling it again after RUN_BREAKPOINT steps past the
+// breakpoint. May overshoot by the length of the last instruction (or block).
+RunResult run_until(CPU* cpu, uint64_t targetCycle)
+{
+    Scheduler* scheduler = cpu->mem->scheduler;
+
+    for (;;)
+    {
+        RunResult result = run_span(cpu, event_limit(cpu, targetCycle));
+        if (result == RUN_BREAKPOINT) return result;
+
+        // Short of targetCycle, for an event that has since been put back
+        if (cpu->cycles < cpu->nextEvent)
+        {
+            if (cpu->cycles >= targetCycle) return result;
+            continue;
+        }
+
+        if (!scheduler) return cpu->nextEvent <= targetCycle ? RUN_EVENT : RUN_BUDGET;
+
+        run_events(scheduler, cpu->cycles);
+        if (cpu->cycles >= targetCycle) return RUN_BUDGET;
+    }
+}
+
+RunResult run_cycles(CPU* cpu, uint64_t budget)
+{
+    return run_until(cpu, cpu->cycles + budget);
+}
+
+void set_breakpoint(CPU* cpu, uint16_t addr)
+{
+    if (!cpu->breakpoints) cpu->breakpoints = calloc(0x10000 / 8, 1);
+
+    cpu->breakpoints[addr >> 3] |= 1 << (addr & 7);
+}
+
+void clear_breakpoint(CPU* cpu, uint16_t addr)
+{
+    if (cpu->breakpoints) cpu->breakpoints[addr >> 3] &= ~(1 << (addr & 7));
+}
+
+#if BRANCH_PROFILE
+
+// Taken and not-taken counts and cycles for every conditional branch opcode
+// that ran
+void print_branch_profile(CPU* cpu)
+{
+    for (int inst = 0; inst < 0x100; inst++)
+    {
+        const OpcodeInfo* info = &opcode_info[inst];
+        uint64_t taken = cpu->branchCounts[inst][1];
+        uint64_t notTaken = cpu->branchCounts[inst][0];
+
+        if (!taken && !notTaken) continue;
+
+        printf("%-12s %10llu taken (%5.1f%%, %llu cycles) %10llu not taken (%llu cycles)\n", info->mnemonic,
+            (unsigned long long)taken, 100.0 * taken / (taken + notTaken), (unsigned long long)(taken * info->takenCycles),
+            (unsigned long long)notTaken, (unsigned long long)(notTaken * info->cycles));
+    }
+}
+
+#endif
@@ -5,10 +5,119 @@
 #include <stdlib.h>
 
 #include "memory.h"
+#include "io.h"
 
+// Build with -DTHREADED_DISPATCH=1 to replace the instruction_map function
+// pointer table with a computed-goto interpreter (requires GCC or Clang).
+#ifndef THREADED_DISPATCH
+#define THREADED_DISPATCH 0
+#endif
+
+// Build with -DSPECIALIZED_HANDLERS=1 to dispatch to per-opcode handlers
+// generated from opcodes.h instead of the generic handlers that decode their
+// operands at runtime.
+#ifndef SPECIALIZED_HANDLERS
+#define SPECIALIZED_HANDLERS 0
+#endif
+
+// Build with -DLAZY_FLAGS=1 to record the last flag-setting ALU operation and
+// only compute F when something reads it (see read_flags).
+#ifndef LAZY_FLAGS
+#define LAZY_FLAGS 0
+#endif
+
+// Build with -DALU_TABLES=1 to take 8-bit ADD/ADC/SUB/SBC/CP and INC/DEC
+// results and flags from precomputed tables instead of computing them.
+#ifndef ALU_TABLES
+#define ALU_TABLES 0
+#endif
+
+// Build with -DBLOCK_CACHE=1 to enable execute_block and the decoded basic
+// block cache in block-cache.h. Memory writes then check for cached code.
+#ifndef BLOCK_CACHE
+#define BLOCK_CACHE 0
+#endif
+
+// Build with -DFUSION=1 (and BLOCK_CACHE) to run common multi-instruction
+// idioms found at block decode time as single superinstructions.
+#ifndef FUSION
+#define FUSION 0
+#endif
+
+// Build with -DIDLE_SKIP=1 (and BLOCK_CACHE) to have run_until fast-forward
+// over loops that spin without changing anything.
+#ifndef IDLE_SKIP
+#define IDLE_SKIP 0
+#endif
+
+// Build with -DJIT=1 (and BLOCK_CACHE) to translate hot blocks to x86-64
+// code, see jit.c.
+#ifndef JIT
+#define JIT 0
+#endif
+
+// Build with -DFLAT_REGS=1 to keep Z, N, H and C in bytes of their own next to
+// A instead of as bitfields of F. F is then only assembled for PUSH AF and
+// read_flags.
+#ifndef FLAT_REGS
+#define FLAT_REGS 0
+#endif
+
+// Build with -DBRANCH_PROFILE=1 to count taken and not-taken conditional
+// branches per opcode for print_branch_profile. Branches inside JIT-compiled
+// or AOT-translated blocks and fused idioms are not counted.
+#ifndef BRANCH_PROFILE
+#define BRANCH_PROFILE 0
+#endif
+
+// Build with -DAOT=1, and a file generated by recompiler/recompile.c, to run
+// ROM code through its ahead-of-time C translation, see aot.h.
+#ifndef AOT
+#define AOT 0
+#endif
+
+#if LAZY_FLAGS && ALU_TABLES
+#error "LAZY_FLAGS and ALU_TABLES are alternative flag strategies"
+#endif
+
+#if FUSION && !BLOCK_CACHE
+#error "FUSION requires BLOCK_CACHE"
+#endif
+
+#if IDLE_SKIP && !BLOCK_CACHE
+#error "IDLE_SKIP requires BLOCK_CACHE"
+#endif
+
+#if JIT && (!BLOCK_CACHE || LAZY_FLAGS || !defined(__x86_64__))
+#error "JIT requires BLOCK_CACHE, eager flags and an x86-64 host"
+#endif
+
+#if FLAT_REGS && (LAZY_FLAGS || ALU_TABLES || JIT)
+#error "FLAT_REGS has no F register for LAZY_FLAGS, ALU_TABLES or JIT to work on"
+#endif
+
+#if AOT && (BLOCK_CACHE || LAZY_FLAGS)
+#error "AOT requires eager flags and replaces BLOCK_CACHE"
+#endif
+
+#if THREADED_DISPATCH && !defined(__GNUC__)
+#error "THREADED_DISPATCH requires the labels-as-values extension"
+#endif
+
+// Everything an instruction touches comes before breakpoints, in the first
+// 64-byte line of the struct; see emulator.h for where the struct lives
 typedef struct CPU
 {
     // Registers
+#if FLAT_REGS
+    // Every flag write is a plain byte store instead of a read-modify-write
+    // of F
+    uint8_t a;
+    bool z;
+    bool n;
+    bool half_carry;
+    bool carry;
+#else
     union
     {
         uint16_t af;
@@ -29,6 +138,7 @@ typedef struct CPU
             uint8_t a;
         };
     };
+#endif
     union
     {
         uint16_t bc;
@@ -58,9 +168,136 @@ typedef struct CPU
     };
     uint16_t sp;
     uint16_t pc;
+
+    // Opcode of the instruction in progress, 0xcb for the whole CB page. With
+    // its access pattern it tells register handlers which M-cycle of the
+    // instruction their access falls on.
+    uint8_t inst;
+
+#if LAZY_FLAGS
+    // Last flag-setting operation (FlagOp) and its operands; f is only
+    // authoritative while flagOp is FLAGS_NONE
+    uint8_t flagOp;
+    bool flagCarryIn;
+    uint16_t flagLhs;
+    uint16_t flagRhs;
+    uint32_t flagResult;
+#endif
+
     Memory* mem;
+
+    // M-cycles executed so far, and the cycle at which run_until has to hand
+    // control back for something outside the CPU (UINT64_MAX for nothing).
+    // With a scheduler on the memory, nextEvent is its soonest event.
+    uint64_t cycles;
+    uint64_t nextEvent;
+
+    // Interrupt master enable and low-power state. checkState makes the run
+    // loops call update_cpu_state before the next instruction; it is set
+    // whenever one of these or IE/IF may have changed.
+    bool ime;
+    uint8_t imeDelay;       // EI: instructions until IME turns on
+    bool halted;
+    bool stopped;
+    bool haltBug;           // the next opcode is fetched without advancing PC
+    bool checkState;
+
+    // M-cycles the running block has used before the instruction in
+    // progress; cycles stays at the block's start until it ends. 0 outside
+    // blocks.
+    uint16_t blockCycles;
+
+#if BLOCK_CACHE
+    struct BlockCache* blockCache;
+#endif
+
+#if AOT
+    struct AotTable* aot;
+#endif
+
+    // One bit per address, NULL until the first set_breakpoint. The run loops
+    // load it once per call, so it can sit past the first cache line.
+    uint8_t* breakpoints;
+
+#if BRANCH_PROFILE
+    // [opcode][taken]
+    uint64_t branchCounts[0x100][2];
+#endif
 } CPU;
 
+typedef enum FlagOp
+{
+    FLAGS_NONE,
+    FLAGS_ADD,
+    FLAGS_SUB,
+    FLAGS_AND,
+    FLAGS_LOGIC,
+    FLAGS_INC,
+    FLAGS_DEC,
+    FLAGS_ADD_HL,
+    FLAGS_SHIFT
+} FlagOp;
+
+// Bits of IF and IE, in priority order; each has its handler at 0x40 + 8 * bit
+typedef enum Interrupt
+{
+    INT_VBLANK,
+    INT_STAT,
+    INT_TIMER,
+    INT_SERIAL,
+    INT_JOYPAD
+} Interrupt;
+
+// Why run_until/run_cycles returned
+typedef enum RunResult
+{
+    RUN_BUDGET,
+    RUN_EVENT,
+    RUN_BREAKPOINT
+} RunResult;
+
+extern int (*instruction_map[0x100])(CPU* cpu, uint8_t inst);
+extern int (*cb_instruction_map[0x100])(CPU* cpu, uint8_t inst);
+
+#if BLOCK_CACHE
+// Per-opcode handlers for already decoded instructions: the immediate, if
+// any, is passed in and PC has to be past the whole instruction. No entry for
+// the CB prefix.
+extern int (*decoded_instruction_map[0x100])(CPU* cpu, uint16_t imm);
+extern int (*decoded_cb_instruction_map[0x100])(CPU* cpu, uint16_t imm);
+#endif
+
 CPU* make_cpu(Memory* mem);
+
+// Zeroes cpu and attaches it to mem, without allocating
+void init_cpu(CPU* cpu, Memory* mem);
 int execute_inst(CPU* cpu);
-void print_reg(CPU* cpu);
\ No newline at end of file
+RunResult run_until(CPU* cpu, uint64_t targetCycle);
+RunResult run_cycles(CPU* cpu, uint64_t budget);
+void set_breakpoint(CPU* cpu, uint16_t addr);
+void clear_breakpoint(CPU* cpu, uint16_t addr);
+void request_interrupt(CPU* cpu, Interrupt interrupt);
+uint64_t step_until(CPU* cpu, uint64_t limit);
+
+// Cycle at which the instruction in progress makes its data access (a write
+// or not), for peripherals that catch up to the cycle they are accessed on
+uint64_t access_cycle(CPU* cpu, bool write);
+
+// Limit for a run loop that started with limit, once it sees checkState: a
+// register write may have brought the next event forward
+static inline uint64_t event_limit(CPU* cpu, uint64_t limit)
+{
+    return cpu->nextEvent < limit ? cpu->nextEvent : limit;
+}
+
+#if FUSION
+int fused_copy_loop(CPU* cpu, uint16_t loopPc);
+int fused_dec_loop(CPU* cpu, int regIndex, uint16_t loopPc);
+int fused_ldh_cp_jr(CPU* cpu, uint8_t port, uint8_t value, uint8_t jrInst, int8_t offset, uint16_t nextPc);
+#endif
+uint8_t read_flags(CPU* cpu);
+void write_flags(CPU* cpu, uint8_t flags);
+void print_reg(CPU* cpu);
+#if BRANCH_PROFILE
+void print_branch_profile(CPU* cpu);
+#endif
\ No newline at end of file
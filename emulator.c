@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "emulator.h"
+#include "cartridge.h"
+#include "block-cache.h"
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+_Static_assert(offsetof(CPU, breakpoints) <= EMULATOR_ALIGN, "hot CPU fields spill out of the first cache line");
+_Static_assert(sizeof(Emulator) <= HUGE_PAGE_SIZE, "Emulator no longer fits a huge page");
+
+// Until there is a PPU, VBlank is only its interrupt, once a frame while the
+// LCD is on. It is only pending while the LCD is on.
+static void vblank_event(Memory* mem, uint64_t cycle)
+{
+    mem->ram[REG_IF] |= 1 << INT_VBLANK;
+
+    schedule_event(mem->scheduler, EVENT_VBLANK, cycle + FRAME_CYCLES);
+}
+
+uint8_t ly_read(Memory* mem, uint8_t port)
+{
+    if (!mem->scheduler || !(mem->ram[REG_LCDC] & 0x80)) return mem->ram[IO_BASE | port];
+
+    uint64_t line = (access_cycle(mem->scheduler->cpu, false) - mem->lcdOnCycle) / LINE_CYCLES;
+    uint64_t next = mem->lcdOnCycle + (line + 1) * LINE_CYCLES;
+    if (next < mem->clockedUntil) mem->clockedUntil = next;
+
+    return line % (FRAME_CYCLES / LINE_CYCLES);
+}
+
+void lcdc_write(Memory* mem, uint8_t port, uint8_t value)
+{
+    Scheduler* scheduler = mem->scheduler;
+    if (!scheduler) return;
+
+    bool wasOn = event_pending(scheduler, EVENT_VBLANK);
+    bool on = value & 0x80;
+
+    if (on && !wasOn)
+    {
+        mem->lcdOnCycle = access_cycle(scheduler->cpu, true);
+        schedule_event(scheduler, EVENT_VBLANK, mem->lcdOnCycle + VBLANK_LINE * LINE_CYCLES);
+    }
+    else if (!on && wasOn)
+    {
+        cancel_event(scheduler, EVENT_VBLANK);
+    }
+}
+
+// Explicit huge pages if any are reserved, else a transparent one if the
+// kernel goes along with it; NULL to fall back to small pages
+static Emulator* map_huge(size_t* mappedSize)
+{
+#ifdef MAP_HUGETLB
+    void* block = mmap(NULL, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (block != MAP_FAILED)
+    {
+        *mappedSize = HUGE_PAGE_SIZE;
+        return block;
+    }
+#endif
+
+#ifdef MADV_HUGEPAGE
+    void* aligned = aligned_alloc(HUGE_PAGE_SIZE, HUGE_PAGE_SIZE);
+    if (aligned && madvise(aligned, HUGE_PAGE_SIZE, MADV_HUGEPAGE) == 0)
+    {
+        *mappedSize = 0;
+        return aligned;
+    }
+    free(aligned);
+#endif
+
+    return NULL;
+}
+
+Emulator* make_emulator(bool hugePages)
+{
+    size_t mappedSize = 0;
+    Emulator* emu = hugePages ? map_huge(&mappedSize) : NULL;
+    bool huge = emu != NULL;
+
+    if (!emu) emu = aligned_alloc(EMULATOR_ALIGN, sizeof(Emulator));
+
+    init_emulator(emu);
+    emu->mappedSize = mappedSize;
+    emu->hugePages = huge;
+
+    return emu;
+}
+
+void free_emulator(Emulator* emu)
+{
+    if (emu->mappedSize) munmap(emu, emu->mappedSize);
+    else free(emu);
+}
+
+void init_emulator(Emulator* emu)
+{
+    memset(emu, 0, sizeof(Emulator));
+
+    init_memory(&emu->mem);
+    init_cpu(&emu->cpu, &emu->mem);
+
+    init_scheduler(&emu->scheduler, &emu->cpu);
+    set_event_handler(&emu->scheduler, EVENT_VBLANK, vblank_event);
+    init_timer(&emu->timer, &emu->cpu);
+
+    reset_emulator(emu);
+}
+
+void reset_emulator(Emulator* emu)
+{
+    CPU* cpu = &emu->cpu;
+    Memory* mem = &emu->mem;
+
+    // Attachments survive; everything else in the CPU starts over
+    CPU attached = *cpu;
+    init_cpu(cpu, mem);
+    cpu->breakpoints = attached.breakpoints;
+
+#if BLOCK_CACHE
+    cpu->blockCache = attached.blockCache;
+    if (cpu->blockCache) flush_block_cache(cpu->blockCache);
+#endif
+
+#if AOT
+    cpu->aot = attached.aot;
+#endif
+
+    // Register values the boot ROM leaves behind on a DMG
+    cpu->a = 0x01;
+    write_flags(cpu, 0xb0);
+    cpu->bc = 0x0013;
+    cpu->de = 0x00d8;
+    cpu->hl = 0x014d;
+    cpu->sp = 0xfffe;
+    cpu->pc = 0x100;
+
+    memset(&mem->ram[0x8000], 0, 0x8000);
+    map_flat(mem);
+    map_io(mem);
+
+    if (mem->cart) map_cartridge(mem, mem->cart);
+
+    cancel_all_events(&emu->scheduler);
+    mem->lcdOnCycle = 0;
+    schedule_event(&emu->scheduler, EVENT_VBLANK, VBLANK_LINE * LINE_CYCLES);
+    reset_timer(&emu->timer);
+}
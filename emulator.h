@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "memory.h"
+#include "cpu.h"
+#include "scheduler.h"
+#include "timer.h"
+
+// Cache line size the layout is planned around
+#define EMULATOR_ALIGN 64
+
+// M-cycles per scanline and per 59.7 Hz frame of 154 lines, the last 10 of
+// them VBlank
+#define LINE_CYCLES 114
+#define FRAME_CYCLES (154 * LINE_CYCLES)
+#define VBLANK_LINE 144
+
+// One whole machine in a single block: the CPU's registers and run state in
+// the first cache line, then the bus page tables, then the 64 KiB backing
+// store holding VRAM, WRAM, OAM, the I/O registers and HRAM, then the
+// peripherals' event queue and state. cpu.mem points at mem, and since the
+// pointer sits in the registers' cache line, following it costs no extra
+// miss. Nothing in here points outside the block except what the caller
+// attaches: a cartridge, a block cache, an AOT table, breakpoints.
+typedef struct Emulator
+{
+    _Alignas(EMULATOR_ALIGN) CPU cpu;
+    _Alignas(EMULATOR_ALIGN) Memory mem;
+    Scheduler scheduler;
+    Timer timer;
+
+    // How make_emulator got the block, for free_emulator: a mapping of this
+    // many bytes, or 0 for the heap
+    size_t mappedSize;
+    bool hugePages;
+} Emulator;
+
+// io_registers handler for LY, which runs through the 154 lines of a frame
+// in step with VBlank while the LCD is on and reads 0 while it is off.
+// Without a scheduler attached it is a plain register.
+uint8_t ly_read(Memory* mem, uint8_t port);
+
+// io_registers handler for LCDC. Switching the LCD on starts LY over at line
+// 0 and VBlank 144 lines later; switching it off stops VBlank.
+void lcdc_write(Memory* mem, uint8_t port, uint8_t value);
+
+// Allocates and initialises an emulator. With hugePages the block is put on a
+// 2 MiB huge page if the system will give us one, so the CPU and the whole
+// address space are covered by a single TLB entry; otherwise, or without
+// hugePages, it is ordinary memory aligned to EMULATOR_ALIGN.
+Emulator* make_emulator(bool hugePages);
+void free_emulator(Emulator* emu);
+
+// Sets up an Emulator the caller has placed, statically or in an array of
+// them, and resets it. Allocates nothing; emu must be EMULATOR_ALIGN aligned.
+void init_emulator(Emulator* emu);
+
+// Puts the machine where the DMG boot ROM hands over to the cartridge: boot
+// register values, I/O registers reset, memory from 0x8000 up cleared and the
+// peripherals' events scheduled afresh. Below 0x8000 is left alone, which
+// without a cartridge is the caller's ROM image. A mapped cartridge stays
+// mapped, with its controller reset and its RAM kept; attachments stay, with
+// the block cache flushed. Allocates nothing.
+void reset_emulator(Emulator* emu);
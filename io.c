@@ -0,0 +1,81 @@
+#include "io.h"
+#include "timer.h"
+#include "emulator.h"
+
+// OAM DMA from value * 0x100. The hardware takes 160 M-cycles and locks the
+// bus meanwhile; this copies everything at once.
+static void write_dma(Memory* mem, uint8_t port, uint8_t value)
+{
+    uint16_t src = value << 8;
+
+    for (int i = 0; i < 0xa0; i++) mem->ram[0xfe00 + i] = bus_read8(mem, src + i);
+}
+
+// Read and write mask, reset value. Registers left out read as 0xff and
+// ignore writes; so do the CGB-only ones.
+#define PLAIN(reset) { 0xff, 0xff, reset }
+#define SOUND(orMask, reset) { (uint8_t)~(orMask), 0xff, reset }
+
+const IoRegister io_registers[IO_REGISTERS + 1] = {
+    [0x00] = { 0x3f, 0x30, 0xcf },                  // JOYP, no buttons pressed
+    [0x01] = PLAIN(0x00),                           // SB
+    [0x02] = { 0x81, 0x81, 0x7e },                  // SC
+    [0x04] = { 0xff, 0x00, 0xab, timer_read, timer_write }, // DIV
+    [0x05] = { 0xff, 0xff, 0x00, timer_read, timer_write }, // TIMA
+    [0x06] = { 0xff, 0xff, 0x00, NULL, timer_write },       // TMA
+    [0x07] = { 0x07, 0x07, 0xf8, NULL, timer_write },       // TAC
+    [0x0f] = { 0x1f, 0x1f, 0xe1, timer_read, timer_write }, // IF
+
+    // NR10-NR51 read back with their write-only bits set
+    [0x10] = SOUND(0x80, 0x80), [0x11] = SOUND(0x3f, 0xbf), [0x12] = SOUND(0x00, 0xf3),
+    [0x13] = SOUND(0xff, 0xff), [0x14] = SOUND(0xbf, 0xbf),
+    [0x16] = SOUND(0x3f, 0x3f), [0x17] = SOUND(0x00, 0x00), [0x18] = SOUND(0xff, 0xff),
+    [0x19] = SOUND(0xbf, 0xbf),
+    [0x1a] = SOUND(0x7f, 0x7f), [0x1b] = SOUND(0xff, 0xff), [0x1c] = SOUND(0x9f, 0x9f),
+    [0x1d] = SOUND(0xff, 0xff), [0x1e] = SOUND(0xbf, 0xbf),
+    [0x20] = SOUND(0xff, 0xff), [0x21] = SOUND(0x00, 0x00), [0x22] = SOUND(0x00, 0x00),
+    [0x23] = SOUND(0xbf, 0xbf),
+    [0x24] = SOUND(0x00, 0x77), [0x25] = SOUND(0x00, 0xf3),
+    [0x26] = { 0x8f, 0x80, 0xf1 },                  // NR52, channel bits are status
+
+    // Wave RAM
+    [0x30] = PLAIN(0x00), [0x31] = PLAIN(0x00), [0x32] = PLAIN(0x00), [0x33] = PLAIN(0x00),
+    [0x34] = PLAIN(0x00), [0x35] = PLAIN(0x00), [0x36] = PLAIN(0x00), [0x37] = PLAIN(0x00),
+    [0x38] = PLAIN(0x00), [0x39] = PLAIN(0x00), [0x3a] = PLAIN(0x00), [0x3b] = PLAIN(0x00),
+    [0x3c] = PLAIN(0x00), [0x3d] = PLAIN(0x00), [0x3e] = PLAIN(0x00), [0x3f] = PLAIN(0x00),
+
+    [0x40] = { 0xff, 0xff, 0x91, NULL, lcdc_write }, // LCDC
+    [0x41] = { 0x7f, 0x78, 0x85 },                  // STAT, mode and LYC=LY are status
+    [0x42] = PLAIN(0x00),                           // SCY
+    [0x43] = PLAIN(0x00),                           // SCX
+    [0x44] = { 0xff, 0x00, 0x00, ly_read },         // LY
+    [0x45] = PLAIN(0x00),                           // LYC
+    [0x46] = { 0xff, 0xff, 0xff, NULL, write_dma }, // DMA
+    [0x47] = PLAIN(0xfc),                           // BGP
+    [0x48] = PLAIN(0xff),                           // OBP0
+    [0x49] = PLAIN(0xff),                           // OBP1
+    [0x4a] = PLAIN(0x00),                           // WY
+    [0x4b] = PLAIN(0x00),                           // WX
+
+    [IO_IE_SLOT] = PLAIN(0x00),                     // IE
+};
+
+static uint8_t io_page_read(Memory* mem, uint16_t addr)
+{
+    return io_read(mem, addr & 0xff);
+}
+
+static void io_page_write(Memory* mem, uint16_t addr, uint8_t value)
+{
+    io_write(mem, addr & 0xff, value);
+}
+
+// Routes 0xff00-0xffff through the register table and resets the registers
+void map_io(Memory* mem)
+{
+    bus_map(mem, IO_BASE, BUS_PAGE_SIZE, NULL, NULL);
+    bus_map_handlers(mem, IO_BASE, BUS_PAGE_SIZE, io_page_read, io_page_write);
+
+    for (int port = 0; port < IO_REGISTERS; port++) mem->ram[IO_BASE | port] = io_registers[port].reset;
+    mem->ram[REG_IE] = io_registers[IO_IE_SLOT].reset;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "memory.h"
+
+// Hardware registers at 0xff00-0xff7f plus IE at 0xffff. map_io puts the top
+// bus page on handlers that go through io_registers; memory from make_memory
+// alone leaves it plain RAM, which is what the CPU tests expect.
+
+#define IO_BASE 0xff00
+#define IO_REGISTERS 0x80
+
+// io_registers slot for IE, after the 0x80 registers
+#define IO_IE_SLOT IO_REGISTERS
+
+#define REG_JOYP 0xff00
+#define REG_SB 0xff01
+#define REG_SC 0xff02
+#define REG_DIV 0xff04
+#define REG_TIMA 0xff05
+#define REG_TMA 0xff06
+#define REG_TAC 0xff07
+#define REG_IF 0xff0f
+#define REG_NR52 0xff26
+#define REG_LCDC 0xff40
+#define REG_STAT 0xff41
+#define REG_LY 0xff44
+#define REG_LYC 0xff45
+#define REG_DMA 0xff46
+#define REG_BGP 0xff47
+#define REG_WY 0xff4a
+#define REG_WX 0xff4b
+#define REG_IE 0xffff
+
+typedef struct IoRegister
+{
+    // Bits that exist; the others always read back as 1
+    uint8_t readMask;
+
+    // Bits the CPU can change; writes leave the others alone
+    uint8_t writeMask;
+
+    // Value after the DMG boot ROM
+    uint8_t reset;
+
+    // Only for registers with side effects, NULL for plain storage. write is
+    // called after the masked value has been stored.
+    uint8_t (*read)(Memory* mem, uint8_t port);
+    void (*write)(Memory* mem, uint8_t port, uint8_t value);
+} IoRegister;
+
+extern const IoRegister io_registers[IO_REGISTERS + 1];
+
+void map_io(Memory* mem);
+
+// HRAM between the registers and IE is plain memory
+static inline const IoRegister* io_register(uint8_t port)
+{
+    if (port < IO_REGISTERS) return &io_registers[port];
+
+    return port == 0xff ? &io_registers[IO_IE_SLOT] : NULL;
+}
+
+// Register access by port (the low byte of the address). Plain registers are
+// a load or store with their masks applied, without calling anything.
+static inline uint8_t io_read(Memory* mem, uint8_t port)
+{
+    const IoRegister* reg = io_register(port);
+    uint8_t value = mem->ram[IO_BASE | port];
+
+    if (!reg) return value;
+    if (reg->read) return reg->read(mem, port);
+
+    return value | (uint8_t)~reg->readMask;
+}
+
+static inline void io_write(Memory* mem, uint8_t port, uint8_t value)
+{
+    const IoRegister* reg = io_register(port);
+    uint8_t* stored = &mem->ram[IO_BASE | port];
+
+    if (!reg)
+    {
+        *stored = value;
+        return;
+    }
+
+    *stored = (*stored & ~reg->writeMask) | (value & reg->writeMask);
+
+    if (reg->write) reg->write(mem, port, value);
+}
@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "jit.h"
+#include "opcodes.h"
+
+#if JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Upper bound on the code emitted for one block (32 fallback calls)
+#define JIT_MAX_BLOCK_CODE 8192
+
+// Host registers. The translated code keeps the CPU pointer in rbx, the flag
+// lookup table in rbp and the SM83 registers in r8b-r15b while it runs.
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define HOST_A R8
+#define HOST_F R9
+
+// Host register for each operand index B C D E H L (HL) A
+static const int hostRegs[8] = { R10, R11, R12, R13, R14, R15, -1, HOST_A };
+
+typedef struct Emitter
+{
+    uint8_t* p;
+
+    // AH still holds the LAHF of a native op whose host carry is the SM83
+    // carry, so ADC/SBC can skip the round trip through F
+    bool carryInAh;
+} Emitter;
+
+typedef struct MappedReg
+{
+    int host;
+    uint8_t offset;
+} MappedReg;
+
+static const MappedReg mappedRegs[8] = {
+    { HOST_A, offsetof(CPU, a) },
+    { HOST_F, offsetof(CPU, f) },
+    { R10, offsetof(CPU, b) },
+    { R11, offsetof(CPU, c) },
+    { R12, offsetof(CPU, d) },
+    { R13, offsetof(CPU, e) },
+    { R14, offsetof(CPU, h) },
+    { R15, offsetof(CPU, l) }
+};
+
+// SM83 Z-H-C bits for every value LAHF can leave in AH (ZF bit 6, AF bit 4,
+// CF bit 0)
+static uint8_t lahfFlags[0x100];
+
+static void emit8(Emitter* e, uint8_t value)
+{
+    *e->p++ = value;
+}
+
+static void emit16(Emitter* e, uint16_t value)
+{
+    memcpy(e->p, &value, 2);
+    e->p += 2;
+}
+
+static void emit32(Emitter* e, uint32_t value)
+{
+    memcpy(e->p, &value, 4);
+    e->p += 4;
+}
+
+static void emit64(Emitter* e, uint64_t value)
+{
+    memcpy(e->p, &value, 8);
+    e->p += 8;
+}
+
+// op r/m8, r8 between two host byte registers. The REX prefix is always
+// emitted so 4-7 select spl-dil rather than ah-bh.
+static void emit_rr8(Emitter* e, uint8_t opcode, int dst, int src)
+{
+    emit8(e, 0x40 | ((src >> 3) << 2) | (dst >> 3));
+    emit8(e, opcode);
+    emit8(e, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+// Group 1 op r/m8, imm8 (ext: 0 ADD, 1 OR, 2 ADC, 3 SBB, 4 AND, 5 SUB, 6 XOR, 7 CMP)
+static void emit_ri8(Emitter* e, int ext, int dst, uint8_t imm)
+{
+    emit8(e, 0x40 | (dst >> 3));
+    emit8(e, 0x80);
+    emit8(e, 0xc0 | (ext << 3) | (dst & 7));
+    emit8(e, imm);
+}
+
+static void emit_mov_ri8(Emitter* e, int dst, uint8_t imm)
+{
+    emit8(e, 0x40 | (dst >> 3));
+    emit8(e, 0xb0 + (dst & 7));
+    emit8(e, imm);
+}
+
+// mov r8, [rbx + offset] (opcode 0x8a) or mov [rbx + offset], r8 (0x88)
+static void emit_cpu_access(Emitter* e, uint8_t opcode, int reg, uint8_t offset)
+{
+    emit8(e, 0x40 | ((reg >> 3) << 2));
+    emit8(e, opcode);
+    emit8(e, 0x40 | ((reg & 7) << 3) | RBX);
+    emit8(e, offset);
+}
+
+static void emit_load_regs(Emitter* e)
+{
+    for (int i = 0; i < 8; i++) emit_cpu_access(e, 0x8a, mappedRegs[i].host, mappedRegs[i].offset);
+}
+
+static void emit_store_regs(Emitter* e)
+{
+    for (int i = 0; i < 8; i++) emit_cpu_access(e, 0x88, mappedRegs[i].host, mappedRegs[i].offset);
+}
+
+// mov word [rbx + offset], imm16
+static void emit_store_cpu16(Emitter* e, uint8_t offset, uint16_t value)
+{
+    emit8(e, 0x66);
+    emit8(e, 0xc7);
+    emit8(e, 0x43);
+    emit8(e, offset);
+    emit16(e, value);
+}
+
+// add dword [rsp], imm32 (the block's cycle counter)
+static void emit_add_cycles(Emitter* e, uint32_t cycles)
+{
+    if (!cycles) return;
+
+    emit8(e, 0x81);
+    emit8(e, 0x04);
+    emit8(e, 0x24);
+    emit32(e, cycles);
+}
+
+// Replaces the F bits in `written` with the Z-H-C bits of the last host
+// instruction masked by `mask`, plus `set`
+static void emit_flags(Emitter* e, uint8_t written, uint8_t mask, uint8_t set)
+{
+    emit8(e, 0x9f);                                     // lahf
+    emit8(e, 0x0f); emit8(e, 0xb6); emit8(e, 0xcc);     // movzx ecx, ah
+    emit8(e, 0x8a); emit8(e, 0x4c); emit8(e, 0x0d); emit8(e, 0x00); // mov cl, [rbp + rcx]
+    if (mask != 0xb0) emit_ri8(e, 4, RCX, mask);
+    if (set) emit_ri8(e, 1, RCX, set);
+    emit_ri8(e, 4, HOST_F, ~written);
+    emit_rr8(e, 0x08, HOST_F, RCX);
+}
+
+// Copies the SM83 carry into the host carry for ADC/SBC
+static void emit_load_carry(Emitter* e)
+{
+    if (e->carryInAh)
+    {
+        emit8(e, 0x0f); emit8(e, 0xba); emit8(e, 0xe0); emit8(e, 0x08);                 // bt eax, 8
+    }
+    else
+    {
+        emit8(e, 0x41); emit8(e, 0x0f); emit8(e, 0xba); emit8(e, 0xe1); emit8(e, 0x04); // bt r9d, 4
+    }
+}
+
+// 8-bit ALU op on A; src is a host register, or -1 for the immediate
+static void emit_alu(Emitter* e, uint8_t kind, int src, uint8_t imm, bool flagsLive)
+{
+    // r/m8, r8 opcode and group 1 extension per kind
+    uint8_t opcode, ext, mask = 0xb0, set = 0;
+    switch (kind)
+    {
+        case KIND_ADD: opcode = 0x00; ext = 0; break;
+        case KIND_ADC: opcode = 0x10; ext = 2; emit_load_carry(e); break;
+        case KIND_SUB: opcode = 0x28; ext = 5; set = 0x40; break;
+        case KIND_SBC: opcode = 0x18; ext = 3; set = 0x40; emit_load_carry(e); break;
+        case KIND_CP: opcode = 0x38; ext = 7; set = 0x40; break;
+        case KIND_AND: opcode = 0x20; ext = 4; mask = 0x80; set = 0x20; break;
+        case KIND_XOR: opcode = 0x30; ext = 6; mask = 0x80; break;
+        default: opcode = 0x08; ext = 1; mask = 0x80; break;
+    }
+
+    if (src < 0) emit_ri8(e, ext, HOST_A, imm);
+    else emit_rr8(e, opcode, HOST_A, src);
+
+    if (flagsLive) emit_flags(e, 0xf0, mask, set);
+    e->carryInAh = flagsLive;
+}
+
+// Emits native code for the instructions that only touch registers. Returns
+// false for everything else, which goes through the interpreter handler.
+// F is left stale when flagsLive is false, i.e. nothing reads it before the
+// next instruction that overwrites all of it.
+static bool emit_native(Emitter* e, MicroOp* op, bool flagsLive)
+{
+    const OpcodeInfo* info = &opcode_info[op->info];
+    uint8_t inst = op->inst;
+    int dst = hostRegs[(inst >> 3) & 7];
+    int src = hostRegs[inst & 7];
+
+    if (op->opcodeLength != 1) return false;
+
+    switch (info->kind)
+    {
+        case KIND_NOP:
+            return true;
+        case KIND_LD:
+            if (inst >= 0x40 && inst < 0x80 && dst >= 0 && src >= 0)
+            {
+                if (dst != src) emit_rr8(e, 0x88, dst, src);
+                return true;
+            }
+            if (inst < 0x40 && (inst & 7) == 6 && dst >= 0)
+            {
+                emit_mov_ri8(e, dst, op->imm);
+                return true;
+            }
+            return false;
+        case KIND_LD16:
+            if (inst == 0x31)
+            {
+                emit_store_cpu16(e, offsetof(CPU, sp), op->imm);
+                return true;
+            }
+            if (inst > 0x31 || (inst & 0xf) != 1) return false;
+            emit_mov_ri8(e, hostRegs[(inst >> 4) * 2], op->imm >> 8);
+            emit_mov_ri8(e, hostRegs[(inst >> 4) * 2 + 1], op->imm & 0xff);
+            return true;
+        case KIND_INC16:
+        case KIND_DEC16:
+        {
+            bool inc = info->kind == KIND_INC16;
+            if (inst >> 4 == 3)
+            {
+                // inc/dec word [rbx + sp]
+                emit8(e, 0x66); emit8(e, 0xff); emit8(e, inc ? 0x43 : 0x4b); emit8(e, offsetof(CPU, sp));
+                return true;
+            }
+            // add/sub 1 on the low byte, carry into the high byte
+            emit_ri8(e, inc ? 0 : 5, hostRegs[(inst >> 4) * 2 + 1], 1);
+            emit_ri8(e, inc ? 2 : 3, hostRegs[(inst >> 4) * 2], 0);
+            return true;
+        }
+        case KIND_INC:
+        case KIND_DEC:
+            if (dst < 0) return false;
+            emit_rr8(e, 0xfe, dst, info->kind == KIND_INC ? 0 : 1);
+            if (flagsLive) emit_flags(e, 0xe0, 0xa0, info->kind == KIND_INC ? 0 : 0x40);
+            e->carryInAh = false;
+            return true;
+        case KIND_ADD:
+        case KIND_ADC:
+        case KIND_SUB:
+        case KIND_SBC:
+        case KIND_CP:
+        case KIND_AND:
+        case KIND_XOR:
+        case KIND_OR:
+            if (inst >= 0xc0) emit_alu(e, info->kind, -1, op->imm, flagsLive);
+            else if (src >= 0) emit_alu(e, info->kind, src, 0, flagsLive);
+            else return false;
+            return true;
+        case KIND_GENERIC:
+            switch (inst)
+            {
+                case 0x2f:
+                    // CPL: not r8b
+                    emit_rr8(e, 0xf6, HOST_A, 2);
+                    emit_ri8(e, 1, HOST_F, 0x60);
+                    return true;
+                case 0x37:
+                    // SCF
+                    e->carryInAh = false;
+                    emit_ri8(e, 4, HOST_F, 0x8f);
+                    emit_ri8(e, 1, HOST_F, 0x10);
+                    return true;
+                case 0x3f:
+                    // CCF
+                    e->carryInAh = false;
+                    emit_ri8(e, 4, HOST_F, 0x9f);
+                    emit_ri8(e, 6, HOST_F, 0x10);
+                    return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+// Calls the decoded handler for op with the registers written back and PC
+// pointing past the instruction, like execute_block does
+static void emit_fallback(Emitter* e, MicroOp* op, uint16_t pc)
+{
+    e->carryInAh = false;
+
+    emit_store_regs(e);
+    emit_store_cpu16(e, offsetof(CPU, pc), pc + op->length);
+
+    // The opcode and the cycles so far, for the timing of register accesses
+    emit8(e, 0xc6); emit8(e, 0x43); emit8(e, offsetof(CPU, inst));                 // mov byte [rbx + inst], opcode
+    emit8(e, op->opcodeLength == 2 ? 0xcb : op->inst);
+    emit8(e, 0x8b); emit8(e, 0x04); emit8(e, 0x24);                                 // mov eax, [rsp]
+    emit8(e, 0x66); emit8(e, 0x89); emit8(e, 0x43); emit8(e, offsetof(CPU, blockCycles)); // mov [rbx + blockCycles], ax
+
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xdf);     // mov rdi, rbx
+    emit8(e, 0xbe); emit32(e, op->imm);                 // mov esi, imm
+    emit8(e, 0x48); emit8(e, 0xb8);                     // mov rax, handler
+    emit64(e, (uint64_t)(uintptr_t)op->handler);
+    emit8(e, 0xff); emit8(e, 0xd0);                     // call rax
+    emit8(e, 0x01); emit8(e, 0x04); emit8(e, 0x24);     // add [rsp], eax
+}
+
+// Works out backwards which instructions need to produce F: it is live at the
+// end of the block and before every handler call, dead before a native ALU op
+// that overwrites all of it (other than ADC/SBC, which read the carry)
+static void compute_flag_liveness(Block* block, bool* flagsLive)
+{
+    uint8_t scratch[64];
+    bool live = true;
+
+    for (int i = block->numOps - 1; i >= 0; i--)
+    {
+        MicroOp* op = &block->ops[i];
+        uint8_t kind = opcode_info[op->info].kind;
+        flagsLive[i] = live;
+
+        Emitter dryRun = { scratch, false };
+        if (!emit_native(&dryRun, op, true)) live = true;
+        else if (kind >= KIND_ADD && kind <= KIND_OR) live = kind == KIND_ADC || kind == KIND_SBC;
+    }
+}
+
+static void init_lahf_flags(void)
+{
+    for (int ah = 0; ah < 0x100; ah++)
+    {
+        lahfFlags[ah] = ((ah & 0x40) ? 0x80 : 0) | ((ah & 0x10) ? 0x20 : 0) | ((ah & 0x01) ? 0x10 : 0);
+    }
+}
+
+// Drops every translation and rewinds the arena
+void jit_flush(BlockCache* cache)
+{
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++)
+    {
+        cache->blocks[i].code = NULL;
+        cache->blocks[i].execCount = 0;
+    }
+
+    cache->codeUsed = 0;
+    cache->evictions++;
+}
+
+// Changes the protection of the arena pages covering [from, to)
+static bool protect_code(BlockCache* cache, uint32_t from, uint32_t to, int prot)
+{
+    uint32_t pageSize = sysconf(_SC_PAGESIZE);
+    uint32_t first = from & ~(pageSize - 1);
+    uint32_t last = (to + pageSize - 1) & ~(pageSize - 1);
+    if (last > JIT_ARENA_SIZE) last = JIT_ARENA_SIZE;
+
+    return mprotect(cache->code + first, last - first, prot) == 0;
+}
+
+// The arena is never writable and executable at once: the pages a block is
+// emitted into are made writable first and executable again once it is done
+bool jit_compile_block(BlockCache* cache, Block* block)
+{
+    if (!cache->code)
+    {
+        void* arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena == MAP_FAILED) return false;
+
+        cache->code = arena;
+        init_lahf_flags();
+    }
+
+    if (cache->codeUsed + JIT_MAX_BLOCK_CODE > JIT_ARENA_SIZE) jit_flush(cache);
+
+    // The first page may hold the end of the previous block, which is not run
+    // while this one is emitted
+    if (!protect_code(cache, cache->codeUsed, cache->codeUsed + JIT_MAX_BLOCK_CODE, PROT_READ | PROT_WRITE)) return false;
+
+    Emitter emitter = { cache->code + cache->codeUsed, false };
+    Emitter* e = &emitter;
+    uint8_t* start = e->p;
+
+    // Prologue: save the callee-saved registers, keep the stack 16-byte
+    // aligned for the handler calls and zero the cycle counter at [rsp]
+    emit8(e, 0x53);                                     // push rbx
+    emit8(e, 0x55);                                     // push rbp
+    emit8(e, 0x41); emit8(e, 0x54);                     // push r12
+    emit8(e, 0x41); emit8(e, 0x55);                     // push r13
+    emit8(e, 0x41); emit8(e, 0x56);                     // push r14
+    emit8(e, 0x41); emit8(e, 0x57);                     // push r15
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xec); emit8(e, 0x08); // sub rsp, 8
+    emit8(e, 0xc7); emit8(e, 0x04); emit8(e, 0x24); emit32(e, 0);   // mov dword [rsp], 0
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xfb);     // mov rbx, rdi
+    emit8(e, 0x48); emit8(e, 0xbd);                     // mov rbp, lahfFlags
+    emit64(e, (uint64_t)(uintptr_t)lahfFlags);
+    emit_load_regs(e);
+
+    // rel32 fields of the jumps to the exit taken when a handler invalidated
+    // the block
+    uint8_t* exitJumps[BLOCK_MAX_OPS];
+    int numExitJumps = 0;
+
+    bool flagsLive[BLOCK_MAX_OPS];
+    compute_flag_liveness(block, flagsLive);
+
+    uint16_t pc = block->startPc;
+    uint32_t pendingCycles = 0;
+    bool registersLive = true;
+
+    for (int i = 0; i < block->numOps; i++)
+    {
+        MicroOp* op = &block->ops[i];
+
+        if (emit_native(e, op, flagsLive[i]))
+        {
+            pendingCycles += op->cycles;
+            registersLive = true;
+        }
+        else
+        {
+            emit_add_cycles(e, pendingCycles);
+            pendingCycles = 0;
+
+            emit_fallback(e, op, pc);
+            registersLive = false;
+
+            if (i + 1 < block->numOps)
+            {
+                emit_load_regs(e);
+                registersLive = true;
+
+                // mov rax, &block->valid; cmp byte [rax], 0; je exit
+                emit8(e, 0x48); emit8(e, 0xb8); emit64(e, (uint64_t)(uintptr_t)&block->valid);
+                emit8(e, 0x80); emit8(e, 0x38); emit8(e, 0x00);
+                emit8(e, 0x0f); emit8(e, 0x84);
+                exitJumps[numExitJumps++] = e->p;
+                emit32(e, 0);
+            }
+        }
+
+        pc += op->length;
+    }
+
+    if (registersLive)
+    {
+        emit_store_regs(e);
+        emit_store_cpu16(e, offsetof(CPU, pc), block->endPc);
+    }
+    emit_add_cycles(e, pendingCycles);
+
+    for (int i = 0; i < numExitJumps; i++)
+    {
+        int32_t rel = e->p - (exitJumps[i] + 4);
+        memcpy(exitJumps[i], &rel, 4);
+    }
+
+    // Epilogue: return the cycle counter
+    emit8(e, 0x8b); emit8(e, 0x04); emit8(e, 0x24);     // mov eax, [rsp]
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xc4); emit8(e, 0x08); // add rsp, 8
+    emit8(e, 0x41); emit8(e, 0x5f);                     // pop r15
+    emit8(e, 0x41); emit8(e, 0x5e);                     // pop r14
+    emit8(e, 0x41); emit8(e, 0x5d);                     // pop r13
+    emit8(e, 0x41); emit8(e, 0x5c);                     // pop r12
+    emit8(e, 0x5d);                                     // pop rbp
+    emit8(e, 0x5b);                                     // pop rbx
+    emit8(e, 0xc3);                                     // ret
+
+    uint32_t startOffset = cache->codeUsed;
+    cache->codeUsed += e->p - start;
+    if (!protect_code(cache, startOffset, cache->codeUsed, PROT_READ | PROT_EXEC)) return false;
+
+    cache->compiledBlocks++;
+    block->code = (BlockCode)start;
+
+    return true;
+}
+
+// Translates and runs the single instruction at PC, so the GameboyCPUTests in
+// test-runner.c cover the translation of every opcode
+int jit_execute_inst(CPU* cpu)
+{
+    Block block;
+    decode_ops(cpu->mem, &block, cpu->pc, 1);
+    block.valid = true;
+
+    if (!jit_compile_block(cpu->blockCache, &block)) return execute_inst(cpu);
+
+    return block.code(cpu);
+}
+
+#endif
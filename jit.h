@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "block-cache.h"
+
+// Size of the arena the translated blocks live in
+#ifndef JIT_ARENA_SIZE
+#define JIT_ARENA_SIZE (4 << 20)
+#endif
+
+// Number of interpreted runs before a block is translated
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 16
+#endif
+
+#if JIT
+bool jit_compile_block(BlockCache* cache, Block* block);
+void jit_flush(BlockCache* cache);
+int jit_execute_inst(CPU* cpu);
+#endif
@@ -3,10 +3,150 @@
 
 #include "memory.h"
 #include "cpu.h"
+#include "cartridge.h"
+#include "emulator.h"
 #include "test-runner.h"
+#include "bench.h"
+#include "aot.h"
+#include "block-cache.h"
 
-int main(void)
+#if BLOCK_CACHE
+
+// Prints what the block cache did over a run and frees it
+static void release_block_cache(CPU* cpu)
+{
+    print_block_cache_stats(cpu->blockCache);
+#if IDLE_SKIP
+    print_idle_loop_stats(cpu);
+#endif
+
+    free_block_cache(cpu->blockCache);
+    cpu->blockCache = NULL;
+}
+
+#endif
+
+// Runs a cartridge from where the DMG boot ROM hands over for some frames and
+// prints the registers at the end. Battery-backed RAM lives in a .sav file
+// next to the ROM.
+static int run_rom(const char* path, int frames)
+{
+    Cartridge* cart = load_cartridge(path);
+    if (!cart) return 1;
+
+    print_cartridge(cart);
+
+    if (cart->hasBattery)
+    {
+        char savePath[4096];
+        const char* extension = strrchr(path, '.');
+        int stem = extension && !strchr(extension, '/') ? (int)(extension - path) : (int)strlen(path);
+
+        snprintf(savePath, sizeof(savePath), "%.*s.sav", stem, path);
+        map_save_file(cart, savePath, true);
+    }
+
+    Emulator* emu = make_emulator(true);
+    CPU* cpu = &emu->cpu;
+    map_cartridge(&emu->mem, cart);
+
+#if BLOCK_CACHE
+    cpu->blockCache = make_block_cache();
+#endif
+
+#if AOT
+    // The blocks linked in from the recompiler that match this cartridge
+    cpu->aot = make_aot_table(&emu->mem);
+#endif
+
+    for (int frame = 1; frame <= frames; frame++)
+    {
+        run_until(cpu, (uint64_t)frame * FRAME_CYCLES);
+        if (frame % SAVE_FLUSH_FRAMES == 0) flush_save(&emu->mem);
+    }
+
+    print_reg(cpu);
+
+#if BLOCK_CACHE
+    release_block_cache(cpu);
+#endif
+
+#if AOT
+    if (cpu->aot) print_aot_stats(cpu->aot);
+    free_aot_table(cpu->aot);
+#endif
+
+    free_emulator(emu);
+    free_cartridge(cart);
+
+    return 0;
+}
+
+// Mooneye test ROMs end in LD B,B with B C D E H L holding 3 5 8 13 21 34 on
+// success, or all 0x42 on failure
+static bool mooneye_done(CPU* cpu, bool* passed)
+{
+    *passed = cpu->b == 3 && cpu->c == 5 && cpu->d == 8 && cpu->e == 13 && cpu->h == 21 && cpu->l == 34;
+    bool failed = cpu->b == 0x42 && cpu->c == 0x42 && cpu->d == 0x42 && cpu->e == 0x42 && cpu->h == 0x42 && cpu->l == 0x42;
+
+    return *passed || failed;
+}
+
+// Runs a mooneye test ROM headlessly for up to frames frames and reports how
+// it ended. Exits 0 only if it passed.
+static int run_mooneye(const char* path, int frames)
+{
+    Cartridge* cart = load_cartridge(path);
+    if (!cart) return 1;
+
+    Emulator* emu = make_emulator(false);
+    CPU* cpu = &emu->cpu;
+    map_cartridge(&emu->mem, cart);
+
+#if BLOCK_CACHE
+    cpu->blockCache = make_block_cache();
+#endif
+
+    bool passed = false;
+    int frame = 1;
+
+    for (; frame <= frames; frame++)
+    {
+        run_until(cpu, (uint64_t)frame * FRAME_CYCLES);
+        if (mooneye_done(cpu, &passed)) break;
+    }
+
+    const char* result = frame > frames ? "TIMEOUT" : passed ? "PASS" : "FAIL";
+    printf("%s: %s after %d frames\n", path, result, frame > frames ? frames : frame);
+    if (!passed) print_reg(cpu);
+
+#if BLOCK_CACHE
+    release_block_cache(cpu);
+#endif
+
+    free_emulator(emu);
+    free_cartridge(cart);
+
+    return !passed;
+}
+
+int main(int argc, char** argv)
 {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        run_benchmarks();
+        return 0;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "rom") == 0) return run_rom(argv[2], argc > 3 ? atoi(argv[3]) : 60);
+    if (argc > 2 && strcmp(argv[1], "mooneye") == 0) return run_mooneye(argv[2], argc > 3 ? atoi(argv[3]) : 600);
+
+#if FUSION
+    if (argc > 1 && strcmp(argv[1], "fusion-test") == 0) return run_fusion_test(3000) != 0;
+#endif
+
+    if (argc > 1 && strcmp(argv[1], "timer-test") == 0) return run_timer_test(400) != 0;
+
     // Memory* mem = make_memory();
     // CPU* cpu = make_cpu(mem);
 
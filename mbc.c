@@ -0,0 +1,313 @@
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "cartridge.h"
+
+// Memory bank controllers. Switching a bank only re-points the bus pages of
+// the 16 KiB ROM or 8 KiB RAM window at another part of the image, 64 or 32
+// pointer pairs, instead of copying the bank into place.
+
+#define RTC_DAYS 512
+#define SECONDS_PER_DAY 86400
+
+static void map_rom_bank(Memory* mem, Cartridge* cart, uint16_t start, int bank)
+{
+    uint8_t* rom = (uint8_t*)cart->rom + (bank % cart->romBanks) * ROM_BANK_SIZE;
+
+    // Read-only: with no write pages, writes go to the controller
+    bus_map(mem, start, ROM_BANK_SIZE, rom, NULL);
+}
+
+// The RAM bank in the 0xa000-0xbfff window, or NULL when it is disabled, is
+// MBC2's nibble RAM or is showing an RTC register, which all need handlers
+static uint8_t* selected_ram(Cartridge* cart)
+{
+    if (!cart->ramBanks || cart->mbc == MBC_2) return NULL;
+    if (cart->mbc != MBC_NONE && !cart->ramEnabled) return NULL;
+
+    int bank;
+    switch (cart->mbc)
+    {
+        case MBC_1: bank = cart->mode ? cart->bank2 : 0; break;
+        case MBC_3:
+            if (cart->bank2 >= 0x08) return NULL;
+            bank = cart->bank2;
+            break;
+        case MBC_5: bank = cart->bank2; break;
+        default: bank = 0; break;
+    }
+
+    return cart->ram + (bank % cart->ramBanks) * RAM_BANK_SIZE;
+}
+
+static void map_ram(Memory* mem, Cartridge* cart)
+{
+    uint8_t* ram = selected_ram(cart);
+
+    bus_map(mem, 0xa000, RAM_BANK_SIZE, ram, ram);
+
+    // Clean pages of a persisted save trap the first write after each flush
+    // in cart_ram_write, which marks them dirty and maps them for writing
+    if (!ram || !cart->persistRam) return;
+
+    for (int offset = 0; offset < RAM_BANK_SIZE; offset += SAVE_PAGE_SIZE)
+    {
+        int page = (ram - cart->ram + offset) / SAVE_PAGE_SIZE;
+
+        if (!(cart->dirtyPages & (1u << page))) bus_map(mem, 0xa000 + offset, SAVE_PAGE_SIZE, ram + offset, NULL);
+    }
+}
+
+// Switchable ROM bank for the 0x4000-0x7fff window
+static int high_rom_bank(Cartridge* cart)
+{
+    return cart->mbc == MBC_1 ? cart->bank2 << 5 | cart->romBank : cart->romBank;
+}
+
+// Everything, after a reset or a register write that moves more than one window
+static void map_banks(Memory* mem, Cartridge* cart)
+{
+    // MBC1 in mode 1 also applies the upper bits to the bank at 0x0000
+    map_rom_bank(mem, cart, 0x0000, cart->mbc == MBC_1 && cart->mode ? cart->bank2 << 5 : 0);
+    map_rom_bank(mem, cart, 0x4000, high_rom_bank(cart));
+    map_ram(mem, cart);
+}
+
+// Switches the ROM window alone, the hot path games hit the most
+static void switch_rom_bank(Memory* mem, Cartridge* cart, uint16_t bank)
+{
+    cart->romBank = bank;
+    cart->bankSwitches++;
+
+    map_rom_bank(mem, cart, 0x4000, high_rom_bank(cart));
+}
+
+// Seconds the clock has counted. A day count past the 9-bit counter wraps it
+// around and sets the carry flag.
+static int64_t rtc_count(Rtc* rtc)
+{
+    int64_t now = time(NULL);
+    int64_t count = rtc->halted ? rtc->haltedCount : now - rtc->start;
+
+    if (count >= (int64_t)RTC_DAYS * SECONDS_PER_DAY)
+    {
+        rtc->carry = true;
+        count %= (int64_t)RTC_DAYS * SECONDS_PER_DAY;
+
+        if (rtc->halted) rtc->haltedCount = count;
+        else rtc->start = now - count;
+    }
+
+    return count;
+}
+
+static void rtc_latch(Rtc* rtc)
+{
+    int64_t count = rtc_count(rtc);
+    int days = count / SECONDS_PER_DAY;
+
+    rtc->latched[0] = count % 60;
+    rtc->latched[1] = count / 60 % 60;
+    rtc->latched[2] = count / 3600 % 24;
+    rtc->latched[3] = days & 0xff;
+    rtc->latched[4] = (days >> 8) | (rtc->halted << 6) | (rtc->carry << 7);
+}
+
+// Sets one of S, M, H, DL, DH, restarting the count from the new time
+static void rtc_write(Rtc* rtc, int reg, uint8_t value)
+{
+    static const uint8_t masks[5] = { 0x3f, 0x3f, 0x1f, 0xff, 0xc1 };
+
+    int64_t count = rtc_count(rtc);
+    int64_t seconds = count % 60;
+    int64_t minutes = count / 60 % 60;
+    int64_t hours = count / 3600 % 24;
+    int64_t days = count / SECONDS_PER_DAY;
+
+    value &= masks[reg];
+
+    switch (reg)
+    {
+        case 0: seconds = value; break;
+        case 1: minutes = value; break;
+        case 2: hours = value; break;
+        case 3: days = (days & 0x100) | value; break;
+        case 4:
+            days = (days & 0xff) | (value & 1) << 8;
+            rtc->carry = value & 0x80;
+            break;
+    }
+
+    count = ((days * 24 + hours) * 60 + minutes) * 60 + seconds;
+
+    bool halted = reg == 4 ? value & 0x40 : rtc->halted;
+    if (halted) rtc->haltedCount = count;
+    else rtc->start = time(NULL) - count;
+
+    rtc->halted = halted;
+    rtc->latched[reg] = value;
+}
+
+// Writes to 0x0000-0x7fff
+static void mbc_write(Memory* mem, uint16_t addr, uint8_t value)
+{
+    Cartridge* cart = mem->cart;
+
+    switch (cart->mbc)
+    {
+        case MBC_NONE:
+            return;
+
+        case MBC_1:
+            if (addr < 0x2000) cart->ramEnabled = (value & 0x0f) == 0x0a;
+            else if (addr < 0x4000)
+            {
+                switch_rom_bank(mem, cart, (value & 0x1f) ? value & 0x1f : 1);
+                return;
+            }
+            else if (addr < 0x6000) cart->bank2 = value & 0x03;
+            else cart->mode = value & 0x01;
+
+            map_banks(mem, cart);
+            return;
+
+        case MBC_2:
+            // Address bit 8 picks the register; the upper half is unused
+            if (addr >= 0x4000) return;
+
+            if (addr & 0x100) switch_rom_bank(mem, cart, (value & 0x0f) ? value & 0x0f : 1);
+            else cart->ramEnabled = (value & 0x0f) == 0x0a;
+            return;
+
+        case MBC_3:
+            if (addr < 0x2000) cart->ramEnabled = (value & 0x0f) == 0x0a;
+            else if (addr < 0x4000)
+            {
+                switch_rom_bank(mem, cart, (value & 0x7f) ? value & 0x7f : 1);
+                return;
+            }
+            else if (addr < 0x6000) cart->bank2 = value;
+            else
+            {
+                // Writing 0 then 1 copies the running clock into the registers
+                if (cart->hasRtc && cart->rtc.latchWrite == 0 && value == 1) rtc_latch(&cart->rtc);
+                cart->rtc.latchWrite = value;
+                return;
+            }
+
+            map_ram(mem, cart);
+            return;
+
+        case MBC_5:
+            if (addr < 0x2000) cart->ramEnabled = value == 0x0a;
+            else if (addr < 0x3000)
+            {
+                switch_rom_bank(mem, cart, (cart->romBank & 0x100) | value);
+                return;
+            }
+            else if (addr < 0x4000)
+            {
+                switch_rom_bank(mem, cart, (cart->romBank & 0xff) | (value & 0x01) << 8);
+                return;
+            }
+            else if (addr < 0x6000)
+            {
+                // On rumble cartridges bit 3 drives the motor instead of the RAM bank
+                if (cart->hasRumble) cart->rumble = value & 0x08;
+                cart->bank2 = value & (cart->hasRumble ? 0x07 : 0x0f);
+            }
+            else return;
+
+            map_ram(mem, cart);
+            return;
+    }
+}
+
+// 0xa000-0xbfff whenever it isn't mapped directly
+static uint8_t cart_ram_read(Memory* mem, uint16_t addr)
+{
+    Cartridge* cart = mem->cart;
+
+    if (!cart->ramEnabled) return 0xff;
+
+    // 512 half-bytes, repeated through the window
+    if (cart->mbc == MBC_2) return 0xf0 | cart->ram[addr & 0x1ff];
+
+    if (cart->mbc == MBC_3 && cart->hasRtc && cart->bank2 >= 0x08 && cart->bank2 <= 0x0c)
+    {
+        return cart->rtc.latched[cart->bank2 - 0x08];
+    }
+
+    return 0xff;
+}
+
+static void cart_ram_write(Memory* mem, uint16_t addr, uint8_t value)
+{
+    Cartridge* cart = mem->cart;
+    uint8_t* ram = selected_ram(cart);
+
+    // A clean save page
+    if (ram)
+    {
+        uint32_t offset = ram - cart->ram + (addr - 0xa000);
+
+        cart->ram[offset] = value;
+        cart->dirtyPages |= 1u << (offset / SAVE_PAGE_SIZE);
+        map_ram(mem, cart);
+        return;
+    }
+
+    if (!cart->ramEnabled) return;
+
+    if (cart->mbc == MBC_2)
+    {
+        cart->ram[addr & 0x1ff] = value & 0x0f;
+        cart->dirtyPages |= 1;
+    }
+    else if (cart->mbc == MBC_3 && cart->hasRtc && cart->bank2 >= 0x08 && cart->bank2 <= 0x0c)
+    {
+        rtc_write(&cart->rtc, cart->bank2 - 0x08, value);
+    }
+}
+
+void map_cartridge(Memory* mem, Cartridge* cart)
+{
+    mem->cart = cart;
+
+    cart->ramEnabled = false;
+    cart->romBank = 1;
+    cart->bank2 = 0;
+    cart->mode = false;
+    cart->rumble = false;
+
+    // ROM pages always have a read pointer, so only writes need a handler
+    bus_map_handlers(mem, 0x0000, 2 * ROM_BANK_SIZE, NULL, mbc_write);
+    bus_map_handlers(mem, 0xa000, RAM_BANK_SIZE, cart_ram_read, cart_ram_write);
+
+    map_banks(mem, cart);
+}
+
+void flush_save(Memory* mem)
+{
+    Cartridge* cart = mem->cart;
+    if (!cart->persistRam || !cart->dirtyPages) return;
+
+    // msync wants whole host pages, which may be bigger than ours
+    uintptr_t hostPage = sysconf(_SC_PAGESIZE);
+
+    for (int page = 0; page < 32; page++)
+    {
+        if (!(cart->dirtyPages & (1u << page))) continue;
+
+        uintptr_t start = (uintptr_t)(cart->ram + page * SAVE_PAGE_SIZE);
+        uintptr_t end = start + SAVE_PAGE_SIZE;
+        start &= ~(hostPage - 1);
+
+        msync((void*)start, end - start, MS_SYNC);
+        cart->flushedPages++;
+    }
+
+    cart->dirtyPages = 0;
+    map_ram(mem, cart);
+}
@@ -1,7 +1,69 @@
+#include <string.h>
+
 #include "memory.h"
 
+// Handlers for pages nothing has claimed: reads float high, writes are lost
+static uint8_t open_bus_read(Memory* mem, uint16_t addr)
+{
+    return 0xff;
+}
+
+static void open_bus_write(Memory* mem, uint16_t addr, uint8_t value)
+{
+}
+
 Memory* make_memory()
 {
-    Memory* mem = calloc(1, sizeof(Memory));
+    Memory* mem = malloc(sizeof(Memory));
+    init_memory(mem);
+
     return mem;
-}
\ No newline at end of file
+}
+
+void init_memory(Memory* mem)
+{
+    memset(mem, 0, sizeof(Memory));
+    map_flat(mem);
+}
+
+void map_flat(Memory* mem)
+{
+    bus_map_handlers(mem, 0, 0x10000, open_bus_read, open_bus_write);
+    bus_map(mem, 0, 0x10000, mem->ram, mem->ram);
+}
+
+void bus_map(Memory* mem, uint16_t start, uint32_t size, uint8_t* read, uint8_t* write)
+{
+    int first = start >> BUS_PAGE_SHIFT;
+    int count = size >> BUS_PAGE_SHIFT;
+
+    // Separate loops so each is a plain run of stores
+    for (int i = 0; i < count; i++) mem->readPages[first + i] = read ? read + i * BUS_PAGE_SIZE : NULL;
+    for (int i = 0; i < count; i++) mem->writePages[first + i] = write ? write + i * BUS_PAGE_SIZE : NULL;
+}
+
+void bus_map_handlers(Memory* mem, uint16_t start, uint32_t size, BusReadHandler read, BusWriteHandler write)
+{
+    for (uint32_t offset = 0; offset < size; offset += BUS_PAGE_SIZE)
+    {
+        int page = (start + offset) >> BUS_PAGE_SHIFT;
+
+        mem->readHandlers[page] = read;
+        mem->writeHandlers[page] = write;
+    }
+}
+
+uint8_t* bus_span(uint8_t* const* pages, uint16_t addr, uint32_t count)
+{
+    uint32_t first = addr >> BUS_PAGE_SHIFT;
+    uint32_t last = (addr + count - 1) >> BUS_PAGE_SHIFT;
+
+    if (!pages[first] || last >= BUS_PAGES) return NULL;
+
+    for (uint32_t page = first + 1; page <= last; page++)
+    {
+        if (pages[page] != pages[first] + ((page - first) << BUS_PAGE_SHIFT)) return NULL;
+    }
+
+    return pages[first] + (addr & (BUS_PAGE_SIZE - 1));
+}
@@ -3,9 +3,89 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+// The bus splits the address space into 256-byte pages. Each page has a base
+// pointer for reads and one for writes: where it is set the access is a plain
+// load or store, and where it is NULL the access goes to the page's handler
+// instead (I/O registers, VRAM locking, MBC control writes and so on).
+#define BUS_PAGE_SHIFT 8
+#define BUS_PAGE_SIZE (1 << BUS_PAGE_SHIFT)
+#define BUS_PAGES (0x10000 >> BUS_PAGE_SHIFT)
+
+struct Memory;
+struct Cartridge;
+struct Scheduler;
+struct Timer;
+
+typedef uint8_t (*BusReadHandler)(struct Memory* mem, uint16_t addr);
+typedef void (*BusWriteHandler)(struct Memory* mem, uint16_t addr, uint8_t value);
+
 typedef struct Memory
 {
-    uint8_t ram[0xffff];
+    // Start of each page's bytes, or NULL to use the handler. Every access
+    // reads these, so they come first and share cache lines with nothing cold.
+    uint8_t* readPages[BUS_PAGES];
+    uint8_t* writePages[BUS_PAGES];
+
+    BusReadHandler readHandlers[BUS_PAGES];
+    BusWriteHandler writeHandlers[BUS_PAGES];
+
+    // Set by map_cartridge, for the controller's handlers
+    struct Cartridge* cart;
+
+    // Set by init_scheduler, for register handlers whose peripheral has
+    // events to move
+    struct Scheduler* scheduler;
+
+    // Set by init_timer, for DIV, TIMA, TMA, TAC and IF
+    struct Timer* timer;
+
+    // Bumped by reads of registers that change with time alone, so a loop
+    // polling one is not taken for a spin that can be skipped
+    uint32_t clockedReads;
+
+    // Lowered by reads of registers that change at known cycles to the first
+    // cycle the value read can change on, so a skip stops short of it
+    uint64_t clockedUntil;
+
+    // Cycle the LCD was last switched on, which LY and VBlank count their
+    // lines from
+    uint64_t lcdOnCycle;
+
+    // Backing store for the whole address space; init_memory maps every page
+    // straight onto it
+    uint8_t ram[0x10000];
 } Memory;
 
 Memory* make_memory();
+
+// Clears mem and maps it flat, without allocating
+void init_memory(Memory* mem);
+
+// Every page straight onto ram, with the open-bus handlers behind them
+void map_flat(Memory* mem);
+
+// Point the pages covering [start, start + size) at consecutive bytes of read
+// and write. Either can be NULL to leave those accesses to the handlers.
+void bus_map(Memory* mem, uint16_t start, uint32_t size, uint8_t* read, uint8_t* write);
+void bus_map_handlers(Memory* mem, uint16_t start, uint32_t size, BusReadHandler read, BusWriteHandler write);
+
+// Host pointer to count bytes from addr if they are all mapped directly and
+// contiguously in pages (readPages or writePages), otherwise NULL
+uint8_t* bus_span(uint8_t* const* pages, uint16_t addr, uint32_t count);
+
+static inline uint8_t bus_read8(Memory* mem, uint16_t addr)
+{
+    uint8_t* page = mem->readPages[addr >> BUS_PAGE_SHIFT];
+
+    if (page) return page[addr & (BUS_PAGE_SIZE - 1)];
+
+    return mem->readHandlers[addr >> BUS_PAGE_SHIFT](mem, addr);
+}
+
+static inline void bus_write8(Memory* mem, uint16_t addr, uint8_t value)
+{
+    uint8_t* page = mem->writePages[addr >> BUS_PAGE_SHIFT];
+
+    if (page) page[addr & (BUS_PAGE_SIZE - 1)] = value;
+    else mem->writeHandlers[addr >> BUS_PAGE_SHIFT](mem, addr, value);
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "opcodes.h"
+
+#define INFO_ENTRY(op, handler, mnemonic, kind, dst, src, length, cycles, taken, flags, access, takenAccess) \
+    [op] = { mnemonic, KIND_##kind, length, cycles, taken, flags, access, takenAccess },
+#define CB_INFO_ENTRY(op, handler, mnemonic, kind, dst, src, length, cycles, taken, flags, access, takenAccess) \
+    [0x100 | op] = { mnemonic, KIND_##kind, length, cycles, taken, flags, access, takenAccess },
+
+const OpcodeInfo opcode_info[0x200] = {
+    OPCODE_TABLE(INFO_ENTRY, INFO_ENTRY)
+    CB_OPCODE_TABLE(CB_INFO_ENTRY)
+};
+
+#define CYCLES_ENTRY(op, handler, mnemonic, kind, dst, src, length, cycles, taken, ...) [op] = { cycles, taken },
+#define CB_CYCLES_ENTRY(op, handler, mnemonic, kind, dst, src, length, cycles, taken, ...) [0x100 | op] = { cycles, taken },
+
+const uint8_t opcode_cycles[0x200][2] = {
+    OPCODE_TABLE(CYCLES_ENTRY, CYCLES_ENTRY)
+    CB_OPCODE_TABLE(CB_CYCLES_ENTRY)
+};
+
+// Every access pattern has one character per M-cycle
+#define CHECK_ENTRY(op, handler, mnemonic, kind, dst, src, length, cycles, taken, flags, access, takenAccess) \
+    _Static_assert(sizeof(access) - 1 == cycles && sizeof(takenAccess) - 1 == taken, mnemonic ": access pattern and cycles disagree");
+
+OPCODE_TABLE(CHECK_ENTRY, CHECK_ENTRY)
+CB_OPCODE_TABLE(CHECK_ENTRY)
+
+// Table entry of the instruction at addr, following the CB prefix
+const OpcodeInfo* opcode_at(Memory* mem, uint16_t addr)
+{
+    uint8_t inst = bus_read8(mem, addr);
+
+    if (inst == 0xcb) return &opcode_info[0x100 | bus_read8(mem, addr + 1)];
+
+    return &opcode_info[inst];
+}
+
+// Writes the instruction at addr into buf with its immediate operand filled in
+// and returns the instruction length
+int disassemble(Memory* mem, uint16_t addr, char* buf, int size)
+{
+    const OpcodeInfo* info = opcode_at(mem, addr);
+
+    uint8_t lo = bus_read8(mem, addr + 1);
+    uint8_t hi = bus_read8(mem, addr + 2);
+
+    const char* placeholders[] = { "d16", "a16", "d8", "a8", "s8" };
+    const char* match = NULL;
+    int placeholderIndex;
+
+    for (placeholderIndex = 0; placeholderIndex < 5; placeholderIndex++)
+    {
+        match = strstr(info->mnemonic, placeholders[placeholderIndex]);
+        if (match) break;
+    }
+
+    if (!match)
+    {
+        snprintf(buf, size, "%s", info->mnemonic);
+        return info->length;
+    }
+
+    char operand[8];
+    switch (placeholderIndex)
+    {
+        case 0:
+        case 1:
+            snprintf(operand, sizeof(operand), "$%04x", lo | (hi << 8));
+            break;
+        case 2:
+            snprintf(operand, sizeof(operand), "$%02x", lo);
+            break;
+        case 3:
+            snprintf(operand, sizeof(operand), "$ff%02x", lo);
+            break;
+        default:
+            // Relative jumps are shown as their target, SP offsets as a signed value
+            if (info->mnemonic[0] == 'J') snprintf(operand, sizeof(operand), "$%04x", (uint16_t)(addr + 2 + (int8_t)lo));
+            else snprintf(operand, sizeof(operand), "%d", (int8_t)lo);
+            break;
+    }
+
+    int prefixLength = match - info->mnemonic;
+    snprintf(buf, size, "%.*s%s%s", prefixLength, info->mnemonic, operand, match + strlen(placeholders[placeholderIndex]));
+
+    return info->length;
+}
+
+// Whether control can leave the straight-line instruction sequence after this
+// instruction (jumps, calls, returns and the CPU state changes)
+bool opcode_ends_block(const OpcodeInfo* info)
+{
+    switch (info->kind)
+    {
+        case KIND_JR:
+        case KIND_JP:
+        case KIND_JP_HL:
+        case KIND_CALL:
+        case KIND_RET:
+        case KIND_RETI:
+        case KIND_RST:
+        case KIND_HALT:
+        case KIND_STOP:
+        case KIND_DI:
+        case KIND_EI:
+            return true;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,577 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memory.h"
+
+// Declarative description of every SM83 opcode. Both the generic handlers in
+// cpu.c and the specialized core are generated from these tables, as are the
+// timing and disassembly metadata in opcode_info.
+//
+// Columns: X(opcode, handler, mnemonic, kind, dst, src, length, cycles, taken, flags, access, takenAccess)
+//   handler  - generic handler in cpu.c that decodes its operands at runtime
+//   kind     - operation used to emit the specialized handler (EXEC_<kind>)
+//   dst/src  - operand tokens: B C D E H L A, HLI = (HL), HLIP/HLIM = (HL+)/(HL-),
+//              BCI/DEI = (BC)/(DE), CI = (FF00+C), D8 D16 A8 A16 S8 immediates,
+//              BC DE HL SP AF register pairs, NZ Z NC C ALWAYS conditions
+//   length   - instruction length in bytes (CB entries include the prefix)
+//   cycles   - M-cycles, or M-cycles when a branch is not taken
+//   taken    - M-cycles when a branch is taken
+//   flags    - Z N H C effects: letter = computed, 0/1 = forced, - = unchanged
+//   access   - bus activity per M-cycle when a branch is not taken: r = read,
+//              w = write, - = internal. Listed like the "cycles" arrays of
+//              GameboyCPUTests: operand and data accesses, then the fetch of
+//              the next opcode, which takes the last M-cycle
+//   takenAccess - the same when a branch is taken
+// P marks the 0xcb prefix so dispatchers can treat it specially.
+#define OPCODE_TABLE(X, P) \
+    X(0x00, noop,        "NOP",         NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0x01, ld_16,       "LD BC,d16",   LD16,    BC,     D16,  3, 3, 3, "----", "rrr",    "rrr") \
+    X(0x02, ld_a16,      "LD (BC),A",   LD,      BCI,    A,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x03, inc_16,      "INC BC",      INC16,   BC,     NONE, 1, 2, 2, "----", "-r",     "-r") \
+    X(0x04, inc_8,       "INC B",       INC,     B,      NONE, 1, 1, 1, "Z0H-", "r",      "r") \
+    X(0x05, dec_8,       "DEC B",       DEC,     B,      NONE, 1, 1, 1, "Z1H-", "r",      "r") \
+    X(0x06, ld_8_d8,     "LD B,d8",     LD,      B,      D8,   2, 2, 2, "----", "rr",     "rr") \
+    X(0x07, rlca,        "RLCA",        GENERIC, NONE,   NONE, 1, 1, 1, "000C", "r",      "r") \
+    X(0x08, ld_a16_sp,   "LD (a16),SP", GENERIC, NONE,   NONE, 3, 5, 5, "----", "rrwwr",  "rrwwr") \
+    X(0x09, add_hl,      "ADD HL,BC",   ADD_HL,  HL,     BC,   1, 2, 2, "-0HC", "-r",     "-r") \
+    X(0x0a, ld_a_a16,    "LD A,(BC)",   LD,      A,      BCI,  1, 2, 2, "----", "rr",     "rr") \
+    X(0x0b, dec_16,      "DEC BC",      DEC16,   BC,     NONE, 1, 2, 2, "----", "-r",     "-r") \
+    X(0x0c, inc_8,       "INC C",       INC,     C,      NONE, 1, 1, 1, "Z0H-", "r",      "r") \
+    X(0x0d, dec_8,       "DEC C",       DEC,     C,      NONE, 1, 1, 1, "Z1H-", "r",      "r") \
+    X(0x0e, ld_8_d8,     "LD C,d8",     LD,      C,      D8,   2, 2, 2, "----", "rr",     "rr") \
+    X(0x0f, rrca,        "RRCA",        GENERIC, NONE,   NONE, 1, 1, 1, "000C", "r",      "r") \
+    X(0x10, stop,        "STOP",        STOP,    NONE,   NONE, 2, 1, 1, "----", "r",      "r") \
+    X(0x11, ld_16,       "LD DE,d16",   LD16,    DE,     D16,  3, 3, 3, "----", "rrr",    "rrr") \
+    X(0x12, ld_a16,      "LD (DE),A",   LD,      DEI,    A,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x13, inc_16,      "INC DE",      INC16,   DE,     NONE, 1, 2, 2, "----", "-r",     "-r") \
+    X(0x14, inc_8,       "INC D",       INC,     D,      NONE, 1, 1, 1, "Z0H-", "r",      "r") \
+    X(0x15, dec_8,       "DEC D",       DEC,     D,      NONE, 1, 1, 1, "Z1H-", "r",      "r") \
+    X(0x16, ld_8_d8,     "LD D,d8",     LD,      D,      D8,   2, 2, 2, "----", "rr",     "rr") \
+    X(0x17, rla,         "RLA",         GENERIC, NONE,   NONE, 1, 1, 1, "000C", "r",      "r") \
+    X(0x18, jr,          "JR s8",       JR,      ALWAYS, S8,   2, 3, 3, "----", "r-r",    "r-r") \
+    X(0x19, add_hl,      "ADD HL,DE",   ADD_HL,  HL,     DE,   1, 2, 2, "-0HC", "-r",     "-r") \
+    X(0x1a, ld_a_a16,    "LD A,(DE)",   LD,      A,      DEI,  1, 2, 2, "----", "rr",     "rr") \
+    X(0x1b, dec_16,      "DEC DE",      DEC16,   DE,     NONE, 1, 2, 2, "----", "-r",     "-r") \
+    X(0x1c, inc_8,       "INC E",       INC,     E,      NONE, 1, 1, 1, "Z0H-", "r",      "r") \
+    X(0x1d, dec_8,       "DEC E",       DEC,     E,      NONE, 1, 1, 1, "Z1H-", "r",      "r") \
+    X(0x1e, ld_8_d8,     "LD E,d8",     LD,      E,      D8,   2, 2, 2, "----", "rr",     "rr") \
+    X(0x1f, rra,         "RRA",         GENERIC, NONE,   NONE, 1, 1, 1, "000C", "r",      "r") \
+    X(0x20, jr_8,        "JR NZ,s8",    JR,      NZ,     S8,   2, 2, 3, "----", "rr",     "r-r") \
+    X(0x21, ld_16,       "LD HL,d16",   LD16,    HL,     D16,  3, 3, 3, "----", "rrr",    "rrr") \
+    X(0x22, ld_a16,      "LD (HL+),A",  LD,      HLIP,   A,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x23, inc_16,      "INC HL",      INC16,   HL,     NONE, 1, 2, 2, "----", "-r",     "-r") \
+    X(0x24, inc_8,       "INC H",       INC,     H,      NONE, 1, 1, 1, "Z0H-", "r",      "r") \
+    X(0x25, dec_8,       "DEC H",       DEC,     H,      NONE, 1, 1, 1, "Z1H-", "r",      "r") \
+    X(0x26, ld_8_d8,     "LD H,d8",     LD,      H,      D8,   2, 2, 2, "----", "rr",     "rr") \
+    X(0x27, daa,         "DAA",         GENERIC, NONE,   NONE, 1, 1, 1, "Z-0C", "r",      "r") \
+    X(0x28, jr_8,        "JR Z,s8",     JR,      Z,      S8,   2, 2, 3, "----", "rr",     "r-r") \
+    X(0x29, add_hl,      "ADD HL,HL",   ADD_HL,  HL,     HL,   1, 2, 2, "-0HC", "-r",     "-r") \
+    X(0x2a, ld_a_a16,    "LD A,(HL+)",  LD,      A,      HLIP, 1, 2, 2, "----", "rr",     "rr") \
+    X(0x2b, dec_16,      "DEC HL",      DEC16,   HL,     NONE, 1, 2, 2, "----", "-r",     "-r") \
+    X(0x2c, inc_8,       "INC L",       INC,     L,      NONE, 1, 1, 1, "Z0H-", "r",      "r") \
+    X(0x2d, dec_8,       "DEC L",       DEC,     L,      NONE, 1, 1, 1, "Z1H-", "r",      "r") \
+    X(0x2e, ld_8_d8,     "LD L,d8",     LD,      L,      D8,   2, 2, 2, "----", "rr",     "rr") \
+    X(0x2f, cpl,         "CPL",         GENERIC, NONE,   NONE, 1, 1, 1, "-11-", "r",      "r") \
+    X(0x30, jr_8,        "JR NC,s8",    JR,      NC,     S8,   2, 2, 3, "----", "rr",     "r-r") \
+    X(0x31, ld_16,       "LD SP,d16",   LD16,    SP,     D16,  3, 3, 3, "----", "rrr",    "rrr") \
+    X(0x32, ld_a16,      "LD (HL-),A",  LD,      HLIM,   A,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x33, inc_16,      "INC SP",      INC16,   SP,     NONE, 1, 2, 2, "----", "-r",     "-r") \
+    X(0x34, inc_8,       "INC (HL)",    INC,     HLI,    NONE, 1, 3, 3, "Z0H-", "rwr",    "rwr") \
+    X(0x35, dec_8,       "DEC (HL)",    DEC,     HLI,    NONE, 1, 3, 3, "Z1H-", "rwr",    "rwr") \
+    X(0x36, ld_8_d8,     "LD (HL),d8",  LD,      HLI,    D8,   2, 3, 3, "----", "rwr",    "rwr") \
+    X(0x37, scf,         "SCF",         GENERIC, NONE,   NONE, 1, 1, 1, "-001", "r",      "r") \
+    X(0x38, jr_8,        "JR C,s8",     JR,      C,      S8,   2, 2, 3, "----", "rr",     "r-r") \
+    X(0x39, add_hl,      "ADD HL,SP",   ADD_HL,  HL,     SP,   1, 2, 2, "-0HC", "-r",     "-r") \
+    X(0x3a, ld_a_a16,    "LD A,(HL-)",  LD,      A,      HLIM, 1, 2, 2, "----", "rr",     "rr") \
+    X(0x3b, dec_16,      "DEC SP",      DEC16,   SP,     NONE, 1, 2, 2, "----", "-r",     "-r") \
+    X(0x3c, inc_8,       "INC A",       INC,     A,      NONE, 1, 1, 1, "Z0H-", "r",      "r") \
+    X(0x3d, dec_8,       "DEC A",       DEC,     A,      NONE, 1, 1, 1, "Z1H-", "r",      "r") \
+    X(0x3e, ld_8_d8,     "LD A,d8",     LD,      A,      D8,   2, 2, 2, "----", "rr",     "rr") \
+    X(0x3f, ccf,         "CCF",         GENERIC, NONE,   NONE, 1, 1, 1, "-00C", "r",      "r") \
+    X(0x40, ld_8,        "LD B,B",      LD,      B,      B,    1, 1, 1, "----", "r",      "r") \
+    X(0x41, ld_8,        "LD B,C",      LD,      B,      C,    1, 1, 1, "----", "r",      "r") \
+    X(0x42, ld_8,        "LD B,D",      LD,      B,      D,    1, 1, 1, "----", "r",      "r") \
+    X(0x43, ld_8,        "LD B,E",      LD,      B,      E,    1, 1, 1, "----", "r",      "r") \
+    X(0x44, ld_8,        "LD B,H",      LD,      B,      H,    1, 1, 1, "----", "r",      "r") \
+    X(0x45, ld_8,        "LD B,L",      LD,      B,      L,    1, 1, 1, "----", "r",      "r") \
+    X(0x46, ld_8,        "LD B,(HL)",   LD,      B,      HLI,  1, 2, 2, "----", "rr",     "rr") \
+    X(0x47, ld_8,        "LD B,A",      LD,      B,      A,    1, 1, 1, "----", "r",      "r") \
+    X(0x48, ld_8,        "LD C,B",      LD,      C,      B,    1, 1, 1, "----", "r",      "r") \
+    X(0x49, ld_8,        "LD C,C",      LD,      C,      C,    1, 1, 1, "----", "r",      "r") \
+    X(0x4a, ld_8,        "LD C,D",      LD,      C,      D,    1, 1, 1, "----", "r",      "r") \
+    X(0x4b, ld_8,        "LD C,E",      LD,      C,      E,    1, 1, 1, "----", "r",      "r") \
+    X(0x4c, ld_8,        "LD C,H",      LD,      C,      H,    1, 1, 1, "----", "r",      "r") \
+    X(0x4d, ld_8,        "LD C,L",      LD,      C,      L,    1, 1, 1, "----", "r",      "r") \
+    X(0x4e, ld_8,        "LD C,(HL)",   LD,      C,      HLI,  1, 2, 2, "----", "rr",     "rr") \
+    X(0x4f, ld_8,        "LD C,A",      LD,      C,      A,    1, 1, 1, "----", "r",      "r") \
+    X(0x50, ld_8,        "LD D,B",      LD,      D,      B,    1, 1, 1, "----", "r",      "r") \
+    X(0x51, ld_8,        "LD D,C",      LD,      D,      C,    1, 1, 1, "----", "r",      "r") \
+    X(0x52, ld_8,        "LD D,D",      LD,      D,      D,    1, 1, 1, "----", "r",      "r") \
+    X(0x53, ld_8,        "LD D,E",      LD,      D,      E,    1, 1, 1, "----", "r",      "r") \
+    X(0x54, ld_8,        "LD D,H",      LD,      D,      H,    1, 1, 1, "----", "r",      "r") \
+    X(0x55, ld_8,        "LD D,L",      LD,      D,      L,    1, 1, 1, "----", "r",      "r") \
+    X(0x56, ld_8,        "LD D,(HL)",   LD,      D,      HLI,  1, 2, 2, "----", "rr",     "rr") \
+    X(0x57, ld_8,        "LD D,A",      LD,      D,      A,    1, 1, 1, "----", "r",      "r") \
+    X(0x58, ld_8,        "LD E,B",      LD,      E,      B,    1, 1, 1, "----", "r",      "r") \
+    X(0x59, ld_8,        "LD E,C",      LD,      E,      C,    1, 1, 1, "----", "r",      "r") \
+    X(0x5a, ld_8,        "LD E,D",      LD,      E,      D,    1, 1, 1, "----", "r",      "r") \
+    X(0x5b, ld_8,        "LD E,E",      LD,      E,      E,    1, 1, 1, "----", "r",      "r") \
+    X(0x5c, ld_8,        "LD E,H",      LD,      E,      H,    1, 1, 1, "----", "r",      "r") \
+    X(0x5d, ld_8,        "LD E,L",      LD,      E,      L,    1, 1, 1, "----", "r",      "r") \
+    X(0x5e, ld_8,        "LD E,(HL)",   LD,      E,      HLI,  1, 2, 2, "----", "rr",     "rr") \
+    X(0x5f, ld_8,        "LD E,A",      LD,      E,      A,    1, 1, 1, "----", "r",      "r") \
+    X(0x60, ld_8,        "LD H,B",      LD,      H,      B,    1, 1, 1, "----", "r",      "r") \
+    X(0x61, ld_8,        "LD H,C",      LD,      H,      C,    1, 1, 1, "----", "r",      "r") \
+    X(0x62, ld_8,        "LD H,D",      LD,      H,      D,    1, 1, 1, "----", "r",      "r") \
+    X(0x63, ld_8,        "LD H,E",      LD,      H,      E,    1, 1, 1, "----", "r",      "r") \
+    X(0x64, ld_8,        "LD H,H",      LD,      H,      H,    1, 1, 1, "----", "r",      "r") \
+    X(0x65, ld_8,        "LD H,L",      LD,      H,      L,    1, 1, 1, "----", "r",      "r") \
+    X(0x66, ld_8,        "LD H,(HL)",   LD,      H,      HLI,  1, 2, 2, "----", "rr",     "rr") \
+    X(0x67, ld_8,        "LD H,A",      LD,      H,      A,    1, 1, 1, "----", "r",      "r") \
+    X(0x68, ld_8,        "LD L,B",      LD,      L,      B,    1, 1, 1, "----", "r",      "r") \
+    X(0x69, ld_8,        "LD L,C",      LD,      L,      C,    1, 1, 1, "----", "r",      "r") \
+    X(0x6a, ld_8,        "LD L,D",      LD,      L,      D,    1, 1, 1, "----", "r",      "r") \
+    X(0x6b, ld_8,        "LD L,E",      LD,      L,      E,    1, 1, 1, "----", "r",      "r") \
+    X(0x6c, ld_8,        "LD L,H",      LD,      L,      H,    1, 1, 1, "----", "r",      "r") \
+    X(0x6d, ld_8,        "LD L,L",      LD,      L,      L,    1, 1, 1, "----", "r",      "r") \
+    X(0x6e, ld_8,        "LD L,(HL)",   LD,      L,      HLI,  1, 2, 2, "----", "rr",     "rr") \
+    X(0x6f, ld_8,        "LD L,A",      LD,      L,      A,    1, 1, 1, "----", "r",      "r") \
+    X(0x70, ld_8,        "LD (HL),B",   LD,      HLI,    B,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x71, ld_8,        "LD (HL),C",   LD,      HLI,    C,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x72, ld_8,        "LD (HL),D",   LD,      HLI,    D,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x73, ld_8,        "LD (HL),E",   LD,      HLI,    E,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x74, ld_8,        "LD (HL),H",   LD,      HLI,    H,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x75, ld_8,        "LD (HL),L",   LD,      HLI,    L,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x76, halt,        "HALT",        HALT,    NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0x77, ld_8,        "LD (HL),A",   LD,      HLI,    A,    1, 2, 2, "----", "wr",     "wr") \
+    X(0x78, ld_8,        "LD A,B",      LD,      A,      B,    1, 1, 1, "----", "r",      "r") \
+    X(0x79, ld_8,        "LD A,C",      LD,      A,      C,    1, 1, 1, "----", "r",      "r") \
+    X(0x7a, ld_8,        "LD A,D",      LD,      A,      D,    1, 1, 1, "----", "r",      "r") \
+    X(0x7b, ld_8,        "LD A,E",      LD,      A,      E,    1, 1, 1, "----", "r",      "r") \
+    X(0x7c, ld_8,        "LD A,H",      LD,      A,      H,    1, 1, 1, "----", "r",      "r") \
+    X(0x7d, ld_8,        "LD A,L",      LD,      A,      L,    1, 1, 1, "----", "r",      "r") \
+    X(0x7e, ld_8,        "LD A,(HL)",   LD,      A,      HLI,  1, 2, 2, "----", "rr",     "rr") \
+    X(0x7f, ld_8,        "LD A,A",      LD,      A,      A,    1, 1, 1, "----", "r",      "r") \
+    X(0x80, add_8,       "ADD A,B",     ADD,     A,      B,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x81, add_8,       "ADD A,C",     ADD,     A,      C,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x82, add_8,       "ADD A,D",     ADD,     A,      D,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x83, add_8,       "ADD A,E",     ADD,     A,      E,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x84, add_8,       "ADD A,H",     ADD,     A,      H,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x85, add_8,       "ADD A,L",     ADD,     A,      L,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x86, add_8,       "ADD A,(HL)",  ADD,     A,      HLI,  1, 2, 2, "Z0HC", "rr",     "rr") \
+    X(0x87, add_8,       "ADD A,A",     ADD,     A,      A,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x88, adc_8,       "ADC A,B",     ADC,     A,      B,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x89, adc_8,       "ADC A,C",     ADC,     A,      C,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x8a, adc_8,       "ADC A,D",     ADC,     A,      D,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x8b, adc_8,       "ADC A,E",     ADC,     A,      E,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x8c, adc_8,       "ADC A,H",     ADC,     A,      H,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x8d, adc_8,       "ADC A,L",     ADC,     A,      L,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x8e, adc_8,       "ADC A,(HL)",  ADC,     A,      HLI,  1, 2, 2, "Z0HC", "rr",     "rr") \
+    X(0x8f, adc_8,       "ADC A,A",     ADC,     A,      A,    1, 1, 1, "Z0HC", "r",      "r") \
+    X(0x90, sub_8,       "SUB A,B",     SUB,     A,      B,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x91, sub_8,       "SUB A,C",     SUB,     A,      C,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x92, sub_8,       "SUB A,D",     SUB,     A,      D,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x93, sub_8,       "SUB A,E",     SUB,     A,      E,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x94, sub_8,       "SUB A,H",     SUB,     A,      H,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x95, sub_8,       "SUB A,L",     SUB,     A,      L,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x96, sub_8,       "SUB A,(HL)",  SUB,     A,      HLI,  1, 2, 2, "Z1HC", "rr",     "rr") \
+    X(0x97, sub_8,       "SUB A,A",     SUB,     A,      A,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x98, sbc_8,       "SBC A,B",     SBC,     A,      B,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x99, sbc_8,       "SBC A,C",     SBC,     A,      C,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x9a, sbc_8,       "SBC A,D",     SBC,     A,      D,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x9b, sbc_8,       "SBC A,E",     SBC,     A,      E,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x9c, sbc_8,       "SBC A,H",     SBC,     A,      H,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x9d, sbc_8,       "SBC A,L",     SBC,     A,      L,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0x9e, sbc_8,       "SBC A,(HL)",  SBC,     A,      HLI,  1, 2, 2, "Z1HC", "rr",     "rr") \
+    X(0x9f, sbc_8,       "SBC A,A",     SBC,     A,      A,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0xa0, and_8,       "AND A,B",     AND,     A,      B,    1, 1, 1, "Z010", "r",      "r") \
+    X(0xa1, and_8,       "AND A,C",     AND,     A,      C,    1, 1, 1, "Z010", "r",      "r") \
+    X(0xa2, and_8,       "AND A,D",     AND,     A,      D,    1, 1, 1, "Z010", "r",      "r") \
+    X(0xa3, and_8,       "AND A,E",     AND,     A,      E,    1, 1, 1, "Z010", "r",      "r") \
+    X(0xa4, and_8,       "AND A,H",     AND,     A,      H,    1, 1, 1, "Z010", "r",      "r") \
+    X(0xa5, and_8,       "AND A,L",     AND,     A,      L,    1, 1, 1, "Z010", "r",      "r") \
+    X(0xa6, and_8,       "AND A,(HL)",  AND,     A,      HLI,  1, 2, 2, "Z010", "rr",     "rr") \
+    X(0xa7, and_8,       "AND A,A",     AND,     A,      A,    1, 1, 1, "Z010", "r",      "r") \
+    X(0xa8, xor_8,       "XOR A,B",     XOR,     A,      B,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xa9, xor_8,       "XOR A,C",     XOR,     A,      C,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xaa, xor_8,       "XOR A,D",     XOR,     A,      D,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xab, xor_8,       "XOR A,E",     XOR,     A,      E,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xac, xor_8,       "XOR A,H",     XOR,     A,      H,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xad, xor_8,       "XOR A,L",     XOR,     A,      L,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xae, xor_8,       "XOR A,(HL)",  XOR,     A,      HLI,  1, 2, 2, "Z000", "rr",     "rr") \
+    X(0xaf, xor_8,       "XOR A,A",     XOR,     A,      A,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xb0, or_8,        "OR A,B",      OR,      A,      B,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xb1, or_8,        "OR A,C",      OR,      A,      C,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xb2, or_8,        "OR A,D",      OR,      A,      D,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xb3, or_8,        "OR A,E",      OR,      A,      E,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xb4, or_8,        "OR A,H",      OR,      A,      H,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xb5, or_8,        "OR A,L",      OR,      A,      L,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xb6, or_8,        "OR A,(HL)",   OR,      A,      HLI,  1, 2, 2, "Z000", "rr",     "rr") \
+    X(0xb7, or_8,        "OR A,A",      OR,      A,      A,    1, 1, 1, "Z000", "r",      "r") \
+    X(0xb8, cp_8,        "CP A,B",      CP,      A,      B,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0xb9, cp_8,        "CP A,C",      CP,      A,      C,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0xba, cp_8,        "CP A,D",      CP,      A,      D,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0xbb, cp_8,        "CP A,E",      CP,      A,      E,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0xbc, cp_8,        "CP A,H",      CP,      A,      H,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0xbd, cp_8,        "CP A,L",      CP,      A,      L,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0xbe, cp_8,        "CP A,(HL)",   CP,      A,      HLI,  1, 2, 2, "Z1HC", "rr",     "rr") \
+    X(0xbf, cp_8,        "CP A,A",      CP,      A,      A,    1, 1, 1, "Z1HC", "r",      "r") \
+    X(0xc0, ret_8,       "RET NZ",      RET,     NZ,     NONE, 1, 2, 5, "----", "-r",     "-rr-r") \
+    X(0xc1, pop,         "POP BC",      POP,     BC,     NONE, 1, 3, 3, "----", "rrr",    "rrr") \
+    X(0xc2, jp_16,       "JP NZ,a16",   JP,      NZ,     A16,  3, 3, 4, "----", "rrr",    "rr-r") \
+    X(0xc3, jp,          "JP a16",      JP,      ALWAYS, A16,  3, 4, 4, "----", "rr-r",   "rr-r") \
+    X(0xc4, call_16,     "CALL NZ,a16", CALL,    NZ,     A16,  3, 3, 6, "----", "rrr",    "rr-wwr") \
+    X(0xc5, push,        "PUSH BC",     PUSH,    NONE,   BC,   1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xc6, add_d8,      "ADD A,d8",    ADD,     A,      D8,   2, 2, 2, "Z0HC", "rr",     "rr") \
+    X(0xc7, rst,         "RST 00H",     RST,     0x00,   NONE, 1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xc8, ret_8,       "RET Z",       RET,     Z,      NONE, 1, 2, 5, "----", "-r",     "-rr-r") \
+    X(0xc9, ret,         "RET",         RET,     ALWAYS, NONE, 1, 4, 4, "----", "rr-r",   "rr-r") \
+    X(0xca, jp_16,       "JP Z,a16",    JP,      Z,      A16,  3, 3, 4, "----", "rrr",    "rr-r") \
+    P(0xcb, cb,          "PREFIX CB",   PREFIX,  NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xcc, call_16,     "CALL Z,a16",  CALL,    Z,      A16,  3, 3, 6, "----", "rrr",    "rr-wwr") \
+    X(0xcd, call,        "CALL a16",    CALL,    ALWAYS, A16,  3, 6, 6, "----", "rr-wwr", "rr-wwr") \
+    X(0xce, adc_d8,      "ADC A,d8",    ADC,     A,      D8,   2, 2, 2, "Z0HC", "rr",     "rr") \
+    X(0xcf, rst,         "RST 08H",     RST,     0x08,   NONE, 1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xd0, ret_8,       "RET NC",      RET,     NC,     NONE, 1, 2, 5, "----", "-r",     "-rr-r") \
+    X(0xd1, pop,         "POP DE",      POP,     DE,     NONE, 1, 3, 3, "----", "rrr",    "rrr") \
+    X(0xd2, jp_16,       "JP NC,a16",   JP,      NC,     A16,  3, 3, 4, "----", "rrr",    "rr-r") \
+    X(0xd3, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xd4, call_16,     "CALL NC,a16", CALL,    NC,     A16,  3, 3, 6, "----", "rrr",    "rr-wwr") \
+    X(0xd5, push,        "PUSH DE",     PUSH,    NONE,   DE,   1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xd6, sub_d8,      "SUB A,d8",    SUB,     A,      D8,   2, 2, 2, "Z1HC", "rr",     "rr") \
+    X(0xd7, rst,         "RST 10H",     RST,     0x10,   NONE, 1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xd8, ret_8,       "RET C",       RET,     C,      NONE, 1, 2, 5, "----", "-r",     "-rr-r") \
+    X(0xd9, reti,        "RETI",        RETI,    NONE,   NONE, 1, 4, 4, "----", "rr-r",   "rr-r") \
+    X(0xda, jp_16,       "JP C,a16",    JP,      C,      A16,  3, 3, 4, "----", "rrr",    "rr-r") \
+    X(0xdb, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xdc, call_16,     "CALL C,a16",  CALL,    C,      A16,  3, 3, 6, "----", "rrr",    "rr-wwr") \
+    X(0xdd, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xde, sbc_d8,      "SBC A,d8",    SBC,     A,      D8,   2, 2, 2, "Z1HC", "rr",     "rr") \
+    X(0xdf, rst,         "RST 18H",     RST,     0x18,   NONE, 1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xe0, ld_a_8,      "LDH (a8),A",  LD,      A8,     A,    2, 3, 3, "----", "rwr",    "rwr") \
+    X(0xe1, pop,         "POP HL",      POP,     HL,     NONE, 1, 3, 3, "----", "rrr",    "rrr") \
+    X(0xe2, ld_a_c,      "LD (C),A",    LD,      CI,     A,    1, 2, 2, "----", "wr",     "wr") \
+    X(0xe3, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xe4, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xe5, push,        "PUSH HL",     PUSH,    NONE,   HL,   1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xe6, and_d8,      "AND A,d8",    AND,     A,      D8,   2, 2, 2, "Z010", "rr",     "rr") \
+    X(0xe7, rst,         "RST 20H",     RST,     0x20,   NONE, 1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xe8, add_s8,      "ADD SP,s8",   GENERIC, NONE,   NONE, 2, 4, 4, "00HC", "r--r",   "r--r") \
+    X(0xe9, jp_hl,       "JP HL",       JP_HL,   NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xea, ld_a_16,     "LD (a16),A",  LD,      A16,    A,    3, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xeb, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xec, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xed, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xee, xor_d8,      "XOR A,d8",    XOR,     A,      D8,   2, 2, 2, "Z000", "rr",     "rr") \
+    X(0xef, rst,         "RST 28H",     RST,     0x28,   NONE, 1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xf0, ld_a_8,      "LDH A,(a8)",  LD,      A,      A8,   2, 3, 3, "----", "rrr",    "rrr") \
+    X(0xf1, pop,         "POP AF",      POP,     AF,     NONE, 1, 3, 3, "ZNHC", "rrr",    "rrr") \
+    X(0xf2, ld_a_c,      "LD A,(C)",    LD,      A,      CI,   1, 2, 2, "----", "rr",     "rr") \
+    X(0xf3, di,          "DI",          DI,      NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xf4, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xf5, push,        "PUSH AF",     PUSH,    NONE,   AF,   1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xf6, or_d8,       "OR A,d8",     OR,      A,      D8,   2, 2, 2, "Z000", "rr",     "rr") \
+    X(0xf7, rst,         "RST 30H",     RST,     0x30,   NONE, 1, 4, 4, "----", "-wwr",   "-wwr") \
+    X(0xf8, ld_hl_sp_s8, "LD HL,SP+s8", GENERIC, NONE,   NONE, 2, 3, 3, "00HC", "r-r",    "r-r") \
+    X(0xf9, ld_sp_hl,    "LD SP,HL",    LD16,    SP,     HL,   1, 2, 2, "----", "-r",     "-r") \
+    X(0xfa, ld_a_16,     "LD A,(a16)",  LD,      A,      A16,  3, 4, 4, "----", "rrrr",   "rrrr") \
+    X(0xfb, ei,          "EI",          EI,      NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xfc, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xfd, noop,        "ILLEGAL",     NOP,     NONE,   NONE, 1, 1, 1, "----", "r",      "r") \
+    X(0xfe, cp_d8,       "CP A,d8",     CP,      A,      D8,   2, 2, 2, "Z1HC", "rr",     "rr") \
+    X(0xff, rst,         "RST 38H",     RST,     0x38,   NONE, 1, 4, 4, "----", "-wwr",   "-wwr")
+
+#define CB_OPCODE_TABLE(X) \
+    X(0x00, rlc,  "RLC B",      RLC,  B,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x01, rlc,  "RLC C",      RLC,  C,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x02, rlc,  "RLC D",      RLC,  D,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x03, rlc,  "RLC E",      RLC,  E,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x04, rlc,  "RLC H",      RLC,  H,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x05, rlc,  "RLC L",      RLC,  L,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x06, rlc,  "RLC (HL)",   RLC,  HLI, NONE, 2, 4, 4, "Z00C", "rrwr",   "rrwr") \
+    X(0x07, rlc,  "RLC A",      RLC,  A,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x08, rrc,  "RRC B",      RRC,  B,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x09, rrc,  "RRC C",      RRC,  C,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x0a, rrc,  "RRC D",      RRC,  D,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x0b, rrc,  "RRC E",      RRC,  E,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x0c, rrc,  "RRC H",      RRC,  H,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x0d, rrc,  "RRC L",      RRC,  L,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x0e, rrc,  "RRC (HL)",   RRC,  HLI, NONE, 2, 4, 4, "Z00C", "rrwr",   "rrwr") \
+    X(0x0f, rrc,  "RRC A",      RRC,  A,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x10, rl,   "RL B",       RL,   B,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x11, rl,   "RL C",       RL,   C,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x12, rl,   "RL D",       RL,   D,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x13, rl,   "RL E",       RL,   E,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x14, rl,   "RL H",       RL,   H,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x15, rl,   "RL L",       RL,   L,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x16, rl,   "RL (HL)",    RL,   HLI, NONE, 2, 4, 4, "Z00C", "rrwr",   "rrwr") \
+    X(0x17, rl,   "RL A",       RL,   A,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x18, rr,   "RR B",       RR,   B,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x19, rr,   "RR C",       RR,   C,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x1a, rr,   "RR D",       RR,   D,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x1b, rr,   "RR E",       RR,   E,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x1c, rr,   "RR H",       RR,   H,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x1d, rr,   "RR L",       RR,   L,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x1e, rr,   "RR (HL)",    RR,   HLI, NONE, 2, 4, 4, "Z00C", "rrwr",   "rrwr") \
+    X(0x1f, rr,   "RR A",       RR,   A,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x20, sla,  "SLA B",      SLA,  B,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x21, sla,  "SLA C",      SLA,  C,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x22, sla,  "SLA D",      SLA,  D,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x23, sla,  "SLA E",      SLA,  E,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x24, sla,  "SLA H",      SLA,  H,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x25, sla,  "SLA L",      SLA,  L,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x26, sla,  "SLA (HL)",   SLA,  HLI, NONE, 2, 4, 4, "Z00C", "rrwr",   "rrwr") \
+    X(0x27, sla,  "SLA A",      SLA,  A,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x28, sra,  "SRA B",      SRA,  B,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x29, sra,  "SRA C",      SRA,  C,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x2a, sra,  "SRA D",      SRA,  D,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x2b, sra,  "SRA E",      SRA,  E,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x2c, sra,  "SRA H",      SRA,  H,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x2d, sra,  "SRA L",      SRA,  L,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x2e, sra,  "SRA (HL)",   SRA,  HLI, NONE, 2, 4, 4, "Z00C", "rrwr",   "rrwr") \
+    X(0x2f, sra,  "SRA A",      SRA,  A,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x30, swap, "SWAP B",     SWAP, B,   NONE, 2, 2, 2, "Z000", "rr",     "rr") \
+    X(0x31, swap, "SWAP C",     SWAP, C,   NONE, 2, 2, 2, "Z000", "rr",     "rr") \
+    X(0x32, swap, "SWAP D",     SWAP, D,   NONE, 2, 2, 2, "Z000", "rr",     "rr") \
+    X(0x33, swap, "SWAP E",     SWAP, E,   NONE, 2, 2, 2, "Z000", "rr",     "rr") \
+    X(0x34, swap, "SWAP H",     SWAP, H,   NONE, 2, 2, 2, "Z000", "rr",     "rr") \
+    X(0x35, swap, "SWAP L",     SWAP, L,   NONE, 2, 2, 2, "Z000", "rr",     "rr") \
+    X(0x36, swap, "SWAP (HL)",  SWAP, HLI, NONE, 2, 4, 4, "Z000", "rrwr",   "rrwr") \
+    X(0x37, swap, "SWAP A",     SWAP, A,   NONE, 2, 2, 2, "Z000", "rr",     "rr") \
+    X(0x38, srl,  "SRL B",      SRL,  B,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x39, srl,  "SRL C",      SRL,  C,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x3a, srl,  "SRL D",      SRL,  D,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x3b, srl,  "SRL E",      SRL,  E,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x3c, srl,  "SRL H",      SRL,  H,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x3d, srl,  "SRL L",      SRL,  L,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x3e, srl,  "SRL (HL)",   SRL,  HLI, NONE, 2, 4, 4, "Z00C", "rrwr",   "rrwr") \
+    X(0x3f, srl,  "SRL A",      SRL,  A,   NONE, 2, 2, 2, "Z00C", "rr",     "rr") \
+    X(0x40, bit,  "BIT 0,B",    BIT,  0,   B,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x41, bit,  "BIT 0,C",    BIT,  0,   C,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x42, bit,  "BIT 0,D",    BIT,  0,   D,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x43, bit,  "BIT 0,E",    BIT,  0,   E,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x44, bit,  "BIT 0,H",    BIT,  0,   H,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x45, bit,  "BIT 0,L",    BIT,  0,   L,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x46, bit,  "BIT 0,(HL)", BIT,  0,   HLI,  2, 3, 3, "Z01-", "rrr",    "rrr") \
+    X(0x47, bit,  "BIT 0,A",    BIT,  0,   A,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x48, bit,  "BIT 1,B",    BIT,  1,   B,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x49, bit,  "BIT 1,C",    BIT,  1,   C,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x4a, bit,  "BIT 1,D",    BIT,  1,   D,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x4b, bit,  "BIT 1,E",    BIT,  1,   E,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x4c, bit,  "BIT 1,H",    BIT,  1,   H,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x4d, bit,  "BIT 1,L",    BIT,  1,   L,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x4e, bit,  "BIT 1,(HL)", BIT,  1,   HLI,  2, 3, 3, "Z01-", "rrr",    "rrr") \
+    X(0x4f, bit,  "BIT 1,A",    BIT,  1,   A,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x50, bit,  "BIT 2,B",    BIT,  2,   B,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x51, bit,  "BIT 2,C",    BIT,  2,   C,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x52, bit,  "BIT 2,D",    BIT,  2,   D,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x53, bit,  "BIT 2,E",    BIT,  2,   E,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x54, bit,  "BIT 2,H",    BIT,  2,   H,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x55, bit,  "BIT 2,L",    BIT,  2,   L,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x56, bit,  "BIT 2,(HL)", BIT,  2,   HLI,  2, 3, 3, "Z01-", "rrr",    "rrr") \
+    X(0x57, bit,  "BIT 2,A",    BIT,  2,   A,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x58, bit,  "BIT 3,B",    BIT,  3,   B,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x59, bit,  "BIT 3,C",    BIT,  3,   C,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x5a, bit,  "BIT 3,D",    BIT,  3,   D,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x5b, bit,  "BIT 3,E",    BIT,  3,   E,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x5c, bit,  "BIT 3,H",    BIT,  3,   H,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x5d, bit,  "BIT 3,L",    BIT,  3,   L,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x5e, bit,  "BIT 3,(HL)", BIT,  3,   HLI,  2, 3, 3, "Z01-", "rrr",    "rrr") \
+    X(0x5f, bit,  "BIT 3,A",    BIT,  3,   A,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x60, bit,  "BIT 4,B",    BIT,  4,   B,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x61, bit,  "BIT 4,C",    BIT,  4,   C,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x62, bit,  "BIT 4,D",    BIT,  4,   D,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x63, bit,  "BIT 4,E",    BIT,  4,   E,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x64, bit,  "BIT 4,H",    BIT,  4,   H,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x65, bit,  "BIT 4,L",    BIT,  4,   L,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x66, bit,  "BIT 4,(HL)", BIT,  4,   HLI,  2, 3, 3, "Z01-", "rrr",    "rrr") \
+    X(0x67, bit,  "BIT 4,A",    BIT,  4,   A,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x68, bit,  "BIT 5,B",    BIT,  5,   B,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x69, bit,  "BIT 5,C",    BIT,  5,   C,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x6a, bit,  "BIT 5,D",    BIT,  5,   D,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x6b, bit,  "BIT 5,E",    BIT,  5,   E,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x6c, bit,  "BIT 5,H",    BIT,  5,   H,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x6d, bit,  "BIT 5,L",    BIT,  5,   L,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x6e, bit,  "BIT 5,(HL)", BIT,  5,   HLI,  2, 3, 3, "Z01-", "rrr",    "rrr") \
+    X(0x6f, bit,  "BIT 5,A",    BIT,  5,   A,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x70, bit,  "BIT 6,B",    BIT,  6,   B,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x71, bit,  "BIT 6,C",    BIT,  6,   C,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x72, bit,  "BIT 6,D",    BIT,  6,   D,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x73, bit,  "BIT 6,E",    BIT,  6,   E,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x74, bit,  "BIT 6,H",    BIT,  6,   H,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x75, bit,  "BIT 6,L",    BIT,  6,   L,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x76, bit,  "BIT 6,(HL)", BIT,  6,   HLI,  2, 3, 3, "Z01-", "rrr",    "rrr") \
+    X(0x77, bit,  "BIT 6,A",    BIT,  6,   A,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x78, bit,  "BIT 7,B",    BIT,  7,   B,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x79, bit,  "BIT 7,C",    BIT,  7,   C,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x7a, bit,  "BIT 7,D",    BIT,  7,   D,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x7b, bit,  "BIT 7,E",    BIT,  7,   E,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x7c, bit,  "BIT 7,H",    BIT,  7,   H,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x7d, bit,  "BIT 7,L",    BIT,  7,   L,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x7e, bit,  "BIT 7,(HL)", BIT,  7,   HLI,  2, 3, 3, "Z01-", "rrr",    "rrr") \
+    X(0x7f, bit,  "BIT 7,A",    BIT,  7,   A,    2, 2, 2, "Z01-", "rr",     "rr") \
+    X(0x80, res,  "RES 0,B",    RES,  0,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x81, res,  "RES 0,C",    RES,  0,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x82, res,  "RES 0,D",    RES,  0,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x83, res,  "RES 0,E",    RES,  0,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x84, res,  "RES 0,H",    RES,  0,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x85, res,  "RES 0,L",    RES,  0,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x86, res,  "RES 0,(HL)", RES,  0,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0x87, res,  "RES 0,A",    RES,  0,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x88, res,  "RES 1,B",    RES,  1,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x89, res,  "RES 1,C",    RES,  1,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x8a, res,  "RES 1,D",    RES,  1,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x8b, res,  "RES 1,E",    RES,  1,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x8c, res,  "RES 1,H",    RES,  1,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x8d, res,  "RES 1,L",    RES,  1,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x8e, res,  "RES 1,(HL)", RES,  1,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0x8f, res,  "RES 1,A",    RES,  1,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x90, res,  "RES 2,B",    RES,  2,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x91, res,  "RES 2,C",    RES,  2,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x92, res,  "RES 2,D",    RES,  2,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x93, res,  "RES 2,E",    RES,  2,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x94, res,  "RES 2,H",    RES,  2,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x95, res,  "RES 2,L",    RES,  2,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x96, res,  "RES 2,(HL)", RES,  2,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0x97, res,  "RES 2,A",    RES,  2,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x98, res,  "RES 3,B",    RES,  3,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x99, res,  "RES 3,C",    RES,  3,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x9a, res,  "RES 3,D",    RES,  3,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x9b, res,  "RES 3,E",    RES,  3,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x9c, res,  "RES 3,H",    RES,  3,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x9d, res,  "RES 3,L",    RES,  3,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0x9e, res,  "RES 3,(HL)", RES,  3,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0x9f, res,  "RES 3,A",    RES,  3,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xa0, res,  "RES 4,B",    RES,  4,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xa1, res,  "RES 4,C",    RES,  4,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xa2, res,  "RES 4,D",    RES,  4,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xa3, res,  "RES 4,E",    RES,  4,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xa4, res,  "RES 4,H",    RES,  4,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xa5, res,  "RES 4,L",    RES,  4,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xa6, res,  "RES 4,(HL)", RES,  4,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xa7, res,  "RES 4,A",    RES,  4,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xa8, res,  "RES 5,B",    RES,  5,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xa9, res,  "RES 5,C",    RES,  5,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xaa, res,  "RES 5,D",    RES,  5,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xab, res,  "RES 5,E",    RES,  5,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xac, res,  "RES 5,H",    RES,  5,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xad, res,  "RES 5,L",    RES,  5,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xae, res,  "RES 5,(HL)", RES,  5,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xaf, res,  "RES 5,A",    RES,  5,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xb0, res,  "RES 6,B",    RES,  6,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xb1, res,  "RES 6,C",    RES,  6,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xb2, res,  "RES 6,D",    RES,  6,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xb3, res,  "RES 6,E",    RES,  6,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xb4, res,  "RES 6,H",    RES,  6,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xb5, res,  "RES 6,L",    RES,  6,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xb6, res,  "RES 6,(HL)", RES,  6,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xb7, res,  "RES 6,A",    RES,  6,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xb8, res,  "RES 7,B",    RES,  7,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xb9, res,  "RES 7,C",    RES,  7,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xba, res,  "RES 7,D",    RES,  7,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xbb, res,  "RES 7,E",    RES,  7,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xbc, res,  "RES 7,H",    RES,  7,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xbd, res,  "RES 7,L",    RES,  7,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xbe, res,  "RES 7,(HL)", RES,  7,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xbf, res,  "RES 7,A",    RES,  7,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xc0, set,  "SET 0,B",    SET,  0,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xc1, set,  "SET 0,C",    SET,  0,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xc2, set,  "SET 0,D",    SET,  0,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xc3, set,  "SET 0,E",    SET,  0,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xc4, set,  "SET 0,H",    SET,  0,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xc5, set,  "SET 0,L",    SET,  0,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xc6, set,  "SET 0,(HL)", SET,  0,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xc7, set,  "SET 0,A",    SET,  0,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xc8, set,  "SET 1,B",    SET,  1,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xc9, set,  "SET 1,C",    SET,  1,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xca, set,  "SET 1,D",    SET,  1,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xcb, set,  "SET 1,E",    SET,  1,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xcc, set,  "SET 1,H",    SET,  1,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xcd, set,  "SET 1,L",    SET,  1,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xce, set,  "SET 1,(HL)", SET,  1,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xcf, set,  "SET 1,A",    SET,  1,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xd0, set,  "SET 2,B",    SET,  2,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xd1, set,  "SET 2,C",    SET,  2,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xd2, set,  "SET 2,D",    SET,  2,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xd3, set,  "SET 2,E",    SET,  2,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xd4, set,  "SET 2,H",    SET,  2,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xd5, set,  "SET 2,L",    SET,  2,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xd6, set,  "SET 2,(HL)", SET,  2,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xd7, set,  "SET 2,A",    SET,  2,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xd8, set,  "SET 3,B",    SET,  3,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xd9, set,  "SET 3,C",    SET,  3,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xda, set,  "SET 3,D",    SET,  3,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xdb, set,  "SET 3,E",    SET,  3,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xdc, set,  "SET 3,H",    SET,  3,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xdd, set,  "SET 3,L",    SET,  3,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xde, set,  "SET 3,(HL)", SET,  3,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xdf, set,  "SET 3,A",    SET,  3,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xe0, set,  "SET 4,B",    SET,  4,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xe1, set,  "SET 4,C",    SET,  4,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xe2, set,  "SET 4,D",    SET,  4,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xe3, set,  "SET 4,E",    SET,  4,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xe4, set,  "SET 4,H",    SET,  4,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xe5, set,  "SET 4,L",    SET,  4,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xe6, set,  "SET 4,(HL)", SET,  4,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xe7, set,  "SET 4,A",    SET,  4,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xe8, set,  "SET 5,B",    SET,  5,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xe9, set,  "SET 5,C",    SET,  5,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xea, set,  "SET 5,D",    SET,  5,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xeb, set,  "SET 5,E",    SET,  5,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xec, set,  "SET 5,H",    SET,  5,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xed, set,  "SET 5,L",    SET,  5,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xee, set,  "SET 5,(HL)", SET,  5,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xef, set,  "SET 5,A",    SET,  5,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xf0, set,  "SET 6,B",    SET,  6,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xf1, set,  "SET 6,C",    SET,  6,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xf2, set,  "SET 6,D",    SET,  6,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xf3, set,  "SET 6,E",    SET,  6,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xf4, set,  "SET 6,H",    SET,  6,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xf5, set,  "SET 6,L",    SET,  6,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xf6, set,  "SET 6,(HL)", SET,  6,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xf7, set,  "SET 6,A",    SET,  6,   A,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xf8, set,  "SET 7,B",    SET,  7,   B,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xf9, set,  "SET 7,C",    SET,  7,   C,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xfa, set,  "SET 7,D",    SET,  7,   D,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xfb, set,  "SET 7,E",    SET,  7,   E,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xfc, set,  "SET 7,H",    SET,  7,   H,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xfd, set,  "SET 7,L",    SET,  7,   L,    2, 2, 2, "----", "rr",     "rr") \
+    X(0xfe, set,  "SET 7,(HL)", SET,  7,   HLI,  2, 4, 4, "----", "rrwr",   "rrwr") \
+    X(0xff, set,  "SET 7,A",    SET,  7,   A,    2, 2, 2, "----", "rr",     "rr")
+
+// The kind column of the tables as a value, for code that analyses instructions
+typedef enum OpKind
+{
+    KIND_NOP, KIND_GENERIC, KIND_STOP, KIND_HALT, KIND_DI, KIND_EI, KIND_PREFIX,
+    KIND_LD, KIND_LD16, KIND_INC16, KIND_DEC16, KIND_INC, KIND_DEC, KIND_ADD_HL,
+    KIND_ADD, KIND_ADC, KIND_SUB, KIND_SBC, KIND_CP, KIND_AND, KIND_XOR, KIND_OR,
+    KIND_JR, KIND_JP, KIND_JP_HL, KIND_CALL, KIND_RET, KIND_RETI, KIND_RST, KIND_PUSH, KIND_POP,
+    KIND_RLC, KIND_RRC, KIND_RL, KIND_RR, KIND_SLA, KIND_SRA, KIND_SWAP, KIND_SRL,
+    KIND_BIT, KIND_RES, KIND_SET
+} OpKind;
+
+typedef struct OpcodeInfo
+{
+    const char* mnemonic;
+    uint8_t kind;
+    uint8_t length;
+    uint8_t cycles;
+    uint8_t takenCycles;
+    const char* flags;
+    const char* access;
+    const char* takenAccess;
+} OpcodeInfo;
+
+// Indexed by opcode; CB-prefixed opcodes live at 0x100 | opcode.
+extern const OpcodeInfo opcode_info[0x200];
+
+// Not-taken and taken M-cycles of every opcode, indexed like opcode_info. A
+// compact copy of those columns for the handlers to return.
+extern const uint8_t opcode_cycles[0x200][2];
+
+const OpcodeInfo* opcode_at(Memory* mem, uint16_t addr);
+
+int disassemble(Memory* mem, uint16_t addr, char* buf, int size);
+bool opcode_ends_block(const OpcodeInfo* info);
@@ -0,0 +1,2 @@
+#!/bin/bash
+gcc recompile.c ../opcodes.c ../aot.c ../memory.c -o ../dist/recompile -O3
@@ -0,0 +1,588 @@
+// Ahead-of-time translator from a ROM image to C, see aot.h.
+//
+//   recompile rom.gb out.c [entry ...]
+//
+// Walks the code reachable from the RST and interrupt vectors, the cartridge
+// entry point at 0x100 and any extra entry points given in hex (bank:addr for
+// one bank only), and writes one C function per basic block and a table of
+// them per ROM bank. Which bank is switched in is only known at run time, so
+// addresses in 0x4000-0x7fff that bank 0 jumps or calls to are followed in
+// every switchable bank; code inside a switchable bank stays in it.
+// Register-only instructions and jumps become plain C on local copies of the
+// registers; everything that touches memory, the stack or the CPU state calls
+// the interpreter's handler.
+//
+// Build the output into the emulator with -DAOT=1, e.g.
+//   gcc *.c /path/to/game-aot.c -o gb-emu -O3 -DAOT=1
+// and give the CPU a table of the translations with
+//   cpu->aot = make_aot_table(mem);
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../aot.h"
+#include "../opcodes.h"
+
+typedef struct Op
+{
+    uint16_t pc;
+    uint8_t inst;           // the byte after the prefix for CB opcodes
+    bool cb;
+    uint8_t length;
+    uint16_t imm;
+    const OpcodeInfo* info;
+} Op;
+
+typedef struct TranslatedBlock
+{
+    uint16_t bank;
+    uint16_t pc;
+    uint16_t endPc;
+    int numOps;
+    Op ops[AOT_MAX_OPS];
+} TranslatedBlock;
+
+// Where a translated block goes in the bank tables
+typedef struct BlockRecord
+{
+    uint16_t bank;
+    uint16_t pc;
+    uint16_t endPc;
+    uint32_t hash;
+} BlockRecord;
+
+// A place to translate from, in the bank its address belongs to
+typedef struct Entry
+{
+    uint16_t bank;
+    uint16_t pc;
+} Entry;
+
+// Bank 0 and the bank being translated, mapped as the cartridge would. The
+// whole file is kept in image, padded to whole banks.
+static Memory* rom;
+static uint8_t* image;
+static long imageSize;
+static int numBanks;
+static int mappedBank;
+static int mappedEnd;
+
+// Register names for operand index B C D E H L (HL) A
+static const char* regNames[8] = { "b", "c", "d", "e", "h", "l", NULL, "a" };
+
+// Condition codes NZ, Z, NC, C from bits 3-4 of the opcode
+static const char* conditions[4] = { "!fz", "fz", "!fc", "fc" };
+
+// Switches bank into 0x4000-0x7fff of rom
+static void map_bank(int bank)
+{
+    if (bank == 0 || bank == mappedBank) return;
+
+    memcpy(&rom->ram[ROM_BANK_SIZE], &image[(long)bank * ROM_BANK_SIZE], ROM_BANK_SIZE);
+    mappedBank = bank;
+
+    long bytes = imageSize - (long)bank * ROM_BANK_SIZE;
+    mappedEnd = ROM_BANK_SIZE + (bytes < ROM_BANK_SIZE ? bytes : ROM_BANK_SIZE);
+}
+
+// Instructions never cross into another bank or past the ROM, so every block
+// lies in one bank
+static uint16_t bank_end(uint16_t pc)
+{
+    if (pc < ROM_BANK_SIZE) return imageSize < ROM_BANK_SIZE ? imageSize : ROM_BANK_SIZE;
+
+    return mappedEnd;
+}
+
+static bool is_conditional(const OpcodeInfo* info)
+{
+    return info->cycles != info->takenCycles;
+}
+
+// Straight-line code from pc up to the first instruction that can branch,
+// like decode_ops in block-cache.c
+static void decode_block(TranslatedBlock* block, int bank, uint16_t pc)
+{
+    uint16_t end = bank_end(pc);
+
+    block->bank = bank;
+    block->pc = pc;
+    block->numOps = 0;
+
+    while (block->numOps < AOT_MAX_OPS)
+    {
+        Op* op = &block->ops[block->numOps];
+        uint8_t inst = rom->ram[pc];
+
+        op->pc = pc;
+        op->cb = inst == 0xcb;
+        op->inst = op->cb ? rom->ram[pc + 1] : inst;
+        op->info = &opcode_info[op->cb ? 0x100 | op->inst : inst];
+        op->length = op->info->length;
+
+        if (pc + op->length > end) break;
+
+        int immBytes = op->length - (op->cb ? 2 : 1);
+        op->imm = 0;
+        if (immBytes >= 1) op->imm = rom->ram[pc + 1];
+        if (immBytes == 2) op->imm |= rom->ram[pc + 2] << 8;
+
+        block->numOps++;
+        pc += op->length;
+
+        if (opcode_ends_block(op->info)) break;
+    }
+
+    block->endPc = pc;
+}
+
+// Addresses control can continue at after the block; returns how many
+static int block_successors(TranslatedBlock* block, int* targets)
+{
+    if (!block->numOps) return 0;
+
+    Op* last = &block->ops[block->numOps - 1];
+    int count = 0;
+
+    switch (last->info->kind)
+    {
+        case KIND_JR:
+            targets[count++] = (uint16_t)(block->endPc + (int8_t)last->imm);
+            if (is_conditional(last->info)) targets[count++] = block->endPc;
+            break;
+        case KIND_JP:
+        case KIND_CALL:
+            targets[count++] = last->imm;
+            if (is_conditional(last->info) || last->info->kind == KIND_CALL) targets[count++] = block->endPc;
+            break;
+        case KIND_RST:
+            targets[count++] = last->inst & 0x38;
+            targets[count++] = block->endPc;
+            break;
+        case KIND_RET:
+            if (is_conditional(last->info)) targets[count++] = block->endPc;
+            break;
+        case KIND_RETI:
+        case KIND_JP_HL:
+            break;
+        default:
+            // HALT, STOP, DI, EI and blocks cut short continue after themselves
+            targets[count++] = block->endPc;
+            break;
+    }
+
+    return count;
+}
+
+// Emits an ALU op on A with operand src (a local or a constant)
+static void emit_alu(FILE* out, uint8_t kind, const char* src)
+{
+    switch (kind)
+    {
+        case KIND_ADD:
+            fprintf(out, "    { unsigned v = %s, r = a + v; fh = (a & 0xf) + (v & 0xf) > 0xf; fc = r > 0xff; a = r; fz = !a; fn = 0; }\n", src);
+            break;
+        case KIND_ADC:
+            fprintf(out, "    { unsigned v = %s, r = a + v + fc; fh = (a & 0xf) + (v & 0xf) + fc > 0xf; fc = r > 0xff; a = r; fz = !a; fn = 0; }\n", src);
+            break;
+        case KIND_SUB:
+            fprintf(out, "    { unsigned v = %s; fh = (a & 0xf) < (v & 0xf); fc = a < v; a -= v; fz = !a; fn = 1; }\n", src);
+            break;
+        case KIND_SBC:
+            fprintf(out, "    { unsigned v = %s, ci = fc; fh = (a & 0xf) < (v & 0xf) + ci; fc = a < v + ci; a -= v + ci; fz = !a; fn = 1; }\n", src);
+            break;
+        case KIND_CP:
+            fprintf(out, "    { unsigned v = %s; fh = (a & 0xf) < (v & 0xf); fc = a < v; fz = a == v; fn = 1; }\n", src);
+            break;
+        case KIND_AND:
+            fprintf(out, "    a &= %s; fz = !a; fn = 0; fh = 1; fc = 0;\n", src);
+            break;
+        case KIND_XOR:
+            fprintf(out, "    a ^= %s; fz = !a; fn = 0; fh = 0; fc = 0;\n", src);
+            break;
+        default:
+            fprintf(out, "    a |= %s; fz = !a; fn = 0; fh = 0; fc = 0;\n", src);
+            break;
+    }
+}
+
+// CB rotates, shifts and bit operations on a register
+static bool emit_cb(FILE* out, Op* op)
+{
+    const char* r = regNames[op->inst & 7];
+    int bit = (op->inst >> 3) & 7;
+
+    if (!r) return false;
+
+    switch (op->info->kind)
+    {
+        case KIND_RLC: fprintf(out, "    fc = %s >> 7; %s = %s << 1 | fc;", r, r, r); break;
+        case KIND_RRC: fprintf(out, "    fc = %s & 1; %s = %s >> 1 | fc << 7;", r, r, r); break;
+        case KIND_RL: fprintf(out, "    { bool out = %s >> 7; %s = %s << 1 | fc; fc = out; }", r, r, r); break;
+        case KIND_RR: fprintf(out, "    { bool out = %s & 1; %s = %s >> 1 | fc << 7; fc = out; }", r, r, r); break;
+        case KIND_SLA: fprintf(out, "    fc = %s >> 7; %s <<= 1;", r, r); break;
+        case KIND_SRA: fprintf(out, "    fc = %s & 1; %s = %s >> 1 | (%s & 0x80);", r, r, r, r); break;
+        case KIND_SWAP: fprintf(out, "    fc = 0; %s = %s << 4 | %s >> 4;", r, r, r); break;
+        case KIND_SRL: fprintf(out, "    fc = %s & 1; %s >>= 1;", r, r); break;
+        case KIND_BIT:
+            fprintf(out, "    fz = !(%s & 0x%02x); fn = 0; fh = 1;\n", r, 1 << bit);
+            return true;
+        case KIND_RES:
+            fprintf(out, "    %s &= 0x%02x;\n", r, (uint8_t)~(1 << bit));
+            return true;
+        case KIND_SET:
+            fprintf(out, "    %s |= 0x%02x;\n", r, 1 << bit);
+            return true;
+        default:
+            return false;
+    }
+
+    fprintf(out, " fz = !%s; fn = 0; fh = 0;\n", r);
+    return true;
+}
+
+// Emits C for instructions that only work on registers and flags. Returns
+// false for everything else, which the interpreter runs.
+static bool emit_inline(FILE* out, Op* op)
+{
+    if (op->cb) return emit_cb(out, op);
+
+    uint8_t inst = op->inst;
+    const char* dst = regNames[(inst >> 3) & 7];
+    const char* src = regNames[inst & 7];
+    const char* pairHi = regNames[((inst >> 4) & 3) * 2];
+    const char* pairLo = regNames[((inst >> 4) & 3) * 2 + 1];
+    bool sp = inst >> 4 == 3;
+    char operand[16];
+
+    switch (op->info->kind)
+    {
+        case KIND_NOP:
+            return true;
+        case KIND_LD:
+            if (inst >= 0x40 && inst < 0x80 && dst && src)
+            {
+                if (dst != src) fprintf(out, "    %s = %s;\n", dst, src);
+                return true;
+            }
+            if (inst < 0x40 && (inst & 7) == 6 && dst)
+            {
+                fprintf(out, "    %s = 0x%02x;\n", dst, op->imm);
+                return true;
+            }
+            return false;
+        case KIND_LD16:
+            if (inst == 0xf9) fprintf(out, "    cpu->sp = h << 8 | l;\n");
+            else if (sp) fprintf(out, "    cpu->sp = 0x%04x;\n", op->imm);
+            else fprintf(out, "    %s = 0x%02x; %s = 0x%02x;\n", pairHi, op->imm >> 8, pairLo, op->imm & 0xff);
+            return true;
+        case KIND_INC16:
+            if (sp) fprintf(out, "    cpu->sp++;\n");
+            else fprintf(out, "    if (!++%s) %s++;\n", pairLo, pairHi);
+            return true;
+        case KIND_DEC16:
+            if (sp) fprintf(out, "    cpu->sp--;\n");
+            else fprintf(out, "    if (!%s--) %s--;\n", pairLo, pairHi);
+            return true;
+        case KIND_INC:
+            if (!dst) return false;
+            fprintf(out, "    %s++; fz = !%s; fn = 0; fh = !(%s & 0xf);\n", dst, dst, dst);
+            return true;
+        case KIND_DEC:
+            if (!dst) return false;
+            fprintf(out, "    %s--; fz = !%s; fn = 1; fh = (%s & 0xf) == 0xf;\n", dst, dst, dst);
+            return true;
+        case KIND_ADD_HL:
+            if (sp) snprintf(operand, sizeof(operand), "cpu->sp");
+            else snprintf(operand, sizeof(operand), "%s << 8 | %s", pairHi, pairLo);
+            fprintf(out, "    { unsigned hl = h << 8 | l, v = %s, r = hl + v; fn = 0; fh = (hl & 0xfff) + (v & 0xfff) > 0xfff; fc = r > 0xffff; h = r >> 8; l = r; }\n", operand);
+            return true;
+        case KIND_ADD:
+        case KIND_ADC:
+        case KIND_SUB:
+        case KIND_SBC:
+        case KIND_CP:
+        case KIND_AND:
+        case KIND_XOR:
+        case KIND_OR:
+            if (inst >= 0xc0) snprintf(operand, sizeof(operand), "0x%02x", op->imm);
+            else if (src) snprintf(operand, sizeof(operand), "%s", src);
+            else return false;
+            emit_alu(out, op->info->kind, operand);
+            return true;
+        case KIND_GENERIC:
+            switch (inst)
+            {
+                case 0x07: fprintf(out, "    fc = a >> 7; a = a << 1 | fc; fz = 0; fn = 0; fh = 0;\n"); return true;
+                case 0x0f: fprintf(out, "    fc = a & 1; a = a >> 1 | fc << 7; fz = 0; fn = 0; fh = 0;\n"); return true;
+                case 0x17: fprintf(out, "    { bool out = a >> 7; a = a << 1 | fc; fc = out; } fz = 0; fn = 0; fh = 0;\n"); return true;
+                case 0x1f: fprintf(out, "    { bool out = a & 1; a = a >> 1 | fc << 7; fc = out; } fz = 0; fn = 0; fh = 0;\n"); return true;
+                case 0x2f: fprintf(out, "    a = ~a; fn = 1; fh = 1;\n"); return true;
+                case 0x37: fprintf(out, "    fn = 0; fh = 0; fc = 1;\n"); return true;
+                case 0x3f: fprintf(out, "    fn = 0; fh = 0; fc = !fc;\n"); return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+static void emit_exit(FILE* out, const char* indent, uint16_t pc, int cycles)
+{
+    fprintf(out, "%sAOT_STORE(cpu);\n", indent);
+    fprintf(out, "%scpu->pc = 0x%04x;\n", indent, pc);
+    fprintf(out, "%sreturn cycles + %d;\n", indent, cycles);
+}
+
+// Jumps whose target is known here end the block in C. Returns false for the
+// ones the interpreter has to run (calls, returns, RST).
+static bool emit_jump(FILE* out, Op* op, uint16_t nextPc)
+{
+    uint8_t kind = op->info->kind;
+    uint16_t target;
+
+    if (op->cb) return false;
+
+    if (kind == KIND_JP_HL)
+    {
+        fprintf(out, "    AOT_STORE(cpu);\n");
+        fprintf(out, "    cpu->pc = h << 8 | l;\n");
+        fprintf(out, "    return cycles + %d;\n", op->info->cycles);
+        return true;
+    }
+
+    if (kind == KIND_JR) target = nextPc + (int8_t)op->imm;
+    else if (kind == KIND_JP) target = op->imm;
+    else return false;
+
+    if (is_conditional(op->info))
+    {
+        fprintf(out, "    if (%s)\n    {\n", conditions[(op->inst >> 3) & 3]);
+        emit_exit(out, "        ", target, op->info->takenCycles);
+        fprintf(out, "    }\n");
+        emit_exit(out, "    ", nextPc, op->info->cycles);
+    }
+    else
+    {
+        emit_exit(out, "    ", target, op->info->cycles);
+    }
+
+    return true;
+}
+
+// Runs op through the interpreter with PC past the opcode, like step_until
+static void emit_fallback(FILE* out, Op* op, TranslatedBlock* block, bool last)
+{
+    const char* map = op->cb ? "cb_instruction_map" : "instruction_map";
+
+    fprintf(out, "    AOT_STORE(cpu);\n");
+    fprintf(out, "    cpu->pc = 0x%04x;\n", op->pc + (op->cb ? 2 : 1));
+
+    // Where the handler's accesses fall, for register handlers
+    fprintf(out, "    cpu->inst = 0x%02x;\n", op->cb ? 0xcb : op->inst);
+    fprintf(out, "    cpu->blockCycles = cycles;\n");
+
+    if (last)
+    {
+        fprintf(out, "    return cycles + %s[0x%02x](cpu, 0x%02x);\n", map, op->inst, op->inst);
+        return;
+    }
+
+    fprintf(out, "    cycles += %s[0x%02x](cpu, 0x%02x);\n", map, op->inst, op->inst);
+    fprintf(out, "    if (AOT_STALE(cpu, %d, 0x%04x)) return cycles;\n", block->bank, block->pc);
+    fprintf(out, "    AOT_LOAD(cpu);\n");
+}
+
+static void emit_block(FILE* out, TranslatedBlock* block)
+{
+    fprintf(out, "static int aot_%02x_%04x(CPU* cpu)\n{\n", block->bank, block->pc);
+    fprintf(out, "    AOT_LOCALS;\n");
+    fprintf(out, "    AOT_LOAD(cpu);\n");
+    fprintf(out, "    int cycles = 0;\n\n");
+
+    for (int i = 0; i < block->numOps; i++)
+    {
+        Op* op = &block->ops[i];
+        bool last = i == block->numOps - 1;
+        char text[32];
+
+        disassemble(rom, op->pc, text, sizeof(text));
+        fprintf(out, "    // %04x: %s\n", op->pc, text);
+
+        if (last && emit_jump(out, op, block->endPc)) break;
+
+        if (emit_inline(out, op))
+        {
+            fprintf(out, "    cycles += %d;\n", op->info->cycles);
+            if (last) emit_exit(out, "    ", block->endPc, 0);
+        }
+        else
+        {
+            emit_fallback(out, op, block, last);
+        }
+    }
+
+    if (!block->numOps) emit_exit(out, "    ", block->pc, 0);
+
+    fprintf(out, "}\n\n");
+}
+
+static bool* queued;         // ROM_BANK_SIZE flags per bank
+static Entry* worklist;
+static int pending;
+
+// Addresses are queued once per bank; the worklist never holds more than that
+static void queue(int bank, int pc)
+{
+    if (bank >= numBanks) return;
+
+    bool* flag = &queued[(long)bank * ROM_BANK_SIZE + (pc & (ROM_BANK_SIZE - 1))];
+    if (*flag) return;
+
+    *flag = true;
+    worklist[pending++] = (Entry){ bank, pc };
+}
+
+// Queues a target reached from code in bank `from`. Bank 0 can reach any
+// switchable bank at 0x4000-0x7fff, so those targets go in for all of them.
+static void queue_target(int from, int pc)
+{
+    if (pc < 0 || pc >= AOT_ROM_END) return;
+
+    if (pc < ROM_BANK_SIZE) queue(0, pc);
+    else if (from != 0) queue(from, pc);
+    else for (int bank = 1; bank < numBanks; bank++) queue(bank, pc);
+}
+
+static int compare_records(const void* a, const void* b)
+{
+    const BlockRecord* x = a;
+    const BlockRecord* y = b;
+
+    return x->bank != y->bank ? x->bank - y->bank : x->pc - y->pc;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s rom.gb out.c [entry ...]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (!in)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fseek(in, 0, SEEK_END);
+    imageSize = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    // At least banks 0 and 1, as a 32 KiB image without a controller maps
+    numBanks = (imageSize + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE;
+    if (numBanks < 2) numBanks = 2;
+    if (numBanks > AOT_MAX_BANKS) numBanks = AOT_MAX_BANKS;
+
+    image = calloc(numBanks, ROM_BANK_SIZE);
+    imageSize = fread(image, 1, (long)numBanks * ROM_BANK_SIZE, in);
+    fclose(in);
+
+    rom = make_memory();
+    memcpy(rom->ram, image, ROM_BANK_SIZE);
+    mappedBank = -1;
+
+    queued = calloc(numBanks, ROM_BANK_SIZE);
+    worklist = calloc((long)numBanks * ROM_BANK_SIZE, sizeof(Entry));
+
+    uint16_t vectors[] = { 0x00, 0x08, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38, 0x40, 0x48, 0x50, 0x58, 0x60, 0x100 };
+    int numVectors = sizeof(vectors) / sizeof(vectors[0]);
+
+    for (int i = 0; i < numVectors; i++) queue(0, vectors[i]);
+
+    for (int i = 3; i < argc; i++)
+    {
+        char* colon = strchr(argv[i], ':');
+        int pc = strtol(colon ? colon + 1 : argv[i], NULL, 16);
+
+        if (colon) queue_target(strtol(argv[i], NULL, 16), pc);
+        else queue_target(0, pc);
+    }
+
+    FILE* out = fopen(argv[2], "w");
+    if (!out)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    fprintf(out, "// Generated by recompiler/recompile.c from %s. Do not edit.\n\n", argv[1]);
+    fprintf(out, "#include \"aot.h\"\n\n");
+
+    BlockRecord* records = NULL;
+    int numBlocks = 0;
+    int capacity = 0;
+
+    while (pending)
+    {
+        Entry entry = worklist[--pending];
+        map_bank(entry.bank);
+
+        TranslatedBlock block;
+        decode_block(&block, entry.bank, entry.pc);
+        if (!block.numOps) continue;
+
+        int targets[2];
+        int count = block_successors(&block, targets);
+        for (int i = 0; i < count; i++) queue_target(entry.bank, targets[i]);
+
+        emit_block(out, &block);
+
+        if (numBlocks == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 1024;
+            records = realloc(records, capacity * sizeof(BlockRecord));
+        }
+
+        records[numBlocks++] = (BlockRecord){
+            block.bank, block.pc, block.endPc, aot_hash(&rom->ram[block.pc], block.endPc - block.pc)
+        };
+    }
+
+    qsort(records, numBlocks, sizeof(BlockRecord), compare_records);
+
+    int numTables = 0;
+    for (int first = 0; first < numBlocks; numTables++)
+    {
+        int bank = records[first].bank;
+
+        fprintf(out, "static const AotBlock aot_bank_%02x[] = {\n", bank);
+        for (; first < numBlocks && records[first].bank == bank; first++)
+        {
+            BlockRecord* record = &records[first];
+            fprintf(out, "    { 0x%04x, 0x%04x, %d, 0x%08x, aot_%02x_%04x },\n",
+                record->pc, record->endPc, bank, record->hash, bank, record->pc);
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "const AotBank aot_banks[] = {\n");
+    for (int first = 0; first < numBlocks; )
+    {
+        int bank = records[first].bank;
+        int count = 0;
+        for (; first < numBlocks && records[first].bank == bank; first++) count++;
+
+        fprintf(out, "    { %d, %d, aot_bank_%02x },\n", bank, count, bank);
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "const int aot_bank_count = %d;\n", numTables);
+
+    fclose(out);
+    printf("%s: %d blocks translated in %d banks\n", argv[2], numBlocks, numTables);
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <string.h>
+
+#include "scheduler.h"
+#include "cpu.h"
+
+static void swap_slots(Scheduler* scheduler, int i, int j)
+{
+    uint8_t kind = scheduler->heap[i];
+    scheduler->heap[i] = scheduler->heap[j];
+    scheduler->heap[j] = kind;
+
+    scheduler->slots[scheduler->heap[i]] = i;
+    scheduler->slots[scheduler->heap[j]] = j;
+}
+
+static bool sooner(Scheduler* scheduler, int i, int j)
+{
+    return scheduler->times[scheduler->heap[i]] < scheduler->times[scheduler->heap[j]];
+}
+
+static void sift_up(Scheduler* scheduler, int i)
+{
+    while (i > 0 && sooner(scheduler, i, (i - 1) / 2))
+    {
+        swap_slots(scheduler, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(Scheduler* scheduler, int i)
+{
+    // Never more than EVENT_KINDS, but bounded so the compiler can see it
+    int count = scheduler->count < EVENT_KINDS ? scheduler->count : EVENT_KINDS;
+
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= count) return;
+
+        if (child + 1 < count && sooner(scheduler, child + 1, child)) child++;
+        if (!sooner(scheduler, child, i)) return;
+
+        swap_slots(scheduler, i, child);
+        i = child;
+    }
+}
+
+// Mirrors the soonest event into the CPU. One brought forward also sets
+// checkState, which is where the run loops look for a deadline earlier than
+// the one they started with.
+static void update_deadline(Scheduler* scheduler)
+{
+    CPU* cpu = scheduler->cpu;
+    uint64_t next = next_event_time(scheduler);
+
+    if (next < cpu->nextEvent) cpu->checkState = true;
+    cpu->nextEvent = next;
+}
+
+static void remove_slot(Scheduler* scheduler, int i)
+{
+    scheduler->slots[scheduler->heap[i]] = -1;
+
+    // The last entry fills the hole and moves whichever way it has to
+    if (i != --scheduler->count)
+    {
+        uint8_t moved = scheduler->heap[scheduler->count];
+        scheduler->heap[i] = moved;
+        scheduler->slots[moved] = i;
+
+        sift_up(scheduler, i);
+        sift_down(scheduler, scheduler->slots[moved]);
+    }
+}
+
+void init_scheduler(Scheduler* scheduler, CPU* cpu)
+{
+    memset(scheduler, 0, sizeof(Scheduler));
+    memset(scheduler->slots, -1, sizeof(scheduler->slots));
+
+    scheduler->cpu = cpu;
+    cpu->mem->scheduler = scheduler;
+    update_deadline(scheduler);
+}
+
+void set_event_handler(Scheduler* scheduler, EventKind kind, EventHandler handler)
+{
+    scheduler->handlers[kind] = handler;
+}
+
+void schedule_event(Scheduler* scheduler, EventKind kind, uint64_t cycle)
+{
+    int i = scheduler->slots[kind];
+    uint64_t old = scheduler->times[kind];
+    scheduler->times[kind] = cycle;
+
+    if (i < 0)
+    {
+        i = scheduler->count++;
+        scheduler->heap[i] = kind;
+        scheduler->slots[kind] = i;
+        sift_up(scheduler, i);
+    }
+    else if (cycle < old)
+    {
+        sift_up(scheduler, i);
+    }
+    else
+    {
+        sift_down(scheduler, i);
+    }
+
+    update_deadline(scheduler);
+}
+
+void cancel_event(Scheduler* scheduler, EventKind kind)
+{
+    if (scheduler->slots[kind] < 0) return;
+
+    remove_slot(scheduler, scheduler->slots[kind]);
+    update_deadline(scheduler);
+}
+
+void cancel_all_events(Scheduler* scheduler)
+{
+    scheduler->count = 0;
+    memset(scheduler->slots, -1, sizeof(scheduler->slots));
+
+    update_deadline(scheduler);
+}
+
+void run_events(Scheduler* scheduler, uint64_t now)
+{
+    while (scheduler->count && scheduler->times[scheduler->heap[0]] <= now)
+    {
+        EventKind kind = scheduler->heap[0];
+
+        // Off the queue before the handler runs, so it can schedule itself again
+        remove_slot(scheduler, 0);
+        update_deadline(scheduler);
+
+        scheduler->eventsRun++;
+        scheduler->handlers[kind](scheduler->cpu->mem, scheduler->times[kind]);
+
+        // In case the handler requested an interrupt
+        scheduler->cpu->checkState = true;
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memory.h"
+
+// Discrete-event scheduler for the peripherals. Nothing outside the CPU is
+// ticked per instruction: each peripheral works out its state from the cycle
+// counter when its registers are touched, and only schedules an event for the
+// next moment it has to act on its own (an interrupt, a counter overflow).
+//
+// Every kind of event is pending at most once, so the queue is a binary heap
+// over the kinds with each kind's position kept alongside, which makes
+// rescheduling and cancelling O(log n) and finding the next event O(1). The
+// soonest time is mirrored into cpu->nextEvent, where the run loops already
+// stop; run_until then calls run_events and carries on.
+
+struct CPU;
+
+typedef enum EventKind
+{
+    EVENT_VBLANK,
+    EVENT_TIMER,
+    EVENT_KINDS
+} EventKind;
+
+// Called with the cycle the event was due at, which the CPU may have run a
+// few cycles past by the end of its last instruction
+typedef void (*EventHandler)(Memory* mem, uint64_t cycle);
+
+typedef struct Scheduler
+{
+    // Due time of each kind, meaningful while it is pending
+    uint64_t times[EVENT_KINDS];
+
+    // Pending kinds, a min-heap on times, and each kind's index in it or -1
+    uint8_t heap[EVENT_KINDS];
+    int8_t slots[EVENT_KINDS];
+    int count;
+
+    EventHandler handlers[EVENT_KINDS];
+
+    // Whose nextEvent this drives; its memory is what handlers get
+    struct CPU* cpu;
+
+    uint64_t eventsRun;
+} Scheduler;
+
+// Empty, driving cpu, and attached to its memory so register handlers can
+// find it
+void init_scheduler(Scheduler* scheduler, struct CPU* cpu);
+
+void set_event_handler(Scheduler* scheduler, EventKind kind, EventHandler handler);
+
+// Due at cycle, replacing any time kind was already pending at
+void schedule_event(Scheduler* scheduler, EventKind kind, uint64_t cycle);
+void cancel_event(Scheduler* scheduler, EventKind kind);
+void cancel_all_events(Scheduler* scheduler);
+
+// Runs the handlers of everything due at or before now, soonest first
+void run_events(Scheduler* scheduler, uint64_t now);
+
+static inline bool event_pending(Scheduler* scheduler, EventKind kind)
+{
+    return scheduler->slots[kind] >= 0;
+}
+
+static inline uint64_t next_event_time(Scheduler* scheduler)
+{
+    return scheduler->count ? scheduler->times[scheduler->heap[0]] : UINT64_MAX;
+}
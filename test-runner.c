@@ -4,6 +4,10 @@
 
 #include "test-runner.h"
 #include "cJSON.h"
+#include "jit.h"
+#include "block-cache.h"
+#include "opcodes.h"
+#include "emulator.h"
 
 #define LOG_LEVEL 2
 
@@ -49,6 +53,29 @@ char* get_test_str(int fileIndex)
     return buffer;
 }
 
+// The bus activity a test's "cycles" array lists, in the notation of the
+// access column of opcodes.h: r or w by each entry's type, - for internal
+// cycles (null entries, or no read or write)
+static void json_access(cJSON* cycles, char* buf, int size)
+{
+    int count = cJSON_GetArraySize(cycles);
+    if (count > size - 1) count = size - 1;
+
+    for (int i = 0; i < count; i++)
+    {
+        cJSON* cycle = cJSON_GetArrayItem(cycles, i);
+        cJSON* type = cJSON_IsArray(cycle) ? cJSON_GetArrayItem(cycle, 2) : NULL;
+        char access = '-';
+
+        if (cJSON_IsString(type) && strchr(type->valuestring, 'w')) access = 'w';
+        else if (cJSON_IsString(type) && strchr(type->valuestring, 'r')) access = 'r';
+
+        buf[i] = access;
+    }
+
+    buf[count] = '\0';
+}
+
 int run_test(int fileIndex)
 {
     char* buffer = get_test_str(fileIndex);
@@ -57,6 +84,12 @@ int run_test(int fileIndex)
 
     int numFailed = 0;
 
+#if JIT
+    // Every test goes through a one-instruction translation; the code arena
+    // is shared between the tests of the file
+    BlockCache* blockCache = make_block_cache();
+#endif
+
     for (int i = 0; i < numTests; i++)
     {
 #if LOG_LEVEL > 0
@@ -74,7 +107,7 @@ int run_test(int fileIndex)
         cpu->c = cJSON_GetObjectItemCaseSensitive(initial, "c")->valueint;
         cpu->d = cJSON_GetObjectItemCaseSensitive(initial, "d")->valueint;
         cpu->e = cJSON_GetObjectItemCaseSensitive(initial, "e")->valueint;
-        cpu->f = cJSON_GetObjectItemCaseSensitive(initial, "f")->valueint;
+        write_flags(cpu, cJSON_GetObjectItemCaseSensitive(initial, "f")->valueint);
         cpu->h = cJSON_GetObjectItemCaseSensitive(initial, "h")->valueint;
         cpu->l = cJSON_GetObjectItemCaseSensitive(initial, "l")->valueint;
         cpu->pc = cJSON_GetObjectItemCaseSensitive(initial, "pc")->valueint - 1;
@@ -88,7 +121,15 @@ int run_test(int fileIndex)
             mem->ram[cJSON_GetArrayItem(ramItem, 0)->valueint] = cJSON_GetArrayItem(ramItem, 1)->valueint;
         }
 
+        const OpcodeInfo* info = opcode_at(mem, cpu->pc);
+
+#if JIT
+        cpu->blockCache = blockCache;
+
+        int cycles = jit_execute_inst(cpu);
+#else
         int cycles = execute_inst(cpu);
+#endif
 
         cJSON* final = cJSON_GetObjectItemCaseSensitive(testJson, "final");
         if (cpu->a != cJSON_GetObjectItemCaseSensitive(final, "a")->valueint)
@@ -126,10 +167,10 @@ int run_test(int fileIndex)
 #endif
             numFailed++;
         }
-        if (cpu->f != cJSON_GetObjectItemCaseSensitive(final, "f")->valueint)
+        if (read_flags(cpu) != cJSON_GetObjectItemCaseSensitive(final, "f")->valueint)
         {
 #if LOG_LEVEL > 1
-            printf("\tIncorrect Value for f \t\t| Expected: 0x%02x;\t Actual: 0x%02x\n", cJSON_GetObjectItemCaseSensitive(final, "f")->valueint, cpu->f);
+            printf("\tIncorrect Value for f \t\t| Expected: 0x%02x;\t Actual: 0x%02x\n", cJSON_GetObjectItemCaseSensitive(final, "f")->valueint, read_flags(cpu));
 #endif
             numFailed++;
         }
@@ -158,6 +199,17 @@ int run_test(int fileIndex)
         {
 #if LOG_LEVEL > 1
             printf("\tIncorrect Value for sp \t\t| Expected: 0x%04x;\t Actual: 0x%04x\n", cJSON_GetObjectItemCaseSensitive(final, "sp")->valueint, cpu->sp);
+#endif
+            numFailed++;
+        }
+        // The tables, not just the handler, have to agree with the test
+        char expectedAccess[16];
+        const char* access = cycles == info->takenCycles ? info->takenAccess : info->access;
+        json_access(cJSON_GetObjectItemCaseSensitive(testJson, "cycles"), expectedAccess, sizeof(expectedAccess));
+        if (strcmp(access, expectedAccess) != 0)
+        {
+#if LOG_LEVEL > 1
+            printf("\tIncorrect bus accesses \t| Expected: %s;\t Table: %s\n", expectedAccess, access);
 #endif
             numFailed++;
         }
@@ -193,8 +245,449 @@ int run_test(int fileIndex)
     printf(numFailed == 0 ? "ALL TESTS PASS\n" : "%d TESTS FAILED\n", numFailed);
 #endif
 
+#if JIT
+    free_block_cache(blockCache);
+#endif
+
     free(buffer);
     cJSON_Delete(json);
 
     return numFailed;
 }
+
+#if FUSION
+
+// Loads one of the fused idioms at a random address with random operands.
+// Returns the PC right after the idiom.
+static uint16_t load_fusion_case(Memory* mem, CPU* cpu, int kind)
+{
+    static const uint8_t copyLoop[] = { 0x2a, 0x12, 0x13, 0x0b, 0x78, 0xb1, 0x20, 0xf8 };
+    static const uint8_t jrInsts[] = { 0x20, 0x28, 0x30, 0x38 };
+
+    for (int addr = 0; addr < 0xff00; addr++) mem->ram[addr] = rand();
+
+    cpu->a = rand();
+    write_flags(cpu, rand() & 0xf0);
+    cpu->bc = rand();
+    cpu->de = rand();
+    cpu->hl = rand();
+    cpu->sp = 0xfff0;
+
+    // Code sometimes sits in WRAM, where the copies can overwrite it
+    uint16_t pc = (rand() & 1) ? 0x100 + rand() % 0x7000 : 0xc000 + rand() % 0x1000;
+    cpu->pc = pc;
+
+    switch (kind)
+    {
+        case 0:
+        {
+            memcpy(&mem->ram[pc], copyLoop, sizeof(copyLoop));
+
+            // Mostly short copies around WRAM so source, destination and code
+            // overlap now and then
+            cpu->bc = 1 + rand() % 600;
+            cpu->hl = 0xc000 + rand() % 0x1800;
+            cpu->de = (rand() & 3) ? 0xc000 + rand() % 0x1800 : cpu->hl + rand() % 16 - 8;
+            if ((rand() & 7) == 0)
+            {
+                // Reads from I/O space can't be fused
+                cpu->hl = 0xfe00 + rand() % 0x80;
+                cpu->bc = 1 + rand() % 300;
+            }
+
+            return pc + sizeof(copyLoop);
+        }
+        case 1:
+        {
+            int reg = rand() % 7;
+            if (reg == 6) reg = 7;
+
+            mem->ram[pc] = 0x05 | (reg << 3);
+            mem->ram[pc + 1] = 0x20;
+            mem->ram[pc + 2] = 0xfd;
+
+            return pc + 3;
+        }
+        default:
+        {
+            uint8_t port = rand();
+            mem->ram[pc] = 0xf0;
+            mem->ram[pc + 1] = port;
+            mem->ram[pc + 2] = 0xfe;
+            mem->ram[pc + 3] = (rand() & 1) ? mem->ram[0xff00 | port] : rand();
+            mem->ram[pc + 4] = jrInsts[rand() % 4];
+            mem->ram[pc + 5] = rand();
+
+            return pc + 6;
+        }
+    }
+}
+
+// Runs the idioms the block cache fuses with fusion on and off from the same
+// random states and compares registers, cycles and memory afterwards
+int run_fusion_test(int numCases)
+{
+    int numFailed = 0;
+    uint64_t fusedRuns = 0;
+    srand(1);
+
+    for (int i = 0; i < numCases; i++)
+    {
+        int kind = i % 3;
+        unsigned int seed = rand();
+
+        Memory* mems[2];
+        CPU* cpus[2];
+        uint16_t endPc;
+
+        for (int fuse = 0; fuse < 2; fuse++)
+        {
+            mems[fuse] = make_memory();
+            cpus[fuse] = make_cpu(mems[fuse]);
+            cpus[fuse]->blockCache = make_block_cache();
+            cpus[fuse]->blockCache->fuse = fuse;
+
+            srand(seed);
+            endPc = load_fusion_case(mems[fuse], cpus[fuse], kind);
+
+            CPU* cpu = cpus[fuse];
+            if (kind == 2)
+            {
+                execute_block(cpu);
+            }
+            else
+            {
+                // A copy that overwrote the loop may never get to endPc
+                while (cpu->pc != endPc && cpu->cycles < 1000000) execute_block(cpu);
+            }
+        }
+
+        CPU* a = cpus[0];
+        CPU* b = cpus[1];
+        uint16_t afA = (a->a << 8) | read_flags(a);
+        uint16_t afB = (b->a << 8) | read_flags(b);
+
+        if (afA != afB || a->bc != b->bc || a->de != b->de || a->hl != b->hl || a->sp != b->sp || a->pc != b->pc ||
+            a->cycles != b->cycles || memcmp(mems[0]->ram, mems[1]->ram, sizeof(mems[0]->ram)))
+        {
+#if LOG_LEVEL > 1
+            printf("\tFusion case %d (kind %d) differs\t| Unfused: AF=%04x BC=%04x DE=%04x HL=%04x PC=%04x cycles=%llu;\t Fused: AF=%04x BC=%04x DE=%04x HL=%04x PC=%04x cycles=%llu\n",
+                i, kind, afA, a->bc, a->de, a->hl, a->pc, (unsigned long long)a->cycles,
+                afB, b->bc, b->de, b->hl, b->pc, (unsigned long long)b->cycles);
+#endif
+            numFailed++;
+        }
+
+        fusedRuns += b->blockCache->fusedRuns;
+
+        for (int fuse = 0; fuse < 2; fuse++)
+        {
+            free_block_cache(cpus[fuse]->blockCache);
+            free(cpus[fuse]);
+            free(mems[fuse]);
+        }
+    }
+
+#if LOG_LEVEL > 0
+    printf("%d fusion cases, %llu fused runs\n", numCases, (unsigned long long)fusedRuns);
+    printf(numFailed == 0 ? "ALL TESTS PASS\n" : "%d TESTS FAILED\n", numFailed);
+#endif
+
+    return numFailed;
+}
+
+#endif
+
+// Cycles each timer case runs for
+#define TIMER_CASE_CYCLES 300000
+
+typedef struct TimerProgram
+{
+    uint8_t code[0x7000];
+    int length;
+} TimerProgram;
+
+static void emit_bytes(TimerProgram* program, const uint8_t* bytes, int count)
+{
+    memcpy(&program->code[program->length], bytes, count);
+    program->length += count;
+}
+
+#define EMIT(program, ...) emit_bytes(program, (const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+static void emit_nops(TimerProgram* program, int count)
+{
+    memset(&program->code[program->length], 0x00, count);
+    program->length += count;
+}
+
+static uint8_t pick(const uint8_t* choices, int count)
+{
+    return choices[rand() % count];
+}
+
+#define PICK(...) pick((const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+// A random program at 0x100 that pokes and reads the timer registers the
+// ways the edge cases hide in: DIV and TAC writes mid-count, TIMA and TMA
+// around the overflow and reload, read-modify-writes of TIMA including CB
+// ops, HALT until the interrupt and polling loops. Reads are logged from
+// 0xc000 up through HL, and with interrupts the handler logs TIMA and DIV
+// and counts itself at 0xc300. The LCD is turned off so VBlank stays out of
+// the way.
+static void make_timer_program(TimerProgram* program, bool interrupts)
+{
+    program->length = 0;
+
+    EMIT(program, 0xf3, 0x3e, 0x00, 0xe0, 0x40, 0x31, 0xf0, 0xdf, 0x21, 0x00, 0xc0, 0x11, 0x05, 0xff);
+    EMIT(program, 0x3e, interrupts ? 1 << INT_TIMER : 0, 0xe0, 0xff);
+
+    uint8_t tac = 0xf8;
+    int steps = 20 + rand() % 101;
+
+    for (int step = 0; step < steps; step++)
+    {
+        switch (rand() % 14)
+        {
+            case 0:
+            {
+                uint8_t port = PICK(0x04, 0x05, 0x06, 0x07, 0x07, 0x0f);
+                uint8_t value = rand();
+                if (port == 0x07) value = tac = (rand() & 7) | (rand() % 5 ? 4 : 0);
+
+                EMIT(program, 0x3e, value, 0xe0, port);
+                break;
+            }
+            case 1:
+                EMIT(program, 0xf0, PICK(0x04, 0x05, 0x05, 0x06, 0x07, 0x0f), 0x22);
+                break;
+            case 2:
+                emit_nops(program, rand() % 40);
+                break;
+            case 3:
+                EMIT(program, 0x0e, PICK(0x04, 0x05, 0x0f), 0xf2, 0x22);
+                break;
+            case 4:
+                EMIT(program, 0x0e, PICK(0x04, 0x05, 0x06), 0x3e, rand(), 0xe2);
+                break;
+            case 5:
+                if (rand() & 1) EMIT(program, 0xfa, 0x05, 0xff, 0x22);
+                else EMIT(program, 0x3e, rand(), 0xea, PICK(0x04, 0x05, 0x06), 0xff);
+                break;
+            case 6:
+                if (rand() & 1) EMIT(program, 0x1a, 0x22);
+                else EMIT(program, 0x3e, PICK(0xfe, 0xff, 0x00, 0x80), 0x12);
+                break;
+            case 7:
+            {
+                // Read-modify-write of TIMA through HL
+                uint8_t bit = (rand() & 7) << 3;
+
+                EMIT(program, 0xe5, 0x21, 0x05, 0xff);
+                switch (rand() % 7)
+                {
+                    case 0: EMIT(program, 0x34); break;
+                    case 1: EMIT(program, 0x35); break;
+                    case 2: EMIT(program, 0xcb, 0x86 | bit); break;
+                    case 3: EMIT(program, 0xcb, 0xc6 | bit); break;
+                    case 4: EMIT(program, 0xcb, 0x46 | bit); break;
+                    case 5: EMIT(program, 0xcb, 0x36); break;
+                    default: EMIT(program, 0x36, rand()); break;
+                }
+                EMIT(program, 0xe1);
+                break;
+            }
+            case 8:
+                // Wait for DIV's low bits to clear
+                EMIT(program, 0xf0, 0x04, 0xe6, PICK(1, 3, 7), 0x20, 0xfa, 0xf0, 0x04, 0x22);
+                break;
+            case 9:
+                EMIT(program, 0x06, 1 + rand() % 59, 0x05, 0x20, 0xfd);
+                break;
+            case 10:
+                // HALT until the timer interrupt, taken or only flagged
+                if (!(tac & 4)) break;
+                if (interrupts) EMIT(program, 0xfb, 0x76, 0x00, 0xf0, 0x05, 0x22);
+                else EMIT(program, 0x3e, 0x00, 0xe0, 0x0f, 0x76, 0x00, 0xf0, 0x0f, 0x22);
+                break;
+            case 11:
+                if (interrupts) EMIT(program, rand() % 5 < 3 ? 0xfb : 0xf3);
+                break;
+            case 12:
+                // TIMA about to overflow, with TMA written meanwhile
+                EMIT(program, 0x3e, PICK(0xfe, 0xff, 0xfd), 0xe0, 0x05, 0x3e, rand(), 0xe0, 0x06);
+                emit_nops(program, rand() % 20);
+                EMIT(program, 0xf0, 0x05, 0x22, 0xf0, 0x0f, 0x22);
+                break;
+            default:
+                // Poll IF for the timer bit
+                if (!(tac & 4)) break;
+                EMIT(program, 0x3e, 0x00, 0xe0, 0x0f, 0xf0, 0x0f, 0xe6, 0x04, 0x28, 0xfa, 0xf0, 0x04, 0x22, 0xf0, 0x05, 0x22);
+                break;
+        }
+    }
+
+    EMIT(program, 0xf3, 0x7c, 0xea, 0xf0, 0xc3, 0x7d, 0xea, 0xf1, 0xc3, 0x18, 0xfe);
+}
+
+static Emulator* run_timer_program(const TimerProgram* program, bool eager, bool blockCache)
+{
+    static const uint8_t handler[] = { 0xf5, 0xf0, 0x05, 0x22, 0xf0, 0x04, 0x22, 0xfa, 0x00, 0xc3, 0x3c, 0xea, 0x00, 0xc3, 0xf1, 0xd9 };
+
+    Emulator* emu = make_emulator(false);
+    memcpy(&emu->mem.ram[0x50], handler, sizeof(handler));
+    memcpy(&emu->mem.ram[0x100], program->code, program->length);
+
+    emu->timer.eager = eager;
+    reset_timer(&emu->timer);
+
+#if BLOCK_CACHE
+    if (blockCache) emu->cpu.blockCache = make_block_cache();
+#endif
+
+    run_until(&emu->cpu, TIMER_CASE_CYCLES);
+
+#if BLOCK_CACHE
+    free_block_cache(emu->cpu.blockCache);
+    emu->cpu.blockCache = NULL;
+#endif
+
+    return emu;
+}
+
+// Shaped like the mooneye-gb timer tests: wait for VBlank by polling LY,
+// switch the LCD off, start TIMA two counts short of overflow with TMA 0x42
+// right after clearing DIV, wait `nops`, check TIMA, switch the LCD back on,
+// wait for line 5 and check DIV, wait for VBlank again and end on LD B,B with
+// the Fibonacci registers for a pass or 0x42 in all of them for a fail.
+static void make_lcd_program(TimerProgram* program, int nops, uint8_t expectedTima, uint8_t expectedDiv)
+{
+    static const uint8_t pass[] = { 0x06, 3, 0x0e, 5, 0x16, 8, 0x1e, 13, 0x26, 21, 0x2e, 34, 0x40, 0x18, 0xfe };
+
+    program->length = 0;
+
+    EMIT(program, 0xf3, 0x31, 0xfe, 0xff);
+    EMIT(program, 0xf0, 0x44, 0xfe, 0x90, 0x20, 0xfa);
+    EMIT(program, 0xaf, 0xe0, 0x40);
+    EMIT(program, 0xe0, 0x04, 0x3e, 0x05, 0xe0, 0x07, 0x3e, 0xfe, 0xe0, 0x05, 0x3e, 0x42, 0xe0, 0x06);
+    emit_nops(program, nops);
+
+    // JR NZ to the fail signature past the rest, which is laid out below
+    EMIT(program, 0xf0, 0x05, 0xfe, expectedTima, 0x20, 22 + sizeof(pass));
+    EMIT(program, 0x3e, 0x91, 0xe0, 0x40);
+    EMIT(program, 0xf0, 0x44, 0xfe, 0x05, 0x20, 0xfa);
+    EMIT(program, 0xf0, 0x04, 0xfe, expectedDiv, 0x20, 6 + sizeof(pass));
+    EMIT(program, 0xf0, 0x44, 0xfe, 0x90, 0x20, 0xfa);
+    emit_bytes(program, pass, sizeof(pass));
+    EMIT(program, 0x06, 0x42, 0x48, 0x50, 0x58, 0x60, 0x68, 0x40, 0x18, 0xfe);
+}
+
+static bool lcd_program_passed(Emulator* emu)
+{
+    CPU* cpu = &emu->cpu;
+
+    return cpu->b == 3 && cpu->c == 5 && cpu->d == 8 && cpu->e == 13 && cpu->h == 21 && cpu->l == 34;
+}
+
+static bool same_timer_run(Emulator* a, Emulator* b)
+{
+    CPU* x = &a->cpu;
+    CPU* y = &b->cpu;
+
+    return x->a == y->a && read_flags(x) == read_flags(y) && x->bc == y->bc && x->de == y->de && x->hl == y->hl &&
+        x->sp == y->sp && x->pc == y->pc && x->ime == y->ime && x->halted == y->halted &&
+        memcmp(&a->mem.ram[0xc000], &b->mem.ram[0xc000], 0x2000) == 0;
+}
+
+// Runs random timer programs on the lazy timer and on the eager one, which
+// ticks every M-cycle, and compares registers and the logged reads. With the
+// block cache built in, the lazy timer also runs under it on the cases
+// without interrupts. Then the LCD programs run on both timers and the block
+// cache and have to pass.
+int run_timer_test(int numCases)
+{
+    int numFailed = 0;
+    srand(1);
+
+    TimerProgram* program = malloc(sizeof(TimerProgram));
+
+    for (int i = 0; i < numCases; i++)
+    {
+        make_timer_program(program, i & 1);
+
+        Emulator* eager = run_timer_program(program, true, false);
+        Emulator* lazy = run_timer_program(program, false, false);
+
+        if (!same_timer_run(eager, lazy))
+        {
+#if LOG_LEVEL > 1
+            printf("\tTimer case %d differs\t| Eager: PC=%04x HL=%04x;\t Lazy: PC=%04x HL=%04x\n",
+                i, eager->cpu.pc, eager->cpu.hl, lazy->cpu.pc, lazy->cpu.hl);
+#endif
+            numFailed++;
+        }
+
+#if BLOCK_CACHE
+        // Blocks take interrupts once they end, so only the cases without
+        // any come out the same as the interpreter
+        if (!(i & 1))
+        {
+            Emulator* blocks = run_timer_program(program, false, true);
+
+            if (!same_timer_run(eager, blocks))
+            {
+#if LOG_LEVEL > 1
+                printf("\tTimer case %d differs in blocks\t| Eager: PC=%04x HL=%04x;\t Blocks: PC=%04x HL=%04x\n",
+                    i, eager->cpu.pc, eager->cpu.hl, blocks->cpu.pc, blocks->cpu.hl);
+#endif
+                numFailed++;
+            }
+
+            free_emulator(blocks);
+        }
+#endif
+
+        free_emulator(eager);
+        free_emulator(lazy);
+    }
+
+    // Switching the LCD on starts LY over at line 0, so line 5 comes 570
+    // M-cycles after the LCDC write: (605 + nops) / 64 counts of DIV since
+    // it was cleared. TIMA reloads 17 M-cycles after DIV is cleared and
+    // counts every 4 after that.
+    static const struct { int nops; uint8_t tima; uint8_t div; } lcdCases[] = {
+        { 0, 0x42, 0x09 }, { 3, 0x43, 0x09 }, { 35, 0x4b, 0x0a }
+    };
+    int numLcdCases = sizeof(lcdCases) / sizeof(lcdCases[0]);
+
+    for (int i = 0; i < numLcdCases; i++)
+    {
+        make_lcd_program(program, lcdCases[i].nops, lcdCases[i].tima, lcdCases[i].div);
+
+        for (int run = 0; run < 3; run++)
+        {
+            if (run == 2 && !BLOCK_CACHE) continue;
+
+            Emulator* emu = run_timer_program(program, run == 0, run == 2);
+
+            if (!lcd_program_passed(emu))
+            {
+#if LOG_LEVEL > 1
+                printf("\tLCD case %d failed in run %d\t| B=%02x C=%02x PC=%04x\n", i, run, emu->cpu.b, emu->cpu.c, emu->cpu.pc);
+#endif
+                numFailed++;
+            }
+
+            free_emulator(emu);
+        }
+    }
+
+    free(program);
+
+#if LOG_LEVEL > 0
+    printf("%d timer cases, %d LCD cases\n", numCases, numLcdCases);
+    printf(numFailed == 0 ? "ALL TESTS PASS\n" : "%d TESTS FAILED\n", numFailed);
+#endif
+
+    return numFailed;
+}
@@ -3,4 +3,10 @@
 #include "memory.h"
 #include "cpu.h"
 
-int run_test(int fileIndex);
\ No newline at end of file
+int run_test(int fileIndex);
+
+#if FUSION
+int run_fusion_test(int numCases);
+#endif
+
+int run_timer_test(int numCases);
@@ -0,0 +1,261 @@
+#include <string.h>
+
+#include "timer.h"
+#include "cpu.h"
+#include "io.h"
+#include "scheduler.h"
+
+// Internal counter the DMG boot ROM hands over with
+#define BOOT_COUNTER 0xabcc
+
+#define TAC_ENABLE 0x04
+
+// Counter bit TIMA counts the falling edges of, per TAC clock select: every
+// 1024, 16, 64 or 256 clocks
+static const uint16_t clockBits[4] = { 1 << 9, 1 << 3, 1 << 5, 1 << 7 };
+
+// The signal TIMA counts edges of
+static bool timer_signal(uint8_t tac, uint64_t counter)
+{
+    return (tac & TAC_ENABLE) && (counter & clockBits[tac & 3]);
+}
+
+// Counter value of the overflow edge, with TIMA at its value as of counter
+static uint64_t overflow_counter(Timer* timer)
+{
+    uint64_t period = clockBits[timer->tac & 3] << 1;
+
+    return (timer->counter / period + 0x100 - timer->tima) * period;
+}
+
+static void increment_tima(Timer* timer, uint64_t cycle)
+{
+    if (++timer->tima == 0) timer->overflowCycle = cycle;
+}
+
+// One M-cycle of the eager timer: the reload if TIMA overflowed on the last
+// one, then the counter and the edge that may make
+static void tick(Timer* timer)
+{
+    timer->syncCycle++;
+
+    if (timer->overflowCycle != TIMER_NEVER)
+    {
+        timer->tima = timer->tma;
+        timer->reloadCycle = timer->syncCycle;
+        timer->overflowCycle = TIMER_NEVER;
+
+        timer->cpu->mem->ram[REG_IF] |= 1 << INT_TIMER;
+        timer->cpu->checkState = true;
+    }
+
+    bool signal = timer_signal(timer->tac, timer->counter);
+    timer->counter += 4;
+    if (signal && !timer_signal(timer->tac, timer->counter)) increment_tima(timer, timer->syncCycle);
+}
+
+// Brings the timer up to cycle, reloading and requesting the interrupt for
+// every overflow on the way
+static void catch_up(Timer* timer, uint64_t cycle)
+{
+    Memory* mem = timer->cpu->mem;
+
+    if (timer->eager)
+    {
+        while (cycle > timer->syncCycle) tick(timer);
+        return;
+    }
+
+    while (cycle > timer->syncCycle)
+    {
+        // Edges are at least 4 cycles apart, so none comes between an
+        // overflow and its reload
+        if (timer->overflowCycle != TIMER_NEVER)
+        {
+            uint64_t reload = timer->overflowCycle + 1;
+            if (reload > cycle) break;
+
+            timer->counter += 4 * (reload - timer->syncCycle);
+            timer->syncCycle = reload;
+            timer->tima = timer->tma;
+            timer->reloadCycle = reload;
+            timer->overflowCycle = TIMER_NEVER;
+
+            mem->ram[REG_IF] |= 1 << INT_TIMER;
+            timer->cpu->checkState = true;
+            continue;
+        }
+
+        uint64_t counter = timer->counter + 4 * (cycle - timer->syncCycle);
+        uint64_t period = clockBits[timer->tac & 3] << 1;
+        uint64_t edges = timer->tac & TAC_ENABLE ? counter / period - timer->counter / period : 0;
+
+        if (timer->tima + edges <= 0xff)
+        {
+            timer->tima += edges;
+            timer->counter = counter;
+            timer->syncCycle = cycle;
+            break;
+        }
+
+        // Up to the overflow, then round again for the reload
+        uint64_t overflow = overflow_counter(timer);
+        timer->syncCycle += (overflow - timer->counter) / 4;
+        timer->counter = overflow;
+        timer->tima = 0;
+        timer->overflowCycle = timer->syncCycle;
+    }
+}
+
+// The event is the reload after the next overflow, which is all the timer does
+// without being accessed
+static void schedule_reload(Timer* timer)
+{
+    Scheduler* scheduler = timer->cpu->mem->scheduler;
+
+    // Every cycle, with IF always caught up
+    if (timer->eager)
+    {
+        timer->reloadDue = 0;
+        schedule_event(scheduler, EVENT_TIMER, timer->syncCycle + 1);
+        return;
+    }
+
+    if (timer->overflowCycle != TIMER_NEVER)
+    {
+        timer->reloadDue = timer->overflowCycle + 1;
+    }
+    else if (timer->tac & TAC_ENABLE)
+    {
+        uint64_t overflow = overflow_counter(timer);
+        timer->reloadDue = timer->syncCycle + (overflow - timer->counter) / 4 + 1;
+    }
+    else
+    {
+        timer->reloadDue = TIMER_NEVER;
+        cancel_event(scheduler, EVENT_TIMER);
+        return;
+    }
+
+    schedule_event(scheduler, EVENT_TIMER, timer->reloadDue);
+}
+
+// Whether a reload may have happened by the access in progress, which is no
+// more than 5 M-cycles into its instruction. IF is accessed on every
+// interrupt check and only needs the timer caught up when this is true.
+static bool reload_due(Timer* timer)
+{
+    CPU* cpu = timer->cpu;
+
+    return timer->reloadDue <= cpu->cycles + cpu->blockCycles + 5;
+}
+
+static void timer_event(Memory* mem, uint64_t cycle)
+{
+    catch_up(mem->timer, cycle);
+    schedule_reload(mem->timer);
+}
+
+void init_timer(Timer* timer, CPU* cpu)
+{
+    memset(timer, 0, sizeof(Timer));
+    timer->cpu = cpu;
+
+    cpu->mem->timer = timer;
+    set_event_handler(cpu->mem->scheduler, EVENT_TIMER, timer_event);
+}
+
+void reset_timer(Timer* timer)
+{
+    timer->syncCycle = timer->cpu->cycles;
+    timer->counter = BOOT_COUNTER;
+    timer->tima = timer->cpu->mem->ram[REG_TIMA];
+    timer->tma = timer->cpu->mem->ram[REG_TMA];
+    timer->tac = timer->cpu->mem->ram[REG_TAC];
+    timer->overflowCycle = TIMER_NEVER;
+    timer->reloadCycle = TIMER_NEVER;
+
+    schedule_reload(timer);
+}
+
+uint8_t timer_read(Memory* mem, uint8_t port)
+{
+    Timer* timer = mem->timer;
+    uint8_t value = mem->ram[IO_BASE | port];
+
+    if (!timer) return port == (REG_IF & 0xff) ? value | 0xe0 : value;
+
+    switch (port)
+    {
+        case REG_DIV & 0xff:
+            mem->clockedReads++;
+            return (timer->counter + 4 * (access_cycle(timer->cpu, false) - timer->syncCycle)) >> 8;
+
+        case REG_TIMA & 0xff:
+            mem->clockedReads++;
+            catch_up(timer, access_cycle(timer->cpu, false));
+            return timer->tima;
+
+        default:
+            if (reload_due(timer)) catch_up(timer, access_cycle(timer->cpu, false));
+            return mem->ram[REG_IF] | 0xe0;
+    }
+}
+
+void timer_write(Memory* mem, uint8_t port, uint8_t value)
+{
+    Timer* timer = mem->timer;
+
+    if (!timer)
+    {
+        if (port == (REG_DIV & 0xff)) mem->ram[REG_DIV] = 0;
+        return;
+    }
+
+    // IF is stored again once the timer is caught up, so a reload before the
+    // write doesn't override it
+    if (port == (REG_IF & 0xff))
+    {
+        if (!reload_due(timer)) return;
+
+        catch_up(timer, access_cycle(timer->cpu, true));
+        mem->ram[REG_IF] = (mem->ram[REG_IF] & ~0x1f) | (value & 0x1f);
+        return;
+    }
+
+    uint64_t cycle = access_cycle(timer->cpu, true);
+    catch_up(timer, cycle);
+
+    switch (port)
+    {
+        case REG_DIV & 0xff:
+            // Clearing the counter is a falling edge if the selected bit was set
+            if (timer_signal(timer->tac, timer->counter)) increment_tima(timer, cycle);
+            timer->counter = 0;
+            break;
+
+        case REG_TIMA & 0xff:
+            // Lost to TMA on the reload cycle. On the overflow cycle it sticks
+            // and the reload and interrupt never happen.
+            if (timer->reloadCycle == cycle) break;
+
+            timer->tima = value;
+            timer->overflowCycle = TIMER_NEVER;
+            break;
+
+        case REG_TMA & 0xff:
+            // On the reload cycle TIMA takes the new value too
+            timer->tma = value;
+            if (timer->reloadCycle == cycle) timer->tima = value;
+            break;
+
+        case REG_TAC & 0xff:
+            // Turning the timer off, or selecting a bit that is clear, while
+            // the selected bit is set is a falling edge too
+            if (timer_signal(timer->tac, timer->counter) && !timer_signal(value, timer->counter)) increment_tima(timer, cycle);
+            timer->tac = value;
+            break;
+    }
+
+    schedule_reload(timer);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memory.h"
+
+// DIV, TIMA, TMA and TAC without ticking anything. DIV is the top byte of a
+// counter that goes up by 4 every M-cycle, so it is worked out from the cycle
+// counter when read. TIMA goes up on each falling edge of the counter bit TAC
+// selects, and those come at fixed multiples of the counter, so it is caught
+// up by division whenever one of the registers is accessed. The only event is
+// the reload after the next overflow, which requests the interrupt.
+//
+// Accesses are timed to their M-cycle within the instruction (access_cycle),
+// with the counter ticking before the access, which is what the overflow and
+// reload edge cases depend on.
+
+struct CPU;
+
+typedef struct Timer
+{
+    struct CPU* cpu;
+
+    // Everything below is as of this cycle
+    uint64_t syncCycle;
+
+    // The internal counter, DIV being bits 8-15. Not wrapped at 16 bits, so the
+    // TIMA edges between two values are a difference of quotients.
+    uint64_t counter;
+
+    uint8_t tima;
+    uint8_t tma;
+    uint8_t tac;
+
+    // Cycle TIMA overflowed on, reading 0 until TMA is loaded the cycle
+    // after, and the cycle of the last reload; TIMER_NEVER for neither
+    uint64_t overflowCycle;
+    uint64_t reloadCycle;
+
+    // When the event for the next reload is due, TIMER_NEVER with none
+    uint64_t reloadDue;
+
+    // Ticks the counter one M-cycle at a time on an event every cycle
+    // instead, the slow way round the lazy one is checked against. Takes
+    // effect on reset_timer.
+    bool eager;
+} Timer;
+
+#define TIMER_NEVER UINT64_MAX
+
+// Attaches timer to the CPU's memory and handles its event on the scheduler
+// already attached there. reset_timer then starts it.
+void init_timer(Timer* timer, struct CPU* cpu);
+
+// The state the DMG boot ROM leaves, as of the CPU's cycle counter
+void reset_timer(Timer* timer);
+
+// io_registers handlers for DIV, TIMA, TMA, TAC and IF, which the timer
+// requests its interrupt in. Without a timer attached, DIV only clears on
+// writes and the rest are plain registers.
+uint8_t timer_read(Memory* mem, uint8_t port);
+void timer_write(Memory* mem, uint8_t port, uint8_t value);